@@ -0,0 +1,255 @@
+#!/bin/sh
+# bench.sh -- Benchmark msend/mreceive, and ttcp, in network namespaces
+#
+# Runs every combination of topology, engine, threads, payload size, and
+# rate, each for a few seconds, and writes one tab separated row per run
+# to the results file.  Needs root, iproute2, and timeout(1).
+#
+# Topologies:
+#   veth   sender and receiver in namespaces of their own, veth pair
+#   lo     both in one namespace, loopback only
+#
+# The matrix is set in the environment, e.g.:
+#   BENCH_SIZES="64 1472" BENCH_RATES="max 100k" bench/bench.sh -o new.tsv
+#
+# Columns, - when not applicable:
+#   tool topo engine threads size rate     the run
+#   tx_pps tx_mbps rx_pps rx_mbps          as reported by sender/receiver
+#   loss_pct                               sent but not received
+#   p50_us p99_us p999_us                  one-way latency, mreceive -L
+#   tx_ns_pkt rx_ns_pkt                    CPU time, user + sys, per packet
+set -u
+
+TOPOS=${BENCH_TOPOS:-veth lo}
+ENGINES=${BENCH_ENGINES:-socket uring packet}
+THREADS=${BENCH_THREADS:-1 2}
+SIZES=${BENCH_SIZES:-64 512 1472}
+RATES=${BENCH_RATES:-max 100k}
+TIME=${BENCH_TIME:-3}
+TTCP_MB=${BENCH_TTCP_MB:-256}
+
+BIN=$(cd "$(dirname "$0")/.." && pwd)
+OUT=bench.tsv
+NS=mtb
+GROUP=225.1.2.3
+PORT=4444
+TMP=
+
+usage()
+{
+	cat <<EOF
+Usage: $0 [-h] [-o FILE]
+
+  -h        This help text
+  -o FILE   Results file.  Default: $OUT
+
+Environment, lists are space separated:
+  BENCH_TOPOS    veth, lo.  Default: $TOPOS
+  BENCH_ENGINES  msend/mreceive -e.  Default: $ENGINES
+  BENCH_THREADS  msend/mreceive -T.  Default: $THREADS
+  BENCH_SIZES    UDP payload, msend -s, ttcp -l.  Default: $SIZES
+  BENCH_RATES    msend -R, or max.  Default: $RATES
+  BENCH_TIME     Seconds per run.  Default: $TIME
+  BENCH_TTCP_MB  MiB per ttcp run.  Default: $TTCP_MB
+EOF
+	exit "$1"
+}
+
+die()
+{
+	echo "$0: $*" >&2
+	exit 1
+}
+
+teardown()
+{
+	for ns in tx rx lo; do
+		ip netns del $NS-$ns 2>/dev/null
+	done
+}
+
+cleanup()
+{
+	teardown
+	[ -n "$TMP" ] && rm -rf "$TMP"
+}
+
+# Sender in $NS-tx, receiver in $NS-rx, or both in $NS-lo
+setup()
+{
+	teardown
+	case $1 in
+	veth)
+		ip netns add $NS-tx && ip netns add $NS-rx || return 1
+		ip link add ${NS}0 netns $NS-tx type veth peer name ${NS}1 netns $NS-rx || return 1
+		ip -n $NS-tx addr add 10.77.0.1/24 dev ${NS}0
+		ip -n $NS-rx addr add 10.77.0.2/24 dev ${NS}1
+		for ns in tx rx; do
+			ip -n $NS-$ns link set lo up
+		done
+		ip -n $NS-tx link set ${NS}0 up
+		ip -n $NS-rx link set ${NS}1 up
+		TXNS=$NS-tx TXIF=${NS}0
+		RXNS=$NS-rx RXIF=${NS}1
+		PEER=10.77.0.2
+		;;
+	lo)
+		ip netns add $NS-lo || return 1
+		ip -n $NS-lo link set lo up multicast on
+		TXNS=$NS-lo TXIF=lo
+		RXNS=$NS-lo RXIF=lo
+		PEER=127.0.0.1
+		;;
+	*)
+		die "unknown topology $1"
+		;;
+	esac
+	sleep 1		# DAD and carrier
+}
+
+# Run command in namespace, with a time limit, CPU time of it last, as
+# cutime and cstime from /proc, in clock ticks
+run()
+{
+	ns=$1 limit=$2
+	shift 2
+	ip netns exec "$ns" sh -c 'timeout -s INT "$@"; read -r s < /proc/$$/stat; echo "CPU ${s##*)}"' \
+		sh "$limit" "$@"
+}
+
+# Sum of child CPU time in ticks, from the CPU line of run()
+ticks()
+{
+	awk '/^CPU / { print $15 + $16 }' "$1"
+}
+
+row()
+{
+	printf '%s' "$1"
+	shift
+	for col; do
+		printf '\t%s' "$col"
+	done
+	printf '\n'
+}
+
+# ns per packet, from ticks and packets
+perpkt()
+{
+	awk -v t="$1" -v p="$2" -v hz="$HZ" 'BEGIN {
+		if (t == "" || p == "" || p == 0) print "-"; else printf "%.0f\n", t / hz * 1e9 / p
+	}'
+}
+
+run_mtools()
+{
+	topo=$1 engine=$2 threads=$3 size=$4 rate=$5
+
+	if [ "$rate" = max ]; then
+		pace="-P 0"
+	else
+		pace="-R $rate"
+	fi
+
+	run "$RXNS" $((TIME + 2)) "$BIN/mreceive" -I "$RXIF" -g $GROUP -p $PORT -e "$engine" \
+		-T "$threads" -n -q -L >"$TMP/rx" 2>&1 &
+	rxpid=$!
+	sleep 1
+	run "$TXNS" "$TIME" "$BIN/msend" -I "$TXIF" -g $GROUP -p $PORT -e "$engine" -T "$threads" \
+		-b 32 -s "$size" $pace -n -q >"$TMP/tx" 2>&1
+	wait $rxpid
+
+	# Totals are on the last Sent line, one Source line per sender thread
+	tx=$(sed -n 's/.*Sent \([0-9]*\) packets.* \([0-9.]*\) pps, \([0-9.]*\) Mbps.*/\1 \2 \3/p' "$TMP/tx" | tail -1)
+	rx=$(awk '/^Source / { for (i = 1; i < NF; i++) {
+			if ($(i+1) == "packets,") p += $i; if ($(i+1) == "pps,") r += $i
+			if ($(i+1) == "Mbps") m += $i }
+		  }
+		  END { printf "%d %.0f %.2f\n", p, r, m }' "$TMP/rx")
+	lat=$(sed -n 's/^Latency total:.* p50 \([0-9.]*\), p99 \([0-9.]*\), p99.9 \([0-9.]*\),.*/\1 \2 \3/p' "$TMP/rx")
+
+	# receiver outlives sender, anything not in by then is lost
+	set -- ${tx:-0 - -} $rx
+	loss=$(awk -v t="$1" -v r="$4" 'BEGIN { if (t > 0) printf "%.3f\n", 100 * (t - r) / t; else print "-" }')
+
+	set -- "$@" "$loss" ${lat:-- - -}
+	row mtools "$topo" "$engine" "$threads" "$size" "$rate" "$2" "$3" "$5" "$6" "$7" "$8" "$9" "${10}" \
+		"$(perpkt "$(ticks "$TMP/tx")" "$1")" "$(perpkt "$(ticks "$TMP/rx")" "$4")"
+}
+
+# Unicast stream, TCP or UDP, as fast as possible, ttcp -n from TTCP_MB
+run_ttcp()
+{
+	topo=$1 proto=$2 size=$3
+	num=$((TTCP_MB * 1048576 / size))
+	udp=
+
+	[ "$proto" = udp ] && udp=-u
+	run "$RXNS" $((TIME * 10)) "$BIN/ttcp" -r $udp -l"$size" >"$TMP/rx" 2>&1 &
+	rxpid=$!
+	sleep 1
+	run "$TXNS" $((TIME * 10)) "$BIN/ttcp" -t $udp -l"$size" -n"$num" "$PEER" >"$TMP/tx" 2>&1
+	wait $rxpid
+
+	# bytes, seconds, and I/O calls, a call is a packet for UDP and a write for TCP
+	tx=$(awk '/bytes in .* real seconds/ { b = $2; s = $5 } /I\/O calls/ { c = $2 }
+		END { if (s > 0) printf "%d %.0f %.2f\n", c, c / s, b * 8 / s / 1e6; else print "0 - -" }' "$TMP/tx")
+	rx=$(awk '/bytes in .* real seconds/ { b = $2; s = $5 } /I\/O calls/ { c = $2 }
+		END { if (s > 0) printf "%d %.0f %.2f %d\n", c, c / s, b * 8 / s / 1e6, b; else print "0 - - 0" }' "$TMP/rx")
+	loss=-
+	if [ -n "$udp" ]; then
+		loss=$(awk -v n="$num" -v s="$size" -v b="${rx##* }" 'BEGIN { printf "%.3f\n", 100 * (1 - b / (n * s)) }')
+	fi
+
+	set -- $tx $rx
+	row ttcp "$topo" "$proto" 1 "$size" max "$2" "$3" "$5" "$6" "$loss" - - - \
+		"$(perpkt "$(ticks "$TMP/tx")" "$1")" "$(perpkt "$(ticks "$TMP/rx")" "$4")"
+}
+
+while getopts "ho:" opt; do
+	case $opt in
+	h) usage 0 ;;
+	o) OUT=$OPTARG ;;
+	*) usage 1 ;;
+	esac
+done
+
+[ "$(id -u)" -eq 0 ] || die "must be run as root, for network namespaces"
+for bin in msend mreceive ttcp; do
+	[ -x "$BIN/$bin" ] || die "$BIN/$bin missing, run make first"
+done
+command -v timeout >/dev/null || die "timeout(1) missing"
+
+HZ=$(getconf CLK_TCK)
+TMP=$(mktemp -d) || exit 1
+trap cleanup EXIT
+trap 'exit 1' INT TERM
+
+{
+	echo "# mtools $("$BIN/msend" -v | awk '{ print $NF }'), Linux $(uname -r) $(uname -m), $(nproc) CPUs, $(date -u +%Y-%m-%dT%H:%M:%SZ)"
+	row tool topo engine threads size rate tx_pps tx_mbps rx_pps rx_mbps loss_pct \
+	    p50_us p99_us p999_us tx_ns_pkt rx_ns_pkt
+} >"$OUT"
+
+for topo in $TOPOS; do
+	setup "$topo" || die "cannot set up $topo, see above"
+	for engine in $ENGINES; do
+		for threads in $THREADS; do
+			for size in $SIZES; do
+				for rate in $RATES; do
+					echo "$topo $engine -T $threads -s $size -R $rate" >&2
+					run_mtools "$topo" "$engine" "$threads" "$size" "$rate" >>"$OUT"
+				done
+			done
+		done
+	done
+
+	for proto in tcp udp; do
+		for size in $SIZES; do
+			echo "$topo ttcp $proto -l $size" >&2
+			run_ttcp "$topo" "$proto" "$size" >>"$OUT"
+		done
+	done
+done
+
+echo "Results in $OUT" >&2
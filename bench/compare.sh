@@ -0,0 +1,128 @@
+#!/bin/sh
+# compare.sh -- Compare bench.sh results against a stored baseline
+#
+# Runs are matched on tool, topo, engine, threads, size, and rate.  A run
+# is a regression if received pps or Mbps drop, or p99 latency or CPU
+# per packet grow, by more than the threshold, or if loss grows by more
+# than the loss tolerance, in percentage points.  Exits 1 if any run
+# regressed, 0 otherwise.  Runs only in one of the files are listed.
+set -u
+
+THRESHOLD=10
+LOSS=0.5
+ALL=0
+
+usage()
+{
+	cat <<EOF
+Usage: $0 [-ah] [-l POINTS] [-t PERCENT] BASELINE RESULTS
+
+  -a          Show all runs, not only regressions
+  -h          This help text
+  -l POINTS   Loss tolerance, percentage points.  Default: $LOSS
+  -t PERCENT  Regression threshold.  Default: $THRESHOLD
+EOF
+	exit "$1"
+}
+
+while getopts "ahl:t:" opt; do
+	case $opt in
+	a) ALL=1 ;;
+	h) usage 0 ;;
+	l) LOSS=$OPTARG ;;
+	t) THRESHOLD=$OPTARG ;;
+	*) usage 1 ;;
+	esac
+done
+shift $((OPTIND - 1))
+[ $# -eq 2 ] || usage 1
+
+for file; do
+	[ -r "$file" ] || { echo "$0: cannot read $file" >&2; exit 1; }
+done
+
+awk -F '\t' -v thr="$THRESHOLD" -v tol="$LOSS" -v all="$ALL" '
+# file 1 is the baseline, 2 the results, the same file may be given twice
+FNR == 1 {
+	file++
+}
+/^#/ {
+	if (FNR == 1)
+		printf "%s %s\n", file == 1 ? "Baseline:" : "Results: ", substr($0, 3)
+	next
+}
+# Columns by name, from the header row of each file
+!(file in hdr) {
+	hdr[file] = 1
+	for (i = 1; i <= NF; i++)
+		col[file, $i] = i
+	next
+}
+function get(name) { return $col[file, name] }
+function known(v) { return v != "-" && v != "" }
+{
+	key = get("tool") " " get("topo") " " get("engine") " -T " get("threads") " -s " get("size") " -R " get("rate")
+	n = split("rx_pps rx_mbps loss_pct p99_us tx_ns_pkt rx_ns_pkt", m, " ")
+	for (i = 1; i <= n; i++)
+		val[file == 1, key, m[i]] = get(m[i])
+	if (file == 1) {
+		base[key] = 1
+		order[++nkeys] = key
+	} else {
+		curr[key] = 1
+		if (!(key in base))
+			order[++nkeys] = key
+	}
+}
+# Flag metric if it changed for the worse by more than the threshold
+function check(key, metric, higher_is_better,    b, c, d) {
+	b = val[1, key, metric]
+	c = val[0, key, metric]
+	if (!known(b) || !known(c) || b == 0)
+		return
+
+	d = 100 * (c - b) / b
+	if ((higher_is_better ? -d : d) > thr) {
+		bad = 1
+		line = line sprintf(" %s %s -> %s (%+.1f%%)", metric, b, c, d)
+	} else if (all) {
+		line = line sprintf(" %s %+.1f%%", metric, d)
+	}
+}
+END {
+	for (i = 1; i <= nkeys; i++) {
+		key = order[i]
+		if (!(key in curr)) {
+			printf "%-44s only in baseline\n", key
+			continue
+		}
+		if (!(key in base)) {
+			printf "%-44s new\n", key
+			continue
+		}
+
+		bad = 0
+		line = ""
+		check(key, "rx_pps", 1)
+		check(key, "rx_mbps", 1)
+		check(key, "p99_us", 0)
+		check(key, "tx_ns_pkt", 0)
+		check(key, "rx_ns_pkt", 0)
+		b = val[1, key, "loss_pct"]
+		c = val[0, key, "loss_pct"]
+		if (known(b) && known(c) && c - b > tol) {
+			bad = 1
+			line = line sprintf(" loss_pct %s -> %s", b, c)
+		}
+
+		if (bad) {
+			printf "%-44s REGRESSION%s\n", key, line
+			regressions++
+		} else if (all) {
+			printf "%-44s ok%s\n", key, line
+		}
+	}
+	printf "%d of %d runs regressed, threshold %s%%, loss tolerance %s points\n",
+		regressions, nkeys, thr, tol
+	exit regressions > 0
+}' "$1" "$2"
@@ -0,0 +1,499 @@
+/*
+ * capture.c -- Capture received datagrams to pcapng, written by a thread
+ *
+ * Receive threads only see UDP payloads, so each datagram is stored with
+ * a made up IPv4 or IPv6 and UDP header, LINKTYPE_RAW, carrying source,
+ * group and ports.  The timestamp is the kernel (or NIC) receive time if
+ * available, in nanoseconds.  UDP checksums are left zero.
+ *
+ * Every file starts with a section and interface header, so rotated
+ * files can be read on their own.  With more than one receive thread
+ * packets are only in order per thread, tools like Wireshark and
+ * `reordercap` sort them by time.
+ *
+ * The writer sleeps on a condition variable when no buffer is full, as
+ * the log writer does.  Hand-off is once per buffer, so receive threads
+ * can afford a fence then, to see if the writer needs waking.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <netinet/ip.h>
+#include <netinet/ip6.h>
+#include <netinet/udp.h>
+
+#include "capture.h"
+#include "pcap.h"
+
+#define EPB_OPTS  (sizeof(struct pcapng_opt) + 4 + sizeof(struct pcapng_opt))
+
+static struct capture *caps;
+static int             num_caps;
+static const char     *path;
+static uint64_t        maxsize;
+static uint64_t        maxtime;	/* ns */
+
+static int             fd = -1;
+static unsigned int    files;
+static uint64_t        written;
+static uint64_t        hdrlen;	/* of preamble, nothing written beyond */
+static uint64_t        opened;
+static int             done;
+static pthread_t       tid;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  wake = PTHREAD_COND_INITIALIZER;
+static int             idle;	/* writer sleeps, see handoff() */
+
+/* SIZE[k|M|G] bytes, or TIME[s|m|h], for rotating capture files */
+int capture_limit(const char *arg, uint64_t *size, uint64_t *secs)
+{
+	unsigned long long val;
+	char *end;
+
+	errno = 0;
+	val = strtoull(arg, &end, 10);
+	if (errno || !val)
+		return -1;
+
+	*size = *secs = 0;
+	switch (*end) {
+	case 'k':
+		*size = val << 10;
+		break;
+	case 'M':
+		*size = val << 20;
+		break;
+	case 'G':
+		*size = val << 30;
+		break;
+	case 's':
+		*secs = val;
+		break;
+	case 'm':
+		*secs = val * 60;
+		break;
+	case 'h':
+		*secs = val * 3600;
+		break;
+	default:
+		return -1;
+	}
+	if (end[1])
+		return -1;
+
+	return 0;
+}
+
+int capture_init(struct capture *c)
+{
+	memset(c, 0, sizeof(*c));
+	for (int i = 0; i < 2; i++) {
+		c->buf[i].data = malloc(CAPTURE_BUFSZ);
+		if (!c->buf[i].data)
+			return -1;
+	}
+
+	return 0;
+}
+
+static inline uint16_t csum(const void *data, size_t len)
+{
+	const uint16_t *p = data;
+	uint32_t sum = 0;
+
+	while (len > 1) {
+		sum += *p++;
+		len -= 2;
+	}
+	while (sum >> 16)
+		sum = (sum & 0xffff) + (sum >> 16);
+
+	return ~sum;
+}
+
+/* Made up network and transport header, returns its length */
+static size_t header(char *p, const inet_addr_t *src, const inet_addr_t *dst, size_t len)
+{
+	struct udphdr *udp;
+	size_t hlen;
+
+	if (src->ss_family == AF_INET6) {
+		const struct sockaddr_in6 *s6 = (const struct sockaddr_in6 *)src;
+		const struct sockaddr_in6 *d6 = (const struct sockaddr_in6 *)dst;
+		struct ip6_hdr *ip6 = (struct ip6_hdr *)p;
+
+		hlen = sizeof(*ip6);
+		memset(ip6, 0, hlen);
+		ip6->ip6_flow = htonl(6 << 28);
+		ip6->ip6_plen = htons(sizeof(*udp) + len);
+		ip6->ip6_nxt  = IPPROTO_UDP;
+		ip6->ip6_hlim = 1;
+		ip6->ip6_src  = s6->sin6_addr;
+		ip6->ip6_dst  = d6->sin6_addr;
+	} else {
+		const struct sockaddr_in *s4 = (const struct sockaddr_in *)src;
+		const struct sockaddr_in *d4 = (const struct sockaddr_in *)dst;
+		struct iphdr *ip = (struct iphdr *)p;
+
+		hlen = sizeof(*ip);
+		memset(ip, 0, hlen);
+		ip->version  = 4;
+		ip->ihl      = hlen / 4;
+		ip->tot_len  = htons(hlen + sizeof(*udp) + len);
+		ip->frag_off = htons(IP_DF);
+		ip->ttl      = 1;
+		ip->protocol = IPPROTO_UDP;
+		ip->saddr    = s4->sin_addr.s_addr;
+		ip->daddr    = d4->sin_addr.s_addr;
+		ip->check    = csum(ip, hlen);
+	}
+
+	udp = (struct udphdr *)&p[hlen];
+	udp->source = htons(inet_port(src));
+	udp->dest   = htons(inet_port(dst));
+	udp->len    = htons(sizeof(*udp) + len);
+	udp->check  = 0;
+
+	return hlen + sizeof(*udp);
+}
+
+/* Give current buffer to the writer, if it is done with the other one */
+static int handoff(struct capture *c)
+{
+	struct capbuf *next = &c->buf[!c->curr];
+
+	if (__atomic_load_n(&next->full, __ATOMIC_ACQUIRE))
+		return -1;
+
+	__atomic_store_n(&c->buf[c->curr].full, 1, __ATOMIC_RELEASE);
+	c->curr = !c->curr;
+
+	/* pairs with the fence in sleep_idle() */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&idle, __ATOMIC_RELAXED)) {
+		pthread_mutex_lock(&lock);
+		idle = 0;
+		pthread_cond_signal(&wake);
+		pthread_mutex_unlock(&lock);
+	}
+
+	return 0;
+}
+
+/* Append one datagram as an enhanced packet block, ts in ns */
+void capture_add(struct capture *c, uint64_t ts, const inet_addr_t *src,
+		 const inet_addr_t *dst, const void *data, size_t len)
+{
+	size_t hlen = src->ss_family == AF_INET6 ? sizeof(struct ip6_hdr) : sizeof(struct iphdr);
+	size_t caplen = hlen + sizeof(struct udphdr) + len;
+	size_t total = sizeof(struct pcapng_epb) + PCAPNG_PAD(caplen) + EPB_OPTS + 4;
+	struct capbuf *b = &c->buf[c->curr];
+	struct pcapng_epb *epb;
+	struct pcapng_opt *opt;
+	uint32_t flags = PCAPNG_EPB_INBOUND;
+	char *p;
+
+	if (CAPTURE_BUFSZ - b->len < total) {
+		if (total > CAPTURE_BUFSZ || handoff(c)) {
+			STAT_INC(c->dropped);
+			return;
+		}
+		b = &c->buf[c->curr];
+	}
+
+	p = &b->data[b->len];
+	epb = (struct pcapng_epb *)p;
+	epb->type    = PCAPNG_EPB;
+	epb->len     = total;
+	epb->ifid    = 0;
+	epb->ts_hi   = ts >> 32;
+	epb->ts_lo   = ts & 0xffffffff;
+	epb->caplen  = caplen;
+	epb->origlen = caplen;
+	p += sizeof(*epb);
+
+	p += header(p, src, dst, len);
+	memcpy(p, data, len);
+	p += len;
+	memset(p, 0, PCAPNG_PAD(caplen) - caplen);
+	p += PCAPNG_PAD(caplen) - caplen;
+
+	opt = (struct pcapng_opt *)p;
+	opt->code = PCAPNG_EPB_FLAGS;
+	opt->len  = sizeof(flags);
+	memcpy(&opt[1], &flags, sizeof(flags));
+	p += sizeof(*opt) + sizeof(flags);
+
+	opt = (struct pcapng_opt *)p;
+	opt->code = PCAPNG_OPT_END;
+	opt->len  = 0;
+	p += sizeof(*opt);
+
+	memcpy(p, &epb->len, sizeof(epb->len));
+
+	b->len += total;
+	STAT_INC(c->packets);
+}
+
+/* Called regularly by receive thread, hands over partial buffers */
+void capture_tick(struct capture *c, uint64_t now)
+{
+	struct capbuf *b = &c->buf[c->curr];
+
+	if (!b->len)
+		return;
+
+	if (!b->first)
+		b->first = now;
+	else if (now - b->first >= CAPTURE_FLUSH)
+		handoff(c);
+}
+
+static int writeall(const void *buf, size_t len)
+{
+	const char *p = buf;
+
+	while (len) {
+		ssize_t n = write(fd, p, len);
+
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		p   += n;
+		len -= n;
+	}
+	written += p - (const char *)buf;
+
+	return 0;
+}
+
+/* Section header and interface description, nanosecond timestamps */
+static int preamble(void)
+{
+	const char appl[] = "mreceive " VERSION;
+	uint64_t buf[32];
+	char *p = (char *)buf;
+	struct pcapng_shb *shb;
+	struct pcapng_idb *idb;
+	struct pcapng_opt *opt;
+	uint32_t len;
+
+	shb = (struct pcapng_shb *)p;
+	shb->type    = PCAPNG_SHB;
+	shb->bom     = PCAPNG_BOM;
+	shb->major   = 1;
+	shb->minor   = 0;
+	shb->section = -1;
+	p += sizeof(*shb);
+	opt = (struct pcapng_opt *)p;
+	opt->code = PCAPNG_SHB_APPL;
+	opt->len  = strlen(appl);
+	memset(&opt[1], 0, PCAPNG_PAD(opt->len));
+	memcpy(&opt[1], appl, opt->len);
+	p += sizeof(*opt) + PCAPNG_PAD(opt->len);
+	opt = (struct pcapng_opt *)p;
+	opt->code = PCAPNG_OPT_END;
+	opt->len  = 0;
+	p += sizeof(*opt);
+	len = p + 4 - (char *)shb;
+	memcpy(p, &len, 4);
+	shb->len = len;
+	p += 4;
+
+	idb = (struct pcapng_idb *)p;
+	idb->type     = PCAPNG_IDB;
+	idb->linktype = LINKTYPE_RAW;
+	idb->reserved = 0;
+	idb->snaplen  = 0;
+	p += sizeof(*idb);
+	opt = (struct pcapng_opt *)p;
+	opt->code = PCAPNG_IF_TSRESOL;
+	opt->len  = 1;
+	memset(&opt[1], 0, 4);
+	*(uint8_t *)&opt[1] = 9;	/* 10^-9 */
+	p += sizeof(*opt) + 4;
+	opt = (struct pcapng_opt *)p;
+	opt->code = PCAPNG_OPT_END;
+	opt->len  = 0;
+	p += sizeof(*opt);
+	len = p + 4 - (char *)idb;
+	memcpy(p, &len, 4);
+	idb->len = len;
+	p += 4;
+
+	return writeall(buf, p - (char *)buf);
+}
+
+/* Open next file, FILE, or FILE.NNNN.ext when rotating */
+static int next_file(void)
+{
+	char name[PATH_MAX];
+
+	if (fd >= 0)
+		close(fd);
+
+	if (maxsize || maxtime) {
+		const char *ext = strrchr(path, '.');
+
+		if (!ext || strchr(ext, '/'))
+			ext = path + strlen(path);
+		snprintf(name, sizeof(name), "%.*s.%04u%s", (int)(ext - path), path, files, ext);
+	} else {
+		snprintf(name, sizeof(name), "%s", path);
+	}
+
+	fd = open(name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		fprintf(stderr, "Failed opening capture file %s: %s\n", name, strerror(errno));
+		return -1;
+	}
+
+	files++;
+	written = 0;
+	opened  = clock_ns(CLOCK_MONOTONIC);
+	if (preamble())
+		return -1;
+	hdrlen = written;
+
+	return 0;
+}
+
+static void put(struct capbuf *b)
+{
+	if (fd >= 0) {
+		int rotate = 0;
+
+		if (maxsize && written + b->len > maxsize)
+			rotate = 1;
+		if (maxtime && clock_ns(CLOCK_MONOTONIC) - opened >= maxtime)
+			rotate = 1;
+		if (written == hdrlen)
+			rotate = 0;	/* at least one buffer per file */
+
+		if ((rotate && next_file()) || writeall(b->data, b->len)) {
+			perror("capture");
+			if (fd >= 0)
+				close(fd);
+			fd = -1;	/* stop capturing, keep receiving */
+		}
+	}
+
+	b->len   = 0;
+	b->first = 0;
+	__atomic_store_n(&b->full, 0, __ATOMIC_RELEASE);
+}
+
+/* No buffer full, sleep until handoff() or capture_stop() wakes us */
+static void sleep_idle(void)
+{
+	__atomic_store_n(&idle, 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+	/* a buffer handed off before the flag was seen would never wake us */
+	for (int i = 0; i < num_caps; i++) {
+		for (int j = 0; j < 2; j++) {
+			if (__atomic_load_n(&caps[i].buf[j].full, __ATOMIC_ACQUIRE)) {
+				__atomic_store_n(&idle, 0, __ATOMIC_RELAXED);
+				return;
+			}
+		}
+	}
+
+	pthread_mutex_lock(&lock);
+	while (idle && !done)
+		pthread_cond_wait(&wake, &lock);
+	idle = 0;
+	pthread_mutex_unlock(&lock);
+}
+
+static void *writer(void *arg)
+{
+	(void)arg;
+
+	while (1) {
+		int stop = __atomic_load_n(&done, __ATOMIC_ACQUIRE);
+		int num = 0;
+
+		/* at most one full buffer per thread, the other is being filled */
+		for (int i = 0; i < num_caps; i++) {
+			for (int j = 0; j < 2; j++) {
+				struct capbuf *b = &caps[i].buf[j];
+
+				if (__atomic_load_n(&b->full, __ATOMIC_ACQUIRE)) {
+					put(b);
+					num++;
+				}
+			}
+		}
+
+		if (stop) {
+			/* receive threads have stopped, write partial buffers */
+			for (int i = 0; i < num_caps; i++) {
+				struct capbuf *b = &caps[i].buf[caps[i].curr];
+
+				if (b->len)
+					put(b);
+			}
+			break;
+		}
+
+		if (!num)
+			sleep_idle();
+	}
+
+	return NULL;
+}
+
+/* Start writer thread, size (bytes) or secs rotates files, 0: never */
+int capture_start(struct capture *c, int num, const char *file, uint64_t size, uint64_t secs)
+{
+	int rc;
+
+	caps     = c;
+	num_caps = num;
+	path     = file;
+	maxsize  = size;
+	maxtime  = secs * 1000000000ULL;
+	done     = 0;
+
+	if (next_file())
+		return -1;
+
+	rc = pthread_create(&tid, NULL, writer, NULL);
+	if (rc) {
+		errno = rc;
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Receive threads must have stopped, writes what is left and closes */
+void capture_stop(void)
+{
+	pthread_mutex_lock(&lock);
+	__atomic_store_n(&done, 1, __ATOMIC_RELEASE);
+	pthread_cond_signal(&wake);
+	pthread_mutex_unlock(&lock);
+	pthread_join(tid, NULL);
+
+	if (fd >= 0)
+		close(fd);
+	fd = -1;
+}
+
+/**
+ * Local Variables:
+ *  c-file-style: "linux"
+ *  indent-tabs-mode: t
+ * End:
+ */
@@ -0,0 +1,55 @@
+/*
+ * capture.h -- Capture received datagrams to pcapng, written by a thread
+ */
+
+#ifndef MTOOLS_CAPTURE_H_
+#define MTOOLS_CAPTURE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "common.h"
+
+#define CAPTURE_BUFSZ  (4 * 1024 * 1024)	/* per buffer, two per thread */
+#define CAPTURE_FLUSH  1000000000ULL		/* hand over partial buffer, ns */
+
+struct capbuf {
+	char     *data;
+	size_t    len;
+	uint64_t  first;	/* when first seen non-empty by capture_tick() */
+	int       full;	/* owned by writer thread until it clears this */
+};
+
+/*
+ * Double buffered, per receive thread.  The thread fills one buffer with
+ * complete pcapng blocks while the writer thread writes the other to
+ * disk.  If the writer has not yet returned the other buffer when the
+ * current one is full, packets are dropped and counted, the receive
+ * thread never waits for the disk.
+ */
+struct capture {
+	struct capbuf buf[2];
+	int           curr;
+
+	uint64_t      packets;
+	uint64_t      dropped;
+} __attribute__((aligned(CACHELINE)));
+
+int  capture_limit (const char *arg, uint64_t *size, uint64_t *secs);
+
+int  capture_init  (struct capture *c);
+int  capture_start (struct capture *caps, int num, const char *file, uint64_t size, uint64_t secs);
+void capture_stop  (void);
+
+void capture_add   (struct capture *c, uint64_t ts, const inet_addr_t *src,
+		    const inet_addr_t *dst, const void *data, size_t len);
+void capture_tick  (struct capture *c, uint64_t now);
+
+#endif /* MTOOLS_CAPTURE_H_ */
+
+/**
+ * Local Variables:
+ *  c-file-style: "linux"
+ *  indent-tabs-mode: t
+ * End:
+ */
@@ -2,6 +2,7 @@
  * common.c -- Common functions and variables for mreceive.c and msend.c
  */
 
+#include <sched.h>
 #include "common.h"
 
 char *group_addr  = NULL;
@@ -17,6 +18,89 @@ int   opt_period  = 1000;	/* msec */
 int   opt_ttl     = 1;		/* default for multicast */
 int   opt_verbose = 1;
 
+/* Current time of clk in nanoseconds */
+uint64_t clock_ns(clockid_t clk)
+{
+	struct timespec ts;
+
+	clock_gettime(clk, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void ns_timespec(uint64_t ns, struct timespec *ts)
+{
+	ts->tv_sec  = ns / 1000000000;
+	ts->tv_nsec = ns % 1000000000;
+}
+
+/* CPUs we are allowed to run on, for pinning threads round-robin */
+int cpu_list(int *cpus, int max)
+{
+	cpu_set_t set;
+	int num = 0;
+
+	if (sched_getaffinity(0, sizeof(set), &set)) {
+		perror("sched_getaffinity");
+		return 0;
+	}
+
+	for (int cpu = 0; cpu < CPU_SETSIZE && num < max; cpu++) {
+		if (CPU_ISSET(cpu, &set))
+			cpus[num++] = cpu;
+	}
+
+	return num;
+}
+
+/* Parse CPU list, e.g. 0,2,4-7, returns number of CPUs or -1 on error */
+int cpu_parse(const char *arg, int *cpus, int max)
+{
+	const char *ptr = arg;
+	int num = 0;
+
+	while (*ptr) {
+		char *end;
+		long first, last;
+
+		first = strtol(ptr, &end, 10);
+		if (end == ptr || first < 0)
+			return -1;
+		last = first;
+		if (*end == '-') {
+			ptr  = end + 1;
+			last = strtol(ptr, &end, 10);
+			if (end == ptr || last < first)
+				return -1;
+		}
+
+		for (long cpu = first; cpu <= last; cpu++) {
+			if (num >= max)
+				return -1;
+			cpus[num++] = cpu;
+		}
+
+		if (*end == ',')
+			end++;
+		else if (*end)
+			return -1;
+		ptr = end;
+	}
+
+	return num;
+}
+
+/* Zeroed array of num elements starting on a cache line of its own */
+void *cache_alloc(size_t num, size_t size)
+{
+	size_t len = (num * size + CACHELINE - 1) & ~(size_t)(CACHELINE - 1);
+	void *ptr;
+
+	if (posix_memalign(&ptr, CACHELINE, len))
+		return NULL;
+
+	return memset(ptr, 0, len);
+}
+
 /**
  * Local Variables:
  *  c-file-style: "linux"
@@ -7,11 +7,13 @@
 
 #include <getopt.h>
 #include <signal.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/socket.h>
 #include <sys/time.h>
+#include <time.h>
 
 #include "inet.h"
 #include "sock.h"
@@ -21,6 +23,9 @@
 
 #define LOOPMAX        20
 #define BUFSIZE        1024
+#define BATCHMAX       1024	/* UIO_MAXIOV, max vlen for {send,recv}mmsg() */
+#define CACHELINE      64
+#define THREADMAX      256
 
 #ifndef strlcpy			/* older glibc systems */
 #define strlcpy strncpy
@@ -35,6 +40,21 @@
 	printf(fmt, ##args); fflush(stdout); \
 }
 
+/*
+ * Per-thread counters, updated by their owner thread only and read by the
+ * reporter at any time.  Relaxed atomics, i.e., plain loads and stores.
+ */
+#define STAT_ADD(x, n) __atomic_store_n(&(x), (x) + (n), __ATOMIC_RELAXED)
+#define STAT_INC(x)    STAT_ADD(x, 1)
+#define STAT_SET(x, v) __atomic_store_n(&(x), (v), __ATOMIC_RELAXED)
+#define STAT_GET(x)    __atomic_load_n(&(x), __ATOMIC_RELAXED)
+
+uint64_t clock_ns    (clockid_t clk);
+int      cpu_list    (int *cpus, int max);
+int      cpu_parse   (const char *arg, int *cpus, int max);
+void    *cache_alloc (size_t num, size_t size);
+void     ns_timespec (uint64_t ns, struct timespec *ts);
+
 extern char *group_addr;
 extern int   group_port;
 
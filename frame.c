@@ -0,0 +1,237 @@
+/*
+ * frame.c -- Parse and build link layer frames carrying UDP over IPv4 or IPv6
+ *
+ * Used both for captured packets and for frames read raw from the
+ * network.  Handles Ethernet (with VLAN tags), Linux cooked, and raw IP
+ * link types.  IP fragments and IPv6 extension headers are not UDP as
+ * far as we are concerned.
+ *
+ * Also builds complete Ethernet frames, for sending on a packet socket,
+ * with checksums that can be updated cheaply when the payload changes.
+ */
+
+#include <string.h>
+
+#include "frame.h"
+#include "pcap.h"
+
+#define ETH_P_IPV4   0x0800
+#define ETH_P_IPV6   0x86dd
+#define ETH_P_VLAN   0x8100
+#define ETH_P_QINQ   0x88a8
+
+static inline uint16_t be16(const uint8_t *p)
+{
+	return (uint16_t)p[0] << 8 | p[1];
+}
+
+static inline void put16(uint8_t *p, uint16_t v)
+{
+	p[0] = v >> 8;
+	p[1] = v;
+}
+
+/* Find UDP in frame, 0 if found, -1 if not */
+int frame_parse(uint32_t linktype, const uint8_t *p, size_t len, struct frame *f)
+{
+	const uint8_t *udp;
+	uint16_t proto;
+	size_t off;
+
+	switch (linktype) {
+	case LINKTYPE_ETHERNET:
+		if (len < 14)
+			return -1;
+		proto = be16(&p[12]);
+		off = 14;
+		while ((proto == ETH_P_VLAN || proto == ETH_P_QINQ) && len >= off + 4) {
+			proto = be16(&p[off + 2]);
+			off += 4;
+		}
+		break;
+	case LINKTYPE_LINUX_SLL:
+		if (len < 16)
+			return -1;
+		proto = be16(&p[14]);
+		off = 16;
+		break;
+	case LINKTYPE_LINUX_SLL2:
+		if (len < 20)
+			return -1;
+		proto = be16(&p[0]);
+		off = 20;
+		break;
+	case LINKTYPE_RAW:
+	case LINKTYPE_IPV4:
+	case LINKTYPE_IPV6:
+		if (len < 1)
+			return -1;
+		proto = (p[0] >> 4) == 6 ? ETH_P_IPV6 : ETH_P_IPV4;
+		off = 0;
+		break;
+	default:
+		return -1;
+	}
+	p   += off;
+	len -= off;
+
+	if (proto == ETH_P_IPV4) {
+		struct sockaddr_in *src = (struct sockaddr_in *)&f->src;
+		struct sockaddr_in *dst = (struct sockaddr_in *)&f->dst;
+		size_t hlen, tot;
+
+		if (len < 20 || (p[0] >> 4) != 4 || p[9] != IPPROTO_UDP)
+			return -1;
+		if (be16(&p[6]) & 0x3fff)
+			return -1;	/* fragment */
+
+		hlen = (p[0] & 0x0f) * 4;
+		tot  = be16(&p[2]);
+		if (hlen < 20 || tot < hlen)
+			return -1;
+		if (tot < len)
+			len = tot;	/* Ethernet padding */
+
+		memset(src, 0, sizeof(*src));
+		memset(dst, 0, sizeof(*dst));
+		src->sin_family = dst->sin_family = AF_INET;
+		memcpy(&src->sin_addr, &p[12], 4);
+		memcpy(&dst->sin_addr, &p[16], 4);
+		off = hlen;
+	} else if (proto == ETH_P_IPV6) {
+		struct sockaddr_in6 *src = (struct sockaddr_in6 *)&f->src;
+		struct sockaddr_in6 *dst = (struct sockaddr_in6 *)&f->dst;
+		size_t tot;
+
+		if (len < 40 || (p[0] >> 4) != 6 || p[6] != IPPROTO_UDP)
+			return -1;
+
+		tot = 40 + be16(&p[4]);
+		if (tot < len)
+			len = tot;
+
+		memset(src, 0, sizeof(*src));
+		memset(dst, 0, sizeof(*dst));
+		src->sin6_family = dst->sin6_family = AF_INET6;
+		memcpy(&src->sin6_addr, &p[8], 16);
+		memcpy(&dst->sin6_addr, &p[24], 16);
+		off = 40;
+	} else {
+		return -1;
+	}
+
+	if (len < off + 8)
+		return -1;
+	udp  = &p[off];
+	len -= off + 8;
+	if (be16(&udp[4]) < 8)
+		return -1;
+	if ((size_t)be16(&udp[4]) - 8 < len)
+		len = be16(&udp[4]) - 8;
+
+	inet_set_port(&f->src, be16(&udp[0]));
+	inet_set_port(&f->dst, be16(&udp[2]));
+	f->data = &udp[8];
+	f->len  = len;
+
+	return 0;
+}
+
+/* One's complement sum of buf, in 16-bit words from an even offset */
+uint32_t frame_sum(uint32_t sum, const void *buf, size_t len)
+{
+	const uint8_t *p = buf;
+
+	while (len > 1) {
+		sum += be16(p);
+		p   += 2;
+		len -= 2;
+	}
+	if (len)
+		sum += (uint32_t)p[0] << 8;
+
+	/* fold now and then, no overflow for up to 64k of data */
+	return (sum & 0xffff) + (sum >> 16);
+}
+
+/*
+ * Ethernet, IPv4 or IPv6, and UDP headers followed by payload, to a
+ * multicast group from src.  The destination MAC is the group mapped to
+ * 01:00:5e:xx:xx:xx or 33:33:xx:xx:xx:xx.  Returns frame length, or -1 if
+ * it does not fit in size.  The UDP checksum sum, before it is folded, is
+ * returned in sum, see frame_csum().
+ */
+int frame_build(uint8_t *buf, size_t size, const uint8_t *smac, const inet_addr_t *src,
+		const inet_addr_t *dst, int ttl, const void *data, size_t len, uint32_t *sum)
+{
+	size_t hlen = frame_hdrlen(dst->ss_family);
+	uint8_t *ip = &buf[14], *udp = &buf[hlen - 8];
+	uint32_t s;
+
+	if (hlen + len > size || len > 0xffff - 48 || src->ss_family != dst->ss_family)
+		return -1;
+
+	memcpy(&buf[6], smac, 6);
+	memset(ip, 0, hlen - 14);
+
+	if (dst->ss_family == AF_INET) {
+		const uint8_t *sa = (const uint8_t *)&((const struct sockaddr_in *)src)->sin_addr;
+		const uint8_t *da = (const uint8_t *)&((const struct sockaddr_in *)dst)->sin_addr;
+
+		buf[0] = 0x01;
+		buf[1] = 0x00;
+		buf[2] = 0x5e;
+		buf[3] = da[1] & 0x7f;
+		buf[4] = da[2];
+		buf[5] = da[3];
+		put16(&buf[12], ETH_P_IPV4);
+
+		ip[0] = 0x45;
+		put16(&ip[2], 20 + 8 + len);
+		put16(&ip[6], 0x4000);	/* DF, atomic datagram, ID 0 */
+		ip[8] = ttl;
+		ip[9] = IPPROTO_UDP;
+		memcpy(&ip[12], sa, 4);
+		memcpy(&ip[16], da, 4);
+		put16(&ip[10], frame_csum(frame_sum(0, ip, 20)));
+
+		/* pseudo header */
+		s = frame_sum(0, &ip[12], 8);
+	} else {
+		const uint8_t *sa = (const uint8_t *)&((const struct sockaddr_in6 *)src)->sin6_addr;
+		const uint8_t *da = (const uint8_t *)&((const struct sockaddr_in6 *)dst)->sin6_addr;
+
+		buf[0] = 0x33;
+		buf[1] = 0x33;
+		memcpy(&buf[2], &da[12], 4);
+		put16(&buf[12], ETH_P_IPV6);
+
+		ip[0] = 0x60;
+		put16(&ip[4], 8 + len);
+		ip[6] = IPPROTO_UDP;
+		ip[7] = ttl;
+		memcpy(&ip[8], sa, 16);
+		memcpy(&ip[24], da, 16);
+
+		s = frame_sum(0, &ip[8], 32);
+	}
+	s += IPPROTO_UDP + 8 + len;
+
+	put16(&udp[0], inet_port(src));
+	put16(&udp[2], inet_port(dst));
+	put16(&udp[4], 8 + len);
+	memcpy(&udp[8], data, len);
+
+	s = frame_sum(s, udp, 8 + len);
+	put16(&udp[6], frame_csum(s));
+	*sum = s;
+
+	return hlen + len;
+}
+
+/**
+ * Local Variables:
+ *  c-file-style: "linux"
+ *  indent-tabs-mode: t
+ * End:
+ */
@@ -0,0 +1,52 @@
+/*
+ * frame.h -- Parse and build link layer frames carrying UDP over IPv4 or IPv6
+ */
+
+#ifndef MTOOLS_FRAME_H_
+#define MTOOLS_FRAME_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "inet.h"
+
+/* UDP datagram in a frame, data points into the frame */
+struct frame {
+	inet_addr_t  src;
+	inet_addr_t  dst;
+	const void  *data;	/* payload */
+	size_t       len;	/* captured length of payload */
+};
+
+int      frame_parse (uint32_t linktype, const uint8_t *p, size_t len, struct frame *f);
+
+int      frame_build (uint8_t *buf, size_t size, const uint8_t *smac, const inet_addr_t *src,
+		      const inet_addr_t *dst, int ttl, const void *data, size_t len, uint32_t *sum);
+uint32_t frame_sum   (uint32_t sum, const void *buf, size_t len);
+
+/* Ethernet, IP, and UDP header length of built frames */
+static inline size_t frame_hdrlen(int family)
+{
+	return 14 + (family == AF_INET6 ? 40 : 20) + 8;
+}
+
+/* Folded UDP checksum, 0 is sent as all ones */
+static inline uint16_t frame_csum(uint32_t sum)
+{
+	uint16_t csum;
+
+	while (sum >> 16)
+		sum = (sum & 0xffff) + (sum >> 16);
+	csum = ~sum;
+
+	return csum ? csum : 0xffff;
+}
+
+#endif /* MTOOLS_FRAME_H_ */
+
+/**
+ * Local Variables:
+ *  c-file-style: "linux"
+ *  indent-tabs-mode: t
+ * End:
+ */
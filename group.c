@@ -0,0 +1,236 @@
+/*
+ * group.c -- Multicast group lists for receiving from many groups
+ *
+ * A group is given as a single address, a range of addresses, FIRST-LAST,
+ * or a number of consecutive addresses, FIRST+NUM.  Group files have one
+ * group, or range, per line, with # starting a comment.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "group.h"
+
+static uint8_t *addr_bytes(inet_addr_t *ina, size_t *len)
+{
+	if (ina->ss_family == AF_INET6) {
+		*len = sizeof(struct in6_addr);
+		return (uint8_t *)&((struct sockaddr_in6 *)ina)->sin6_addr;
+	}
+
+	*len = sizeof(struct in_addr);
+	return (uint8_t *)&((struct sockaddr_in *)ina)->sin_addr;
+}
+
+/* Add one to address, network byte order, returns -1 on wrap */
+static int addr_next(inet_addr_t *ina)
+{
+	uint8_t *b;
+	size_t len;
+
+	b = addr_bytes(ina, &len);
+	while (len--) {
+		if (++b[len])
+			return 0;
+	}
+
+	return -1;
+}
+
+static int addr_cmp(inet_addr_t *a, inet_addr_t *b)
+{
+	uint8_t *pa, *pb;
+	size_t len;
+
+	pa = addr_bytes(a, &len);
+	pb = addr_bytes(b, &len);
+
+	return memcmp(pa, pb, len);
+}
+
+static int append(struct group **groups, size_t *num, inet_addr_t *ina)
+{
+	struct group *g;
+
+	if (*num >= GROUP_MAX) {
+		fprintf(stderr, "Too many groups, max %d supported.\n", GROUP_MAX);
+		errno = E2BIG;
+		return -1;
+	}
+
+	/* grow in chunks, realloc() is amortized O(1) */
+	if (!(*num % 64)) {
+		g = realloc(*groups, (*num + 64) * sizeof(*g));
+		if (!g) {
+			perror("realloc");
+			return -1;
+		}
+		*groups = g;
+	}
+
+	g = &(*groups)[(*num)++];
+	memset(g, 0, sizeof(*g));
+	g->addr = *ina;
+	g->sd   = -1;
+	inet_address(ina, g->str, sizeof(g->str));
+
+	return 0;
+}
+
+/* Add group, FIRST-LAST range, or FIRST+NUM consecutive groups */
+int group_add(struct group **groups, size_t *num, const char *arg, in_port_t port)
+{
+	inet_addr_t first, last;
+	char buf[128], *ptr;
+	long count = 1;
+
+	strncpy(buf, arg, sizeof(buf) - 1);
+	buf[sizeof(buf) - 1] = 0;
+
+	/* a single address, else split at the last - or +, never in an address */
+	ptr = NULL;
+	if (inet_parse(&first, buf, port)) {
+		char *minus = strrchr(buf, '-'), *plus = strrchr(buf, '+');
+
+		ptr = !plus || (minus && minus > plus) ? minus : plus;
+	}
+	if (ptr) {
+		char op = *ptr;
+
+		*ptr++ = 0;
+		if (op == '+') {
+			count = strtol(ptr, NULL, 0);
+			if (count < 1)
+				goto fail;
+			ptr = NULL;
+		}
+	}
+
+	if (inet_parse(&first, buf, port))
+		goto fail;
+
+	if (ptr) {
+		if (inet_parse(&last, ptr, port) || last.ss_family != first.ss_family)
+			goto fail;
+		if (addr_cmp(&first, &last) > 0)
+			goto fail;
+	}
+
+	while (1) {
+		if (append(groups, num, &first))
+			return -1;
+
+		if (ptr) {
+			if (!addr_cmp(&first, &last))
+				break;
+		} else if (--count == 0)
+			break;
+
+		if (addr_next(&first))
+			break;
+	}
+
+	return 0;
+fail:
+	fprintf(stderr, "Invalid group or range: %s\n", arg);
+	errno = EINVAL;
+	return -1;
+}
+
+int group_file(struct group **groups, size_t *num, const char *file, in_port_t port)
+{
+	char line[256];
+	FILE *fp;
+	int ret = 0;
+
+	fp = fopen(file, "r");
+	if (!fp) {
+		perror(file);
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), fp)) {
+		char *ptr;
+
+		ptr = strchr(line, '#');
+		if (ptr)
+			*ptr = 0;
+
+		ptr = strtok(line, " \t\r\n");
+		if (!ptr)
+			continue;
+
+		ret = group_add(groups, num, ptr, port);
+		if (ret)
+			break;
+	}
+	fclose(fp);
+
+	return ret;
+}
+
+/*
+ * Hash index from destination address to group, for receive paths that
+ * see all groups on one socket.  Open addressing, at most half full.
+ */
+static uint32_t addr_hash(inet_addr_t *ina)
+{
+	uint32_t h = 2166136261U;
+	uint8_t *b;
+	size_t len;
+
+	b = addr_bytes(ina, &len);
+	while (len--)
+		h = (h ^ *b++) * 16777619U;
+
+	return h;
+}
+
+int group_index_init(struct group_index *gi, struct group *groups, size_t num)
+{
+	size_t size = 16;
+
+	while (size < 2 * num)
+		size <<= 1;
+
+	gi->slot = calloc(size, sizeof(*gi->slot));
+	if (!gi->slot)
+		return -1;
+	gi->mask = size - 1;
+
+	for (size_t i = 0; i < num; i++) {
+		uint32_t h = addr_hash(&groups[i].addr);
+
+		while (gi->slot[h & gi->mask])
+			h++;
+		gi->slot[h & gi->mask] = i + 1;
+	}
+
+	return 0;
+}
+
+/* Group with address, index into groups given to group_index_init(), or -1 */
+long group_index_find(const struct group_index *gi, struct group *groups, inet_addr_t *ina)
+{
+	uint32_t h = addr_hash(ina);
+	uint32_t i;
+
+	while ((i = gi->slot[h & gi->mask])) {
+		struct group *g = &groups[i - 1];
+
+		if (g->addr.ss_family == ina->ss_family && !addr_cmp(&g->addr, ina))
+			return i - 1;
+		h++;
+	}
+
+	return -1;
+}
+
+/**
+ * Local Variables:
+ *  c-file-style: "linux"
+ *  indent-tabs-mode: t
+ * End:
+ */
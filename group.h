@@ -0,0 +1,47 @@
+/*
+ * group.h -- Multicast group lists for receiving from many groups
+ */
+
+#ifndef MTOOLS_GROUP_H_
+#define MTOOLS_GROUP_H_
+
+#include <stdint.h>
+#include "inet.h"
+
+#define GROUP_MAX      65536
+
+struct group {
+	inet_addr_t addr;
+	char        str[INET_ADDRSTR_LEN];
+	int         sd;
+
+	uint64_t    packets;
+	uint64_t    bytes;
+
+	/* at last interval report, only used by the reporter */
+	struct {
+		uint64_t packets;
+		uint64_t bytes;
+	} prev;
+};
+
+/* address to group, see group_index_find() */
+struct group_index {
+	uint32_t   *slot;	/* group + 1, 0: free */
+	size_t      mask;
+};
+
+int  group_add        (struct group **groups, size_t *num, const char *arg, in_port_t port);
+int  group_file       (struct group **groups, size_t *num, const char *file, in_port_t port);
+
+int  group_index_init (struct group_index *gi, struct group *groups, size_t num);
+long group_index_find (const struct group_index *gi, struct group *groups, inet_addr_t *ina);
+
+#endif /* MTOOLS_GROUP_H_ */
+
+/**
+ * Local Variables:
+ *  c-file-style: "linux"
+ *  indent-tabs-mode: t
+ * End:
+ */
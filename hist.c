@@ -0,0 +1,148 @@
+/*
+ * hist.c -- Log-linear histogram, HDR style, for latency distributions
+ */
+
+#include <string.h>
+
+#include "hist.h"
+
+/* Lowest and highest value recorded in bucket */
+static uint64_t lowest(int idx)
+{
+	int shift;
+
+	if (idx < HIST_SUB)
+		return idx;
+
+	shift = idx / HIST_SUB - 1;
+	return (uint64_t)(HIST_SUB + idx % HIST_SUB) << shift;
+}
+
+static uint64_t highest(int idx)
+{
+	if (idx < HIST_SUB)
+		return idx;
+
+	return lowest(idx) + (1ULL << (idx / HIST_SUB - 1)) - 1;
+}
+
+void hist_init(struct hist *h)
+{
+	memset(h, 0, sizeof(*h));
+}
+
+/*
+ * Samples recorded between two snapshots of the same histogram, e.g.,
+ * for interval reports.  Min and max are derived from the buckets.
+ */
+void hist_diff(struct hist *dst, const struct hist *cur, const struct hist *prev)
+{
+	int lo = -1, hi = -1;
+
+	for (int i = 0; i < HIST_BUCKETS; i++) {
+		dst->bucket[i] = cur->bucket[i] - prev->bucket[i];
+		if (!dst->bucket[i])
+			continue;
+		if (lo < 0)
+			lo = i;
+		hi = i;
+	}
+
+	dst->count = cur->count - prev->count;
+	dst->under = cur->under - prev->under;
+	dst->min   = 0;
+	dst->max   = 0;
+	if (lo >= 0) {
+		dst->min = lowest(lo)  > cur->min ? lowest(lo)  : cur->min;
+		dst->max = highest(hi) < cur->max ? highest(hi) : cur->max;
+	}
+}
+
+/*
+ * Safe to call while another thread is adding to src, the result is then
+ * a consistent, slightly stale, snapshot: count is the sum of the buckets
+ * actually read.
+ */
+void hist_merge(struct hist *dst, const struct hist *src)
+{
+	uint64_t count = 0, min, max;
+
+	dst->under += __atomic_load_n(&src->under, __ATOMIC_RELAXED);
+	if (!__atomic_load_n(&src->count, __ATOMIC_RELAXED))
+		return;
+
+	min = __atomic_load_n(&src->min, __ATOMIC_RELAXED);
+	max = __atomic_load_n(&src->max, __ATOMIC_RELAXED);
+	for (int i = 0; i < HIST_BUCKETS; i++) {
+		uint64_t n = __atomic_load_n(&src->bucket[i], __ATOMIC_RELAXED);
+
+		dst->bucket[i] += n;
+		count += n;
+	}
+
+	if (!dst->count || min < dst->min)
+		dst->min = min;
+	if (max > dst->max)
+		dst->max = max;
+	dst->count += count;
+}
+
+/* Value at percentile, highest equivalent value of bucket capped by max */
+uint64_t hist_pct(const struct hist *h, double pct)
+{
+	uint64_t sum = 0, target;
+
+	if (!h->count)
+		return 0;
+
+	target = (uint64_t)(h->count * pct / 100.0 + 0.5);
+	if (target < 1)
+		target = 1;
+
+	for (int i = 0; i < HIST_BUCKETS; i++) {
+		sum += h->bucket[i];
+		if (sum >= target)
+			return highest(i) < h->max ? highest(i) : h->max;
+	}
+
+	return h->max;
+}
+
+void hist_print(const struct hist *h, FILE *fp, const char *name, double div, const char *unit)
+{
+	fprintf(fp, "%s: %llu samples", name, (unsigned long long)h->count);
+	if (h->count)
+		fprintf(fp, ", min %.1f, p50 %.1f, p99 %.1f, p99.9 %.1f, max %.1f %s",
+			h->min / div, hist_pct(h, 50.0) / div, hist_pct(h, 99.0) / div,
+			hist_pct(h, 99.9) / div, h->max / div, unit);
+	if (h->under)
+		fprintf(fp, ", %llu negative", (unsigned long long)h->under);
+	fputc('\n', fp);
+}
+
+/* Full distribution, one line per non-empty bucket with cumulative % */
+void hist_dump(const struct hist *h, FILE *fp, double div, const char *unit)
+{
+	uint64_t sum = 0;
+
+	if (!h->count)
+		return;
+
+	fprintf(fp, "%14s %14s %12s %8s\n", "From", "To", "Count", "Cum%");
+	for (int i = 0; i < HIST_BUCKETS; i++) {
+		if (!h->bucket[i])
+			continue;
+
+		sum += h->bucket[i];
+		fprintf(fp, "%11.1f %-2s %11.1f %-2s %12llu %7.3f%%\n",
+			lowest(i) / div, unit, highest(i) / div, unit,
+			(unsigned long long)h->bucket[i], 100.0 * sum / h->count);
+	}
+}
+
+/**
+ * Local Variables:
+ *  c-file-style: "linux"
+ *  indent-tabs-mode: t
+ * End:
+ */
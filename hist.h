@@ -0,0 +1,78 @@
+/*
+ * hist.h -- Log-linear histogram, HDR style, for latency distributions
+ */
+
+#ifndef MTOOLS_HIST_H_
+#define MTOOLS_HIST_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * Values below HIST_SUB are recorded exactly, above that each power of
+ * two is split in HIST_SUB linear buckets, i.e., ~3% relative precision
+ * over the full 64-bit range.
+ */
+#define HIST_SUB_BITS  5
+#define HIST_SUB       (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS   ((64 - HIST_SUB_BITS + 1) * HIST_SUB)
+
+struct hist {
+	uint64_t count;		/* samples in buckets */
+	uint64_t under;		/* negative samples, not in buckets */
+	uint64_t min;
+	uint64_t max;
+	uint64_t bucket[HIST_BUCKETS];
+};
+
+void     hist_init  (struct hist *h);
+void     hist_diff  (struct hist *dst, const struct hist *cur, const struct hist *prev);
+void     hist_merge (struct hist *dst, const struct hist *src);
+uint64_t hist_pct   (const struct hist *h, double pct);
+void     hist_print (const struct hist *h, FILE *fp, const char *name, double div, const char *unit);
+void     hist_dump  (const struct hist *h, FILE *fp, double div, const char *unit);
+
+static inline int hist_index(uint64_t val)
+{
+	int shift;
+
+	if (val < HIST_SUB)
+		return val;
+
+	shift = 63 - __builtin_clzll(val) - HIST_SUB_BITS;
+	return (shift + 1) * HIST_SUB + (int)(val >> shift) - HIST_SUB;
+}
+
+/*
+ * Hot path, record one sample.  Single writer, but hist_merge() may read
+ * the histogram from another thread meanwhile, hence relaxed stores.  On
+ * 64-bit this compiles to the same plain increments as before.
+ */
+#define HIST_SET(x, v) __atomic_store_n(&(x), (v), __ATOMIC_RELAXED)
+
+static inline void hist_add(struct hist *h, int64_t val)
+{
+	int i;
+
+	if (val < 0) {
+		HIST_SET(h->under, h->under + 1);
+		return;
+	}
+
+	i = hist_index(val);
+	HIST_SET(h->bucket[i], h->bucket[i] + 1);
+	if (!h->count || (uint64_t)val < h->min)
+		HIST_SET(h->min, val);
+	if ((uint64_t)val > h->max)
+		HIST_SET(h->max, val);
+	HIST_SET(h->count, h->count + 1);
+}
+
+#endif /* MTOOLS_HIST_H_ */
+
+/**
+ * Local Variables:
+ *  c-file-style: "linux"
+ *  indent-tabs-mode: t
+ * End:
+ */
@@ -3,6 +3,8 @@
  */
 
 #include <errno.h>
+#include <ifaddrs.h>
+#include <string.h>
 #include <arpa/inet.h>
 
 #include "inet.h"
@@ -36,11 +38,19 @@ in_port_t inet_port(const inet_addr_t *ina)
 
 	if (ina->ss_family == AF_INET6) {
 		struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)ina;
-		return sin6->sin6_port;
+		return ntohs(sin6->sin6_port);
 	}
 
 	sin = (struct sockaddr_in *)ina;
-	return sin->sin_port;
+	return ntohs(sin->sin_port);
+}
+
+void inet_set_port(inet_addr_t *ina, in_port_t port)
+{
+	if (ina->ss_family == AF_INET6)
+		((struct sockaddr_in6 *)ina)->sin6_port = htons(port);
+	else
+		((struct sockaddr_in *)ina)->sin_port = htons(port);
 }
 
 int inet_parse(inet_addr_t *ina, const char *address, in_port_t port)
@@ -66,6 +76,47 @@ int inet_parse(inet_addr_t *ina, const char *address, in_port_t port)
 	return ret;
 }
 
+/*
+ * Address of family on interface, for building our own frames.  For IPv6
+ * a link-local address is only used if there is no other.
+ */
+int inet_ifaddr(inet_addr_t *ina, const char *ifname, int family)
+{
+	struct ifaddrs *ifa, *ptr;
+	int best = 0;
+
+	if (getifaddrs(&ifa))
+		return -1;
+
+	for (ptr = ifa; ptr; ptr = ptr->ifa_next) {
+		struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)ptr->ifa_addr;
+		int rank = 2;
+
+		if (!ptr->ifa_addr || ptr->ifa_addr->sa_family != family)
+			continue;
+		if (strcmp(ptr->ifa_name, ifname))
+			continue;
+
+		if (family == AF_INET6 && IN6_IS_ADDR_LINKLOCAL(&sin6->sin6_addr))
+			rank = 1;
+		if (rank <= best)
+			continue;
+
+		memset(ina, 0, sizeof(*ina));
+		memcpy(ina, ptr->ifa_addr, family == AF_INET6 ? sizeof(struct sockaddr_in6) :
+		       sizeof(struct sockaddr_in));
+		best = rank;
+	}
+	freeifaddrs(ifa);
+
+	if (!best) {
+		errno = EADDRNOTAVAIL;
+		return -1;
+	}
+
+	return 0;
+}
+
 /**
  * Local Variables:
  *  c-file-style: "linux"
@@ -18,8 +18,10 @@ typedef struct sockaddr_storage inet_addr_t;
 const char *inet_address (const inet_addr_t *ina, char *buf, size_t len);
 socklen_t   inet_addrlen (const inet_addr_t *ina);
 in_port_t   inet_port    (const inet_addr_t *ina);
+void        inet_set_port(inet_addr_t *ina, in_port_t port);
 
 int         inet_parse   (inet_addr_t *ina, const char *address, in_port_t port);
+int         inet_ifaddr  (inet_addr_t *ina, const char *ifname, int family);
 
 #endif /* MTOOLS_INET_H_ */
 
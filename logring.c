@@ -0,0 +1,238 @@
+/*
+ * logring.c -- Lock-free rings of log records, formatted by a writer thread
+ *
+ * Each thread producing log output, e.g., a receive thread, has its own
+ * single producer, single consumer ring of fixed size binary records.  A
+ * writer thread drains all rings, formats the records using a callback
+ * from the tool, and writes the text in large batches.  So the hot path
+ * never formats, flushes, or blocks on a slow terminal, at worst records
+ * are dropped and counted.
+ *
+ * When all rings are empty the writer sleeps on a condition variable.
+ * Producers commit records with a plain release store, and once per
+ * batch call logring_notify(), a fence and a load of the writer's idle
+ * flag, taking the lock only to wake it when it has said it sleeps.
+ *
+ * Text from other threads, e.g., interval reports from main, is passed
+ * whole with logring_print() and written between two batches of
+ * records, so lines from the two never interleave.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "logring.h"
+
+#define LOGBUF   (256 * 1024)	/* write batch */
+#define LOGLINE  512		/* max formatted record */
+
+static struct logring *rings;
+static int             num_rings;
+static logfmt_t        format;
+static int             outfd;
+static int             done;
+static pthread_t       tid;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  wake = PTHREAD_COND_INITIALIZER;
+int                    logring_idle;	/* writer sleeps, see logring_commit() */
+static char           *text;		/* from logring_print(), under lock */
+static size_t          text_len;
+
+int logring_init(struct logring *r)
+{
+	r->head = r->tail = r->tail_cache = r->notified = r->dropped = 0;
+	r->rec  = calloc(LOGRING_SIZE, sizeof(*r->rec));
+
+	return r->rec ? 0 : -1;
+}
+
+static void flush(char *buf, size_t *len)
+{
+	size_t off = 0;
+
+	while (off < *len) {
+		ssize_t n = write(outfd, &buf[off], *len - off);
+
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			break;	/* nowhere to report it */
+		}
+		off += n;
+	}
+	*len = 0;
+}
+
+/* Write text passed with logring_print(), after what is already in buf */
+static void print(char *buf, size_t *len)
+{
+	char *ptr;
+	size_t num;
+
+	pthread_mutex_lock(&lock);
+	ptr = text;
+	num = text_len;
+	text = NULL;
+	text_len = 0;
+	pthread_mutex_unlock(&lock);
+
+	if (!ptr)
+		return;
+
+	flush(buf, len);
+	flush(ptr, &num);
+	free(ptr);
+}
+
+/* Nothing in any ring, sleep until a producer, print, or stop wakes us */
+static void sleep_idle(void)
+{
+	__atomic_store_n(&logring_idle, 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+	/* a record committed before the flag was seen would never wake us */
+	for (int i = 0; i < num_rings; i++) {
+		if (__atomic_load_n(&rings[i].head, __ATOMIC_ACQUIRE) != rings[i].tail) {
+			__atomic_store_n(&logring_idle, 0, __ATOMIC_RELAXED);
+			return;
+		}
+	}
+
+	pthread_mutex_lock(&lock);
+	while (logring_idle && !done && !text)
+		pthread_cond_wait(&wake, &lock);
+	logring_idle = 0;
+	pthread_mutex_unlock(&lock);
+}
+
+static void *writer(void *arg)
+{
+	char *buf = arg;
+	size_t len = 0;
+
+	while (1) {
+		int stop = __atomic_load_n(&done, __ATOMIC_ACQUIRE);
+		uint64_t num = 0;
+
+		print(buf, &len);
+
+		for (int i = 0; i < num_rings; i++) {
+			struct logring *r = &rings[i];
+			uint64_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+			uint64_t tail = r->tail;
+
+			while (tail != head) {
+				if (LOGBUF - len < LOGLINE)
+					flush(buf, &len);
+				len += format(&r->rec[tail & (LOGRING_SIZE - 1)], &buf[len], LOGLINE);
+				tail++;
+				num++;
+			}
+			__atomic_store_n(&r->tail, tail, __ATOMIC_RELEASE);
+		}
+
+		if (num)
+			continue;
+
+		/* all rings empty, write what we have and wait for more */
+		if (len)
+			flush(buf, &len);
+		if (stop)
+			break;
+		sleep_idle();
+	}
+	print(buf, &len);
+
+	free(buf);
+	return NULL;
+}
+
+/* Start writer thread, draining num rings, formatting with fmt, to fd */
+int logring_start(struct logring *r, int num, logfmt_t fmt, int fd)
+{
+	char *buf;
+	int rc;
+
+	buf = malloc(LOGBUF);
+	if (!buf)
+		return -1;
+
+	rings     = r;
+	num_rings = num;
+	format    = fmt;
+	outfd     = fd;
+	done      = 0;
+
+	rc = pthread_create(&tid, NULL, writer, buf);
+	if (rc) {
+		free(buf);
+		errno = rc;
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Producer: wake the writer, called from logring_notify() when it sleeps */
+void logring_wake(void)
+{
+	pthread_mutex_lock(&lock);
+	logring_idle = 0;
+	pthread_cond_signal(&wake);
+	pthread_mutex_unlock(&lock);
+}
+
+/*
+ * Queue len bytes of text, complete lines, to be written between two
+ * batches of records.  Any thread, may block briefly on the lock.
+ */
+int logring_print(const char *buf, size_t len)
+{
+	char *ptr;
+
+	pthread_mutex_lock(&lock);
+	ptr = realloc(text, text_len + len);
+	if (!ptr) {
+		pthread_mutex_unlock(&lock);
+		return -1;
+	}
+	memcpy(&ptr[text_len], buf, len);
+	text = ptr;
+	text_len += len;
+	pthread_cond_signal(&wake);
+	pthread_mutex_unlock(&lock);
+
+	return 0;
+}
+
+/* Drain all rings, producers must have stopped, and stop writer thread */
+void logring_stop(void)
+{
+	pthread_mutex_lock(&lock);
+	__atomic_store_n(&done, 1, __ATOMIC_RELEASE);
+	pthread_cond_signal(&wake);
+	pthread_mutex_unlock(&lock);
+	pthread_join(tid, NULL);
+}
+
+uint64_t logring_dropped(struct logring *r, int num)
+{
+	uint64_t sum = 0;
+
+	for (int i = 0; i < num; i++)
+		sum += STAT_GET(r[i].dropped);
+
+	return sum;
+}
+
+/**
+ * Local Variables:
+ *  c-file-style: "linux"
+ *  indent-tabs-mode: t
+ * End:
+ */
@@ -0,0 +1,100 @@
+/*
+ * logring.h -- Lock-free rings of log records, formatted by a writer thread
+ */
+
+#ifndef MTOOLS_LOGRING_H_
+#define MTOOLS_LOGRING_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "common.h"
+
+#define LOGRING_SIZE   16384	/* records per ring, power of two */
+#define LOGREC_ARGS    5
+#define LOGREC_TEXT    64
+
+/* Fixed size, two cache lines, binary log record, formatted by writer */
+struct logrec {
+	uint32_t    type;		/* defined by the tool */
+	uint32_t    len;		/* of text */
+	uint64_t    arg[LOGREC_ARGS];
+	const void *ptr[2];		/* must outlive the writer thread */
+	char        text[LOGREC_TEXT];	/* truncated copy, not NUL terminated */
+};
+
+/*
+ * Format record r to buf, at most len bytes, returns length.  Called
+ * from the writer thread.
+ */
+typedef size_t (*logfmt_t)(const struct logrec *r, char *buf, size_t len);
+
+/*
+ * Single producer, single consumer.  Each index on its own cache line,
+ * with a cached copy of the other side's index to avoid bouncing lines
+ * on every record.  When full the record is dropped and counted.
+ */
+struct logring {
+	uint64_t       head __attribute__((aligned(CACHELINE)));
+	uint64_t       tail_cache;
+	uint64_t       notified;	/* head at last logring_notify() */
+	uint64_t       dropped;
+
+	uint64_t       tail __attribute__((aligned(CACHELINE)));
+
+	struct logrec *rec;
+};
+
+extern int     logring_idle;
+
+int            logring_init  (struct logring *r);
+int            logring_start (struct logring *rings, int num, logfmt_t fmt, int fd);
+void           logring_stop  (void);
+void           logring_wake  (void);
+int            logring_print (const char *buf, size_t len);
+uint64_t       logring_dropped (struct logring *rings, int num);
+
+/* Producer: next free record, or NULL if full */
+static inline struct logrec *logring_claim(struct logring *r)
+{
+	if (r->head - r->tail_cache >= LOGRING_SIZE) {
+		r->tail_cache = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+		if (r->head - r->tail_cache >= LOGRING_SIZE) {
+			STAT_INC(r->dropped);
+			return NULL;
+		}
+	}
+
+	return &r->rec[r->head & (LOGRING_SIZE - 1)];
+}
+
+/* Producer: publish the record from logring_claim() */
+static inline void logring_commit(struct logring *r)
+{
+	__atomic_store_n(&r->head, r->head + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Producer: after a batch of commits, wake the writer if it sleeps.  The
+ * fence pairs with the writer's between setting logring_idle and its
+ * last look at the rings, so one of the two sides sees the other.
+ */
+static inline void logring_notify(struct logring *r)
+{
+	if (r->head == r->notified)
+		return;
+	r->notified = r->head;
+
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&logring_idle, __ATOMIC_RELAXED))
+		logring_wake();
+}
+
+#endif /* MTOOLS_LOGRING_H_ */
+
+/**
+ * Local Variables:
+ *  c-file-style: "linux"
+ *  indent-tabs-mode: t
+ * End:
+ */
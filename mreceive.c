@@ -18,47 +18,1179 @@
  * 
  */
 
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+
+#include "capture.h"
 #include "common.h"
+#include "frame.h"
+#include "group.h"
+#include "hist.h"
+#include "logring.h"
+#include "packet.h"
+#include "pcap.h"
+#include "proto.h"
+#include "size.h"
+#include "stream.h"
+#include "tstamp.h"
+#include "uring.h"
 
 #define MAXIP     16
+#define MAXEVENTS 64
+#define INTERVAL  1000000000ULL	/* latency report interval, ns */
+#define STREAMLAT 1024		/* streams per thread with latency of their own */
+#define URINGBUFS 4096		/* provided receive buffers per thread, at most */
+#define URINGMEM  (16 << 20)	/* ... and bytes, they are datagram sized */
+
+/* receive engines, -e */
+enum {
+	ENGINE_SOCKET,		/* recvmmsg() per group socket */
+	ENGINE_PACKET,		/* AF_PACKET TPACKET_V3 ring per thread */
+	ENGINE_URING,		/* io_uring multishot recvmsg() per group socket */
+};
+
+/* log records, formatted by the log writer thread */
+enum {
+	LOG_NUM,		/* counter, usec, seq; stream, group */
+	LOG_MSG,		/* counter; stream, group; text */
+	LOG_GAP,		/* first, last */
+	LOG_LATE,		/* seq, expected */
+	LOG_DUP,		/* seq */
+	LOG_STALE,		/* seq */
+	LOG_RESET,		/* seq, previous */
+};
+
+/*
+ * One receive thread, with its own socket per group and its own buffer
+ * ring.  Counters are only written by the thread itself, and each worker
+ * starts on a cache line of its own so threads never share a line.  The
+ * main thread merges them when reporting.
+ */
+struct worker {
+	uint64_t        packets;
+	uint64_t        bytes;
+	uint64_t        calls;	/* recvmmsg(), io_uring_enter(), or ring blocks */
+	uint64_t        truncated;	/* did not fit the receive buffer, or snapped */
+
+	int             id;
+	int             cpu;	/* -1: not pinned */
+	int             ep;
+	pthread_t       tid;
+
+	struct group   *groups;	/* own copy, with own socket and counters */
+	struct packet_rx ring;	/* -e packet, all groups */
+
+	/* -e uring, all group sockets on one completion queue */
+	struct uring    uring;
+	struct uring_bufs ubufs;
+	struct msghdr   umsg;	/* sizes of name and control in buffers */
+
+	struct mmsghdr *vec;
+	struct iovec   *iov;
+	inet_addr_t    *from;
+	char           *buf;
+	char           *ctrl;
+
+	/* senders seen by this thread, and packets from senders not fitting */
+	struct stream_tab streams;
+	uint64_t        untracked;
+	unsigned int    streamlat;	/* streams with a latency histogram */
+
+	/* packets by datagram size, read by main when done */
+	struct size_stats sizes;
+
+	/* pcapng capture buffers, if -w */
+	struct capture *cap;
+
+	/* per-packet log state, and ring to log writer */
+	struct logring *log;
+	unsigned long long counter;
+	uint64_t        starttime;
+
+	/* end-to-end, send to kernel, and kernel to user space latency */
+	struct hist     lat;
+	struct hist     net;
+	struct hist     host;
+} __attribute__((aligned(CACHELINE)));
+
+static struct group   *groups;
+static size_t          num_groups;
+static struct group_index gindex;
+static int             gfamily;	/* of all groups, 0 if mixed */
+
+static struct worker  *workers;
+static struct logring *logs;
+static struct capture *caps;
+static uint64_t        starttime;
+static int             stopfd = -1;
+static int             logging;		/* log writer owns stdout */
+
+static inet_addr_t    *source;
+static inet_addr_t     ifaddr[MAXIP];
+static size_t          num_ifaddr;
+
+static int             batch = 32;
+static int             flags = MSG_DONTWAIT;
+static struct timespec timeout;
+
+static char           *opt_capture;	/* -w FILE */
+static uint64_t        opt_capsize;	/* -W SIZE, bytes */
+static uint64_t        opt_captime;	/* -W TIME, sec */
+static int             opt_engine = ENGINE_SOCKET;
+static uint64_t        opt_interval;	/* -r, ns */
+static int             opt_latency;
+static int             opt_steer = SOCK_STEER_FLOW;
+static int             opt_threads = 1;
+static int             opt_tstamp;	/* 1: kernel sw, 2: NIC hw timestamps */
+static int             opt_gro;		/* read coalesced datagrams, -G */
+static size_t          rxsize = 65535;	/* per datagram, or coalesced read */
+static size_t          ctrlsize;	/* control messages per read */
+static int64_t         tai_offset;	/* CLOCK_TAI - CLOCK_REALTIME */
+
+/* merged from all workers, cumulative and at last report */
+static struct hist lat,  lat_prev;
+static struct hist net,  net_prev;
+static struct hist host, host_prev;
 
 
 static int usage(int rc)
 {
 	printf("\
-Usage: mreceive [-46hnv] [-g GROUP] [-i ADDR] ... [-i ADDR] [-I INTERFACE]\n\
-                [-p PORT] [-s ADDR]\n\
+Usage: mreceive [-46GhLnv] [-b NUM] [-e ENGINE] [-f FILE] [-g GROUP] ... [-g GROUP]\n\
+                [-H src|flow] [-i ADDR] ... [-i ADDR] [-I INTERFACE] [-K sw|hw]\n\
+                [-p PORT] [-r SEC] [-s ADDR] [-t USEC] [-T NUM] [-w FILE]\n\
+                [-W SIZE|TIME]\n\
 \n\
   -4 | -6      Select IPv4 or IPv6, use with -I, when -i is not used\n\
-  -g GROUP     IP multicast group address to listen to.\n\
+  -b NUM       Receive up to NUM packets per recvmmsg() call.  Default: 32\n\
+  -e ENGINE    Receive engine, socket: recvmmsg() on a UDP socket per group,\n\
+               packet: AF_PACKET memory-mapped ring on -I INTERFACE, frames\n\
+               filtered by group and port and read in place, uring: io_uring\n\
+               multishot recvmsg() on all group sockets.  Default: socket\n\
+  -f FILE      Read groups to listen to from FILE, one group or range per line\n\
+  -g GROUP     IP multicast group address to listen to, can be given multiple\n\
+               times, and as a range: FIRST-LAST or FIRST+NUM, for many groups\n\
                Default for IPv4: 224.1.1.1, IPv6: ff2e::1\n\
+  -G           Generic receive offload, UDP_GRO, read back-to-back datagrams\n\
+               of a sender as one buffer, split again using the segment size\n\
   -h           This help text.\n\
+  -H src|flow  Shard senders over threads by source address, or by source\n\
+               address and port (flow), see -T.  Default: flow\n\
   -i ADDRESS   IP addresses of one or more interfaces to listen for the given\n\
                multicast group.  Default: the system default interface.\n\
   -I INTERFACE The interface on which to receive. Can be specified as an\n\
                alternative to -i.\n\
-  -n           Interpret the contents of the message as a number instead of\n\
-               a string of characters.  Use this with `msend -n`\n\
+  -K sw|hw     Use kernel (sw) or NIC (hw) receive timestamps to split the\n\
+               latency in network and receiving host parts, implies -L\n\
+  -L           Record one-way latency of each packet, requires `msend -n`.\n\
+               Prints p50/p99/p99.9/max every second and histogram at exit\n\
+  -n           Decode the sequence number of each packet and detect lost,\n\
+               duplicate, reordered, and truncated packets, and loss per\n\
+               datagram size.  Use this with `msend -n`\n\
   -p PORT      UDP port number used in the multicast packets.  Default: 4444\n\
   -q           Quiet, don't print every received packet, errors still printed\n\
+  -r SEC       Report rates, loss, reordering, and latency every SEC seconds,\n\
+               per group and sender, instead of printing every packet\n\
   -s ADDRESS   Source IP address for source-specific filtering (SSM)\n\
-  -v           Print version information.\n\n");
+  -t USEC      Wait up to USEC microseconds to fill a batch, by default, or\n\
+               with 0, a batch is returned as soon as at least one packet is read\n\
+  -T NUM       Receive using NUM threads, each with its own SO_REUSEPORT socket\n\
+               per group, pinned to a CPU of its own when possible\n\
+  -v           Print version information.\n\
+  -w FILE      Capture all received packets to FILE in pcapng format, with\n\
+               kernel receive timestamp, source, and group\n\
+  -W SIZE|TIME Start a new capture file every SIZE bytes, with suffix k/M/G,\n\
+               or every TIME, with suffix s/m/h, e.g. 1G or 10m\n\n");
 
 	return rc;
 }
 
+/*
+ * Record latency of packet.  With kernel timestamps, also record how much
+ * of it was spent in the network, up to the kernel receive timestamp, and
+ * how much in the receiving host, from kernel to user space dequeue.
+ */
+static void latency(struct worker *w, struct stream *st, const struct proto_info *pi,
+		    uint64_t now, uint64_t kern)
+{
+	if (kern)
+		hist_add(&w->host, (int64_t)(now - kern));
+
+	if (!pi || !pi->tstamp)
+		return;
+
+	/* first streams of the thread also get one of their own, ~30 kiB */
+	if (st && !st->lat && w->streamlat < STREAMLAT) {
+		struct hist *h = calloc(2, sizeof(*h));
+
+		if (h) {
+			hist_init(&h[0]);
+			hist_init(&h[1]);
+			__atomic_store_n(&st->lat, h, __ATOMIC_RELEASE);
+			w->streamlat++;
+		}
+	}
+
+	/* kern 0 is no kernel timestamp, keep it that way */
+	if (pi->flags & PROTO_F_TAI) {
+		now += tai_offset;
+		if (kern)
+			kern += tai_offset;
+	}
+
+	hist_add(&w->lat, (int64_t)(now - pi->tstamp));
+	if (st && st->lat)
+		hist_add(&st->lat[0], (int64_t)(now - pi->tstamp));
+	if (kern)
+		hist_add(&w->net, (int64_t)(kern - pi->tstamp));
+}
+
+/* Snapshot of all workers' histograms */
+static void collect(void)
+{
+	hist_init(&lat);
+	hist_init(&net);
+	hist_init(&host);
+	for (int i = 0; i < opt_threads; i++) {
+		hist_merge(&lat, &workers[i].lat);
+		hist_merge(&net, &workers[i].net);
+		hist_merge(&host, &workers[i].host);
+	}
+}
+
+/* Rates and sequence counters, per group and sender, since last call */
+static void traffic(uint64_t now)
+{
+	static uint64_t last;
+	uint64_t packets = 0, bytes = 0;
+	struct hist h;
+	double sec, elapsed;
+
+	if (!last)
+		last = starttime;
+	sec = (now - last) / 1e9;
+	if (sec <= 0.0)
+		sec = 1e-9;
+	elapsed = (now - starttime) / 1e9;
+	last = now;
+
+	for (size_t i = 0; i < num_groups; i++) {
+		struct group *g = &groups[i];
+		uint64_t p = 0, b = 0;
+
+		for (int j = 0; j < opt_threads; j++) {
+			p += STAT_GET(workers[j].groups[i].packets);
+			b += STAT_GET(workers[j].groups[i].bytes);
+		}
+		packets += p - g->prev.packets;
+		bytes   += b - g->prev.bytes;
+
+		if (num_groups > 1 && p != g->prev.packets)
+			printf("[%9.3f] Group [%s]: %.0f pps, %.2f Mbps\n", elapsed, g->str,
+			       (p - g->prev.packets) / sec, (b - g->prev.bytes) * 8 / sec / 1e6);
+		g->prev.packets = p;
+		g->prev.bytes   = b;
+	}
+	printf("[%9.3f] Total: %.0f pps, %.2f Mbps\n", elapsed, packets / sec, bytes * 8 / sec / 1e6);
+
+	for (int i = 0; i < opt_threads; i++) {
+		for (struct stream *st = stream_first(&workers[i].streams); st; st = stream_next(st)) {
+			uint64_t p = STAT_GET(st->packets), b = STAT_GET(st->bytes);
+			uint64_t lost = STAT_GET(st->seq.lost);
+			uint64_t late = STAT_GET(st->seq.late);
+			uint64_t dups = STAT_GET(st->seq.dups);
+			struct hist *lat = __atomic_load_n(&st->lat, __ATOMIC_ACQUIRE);
+
+			/* only senders active, or losing, in this interval */
+			if (p == st->prev.packets && lost == st->prev.lost)
+				continue;
+
+			printf("[%9.3f]   [%s]:%d", elapsed, st->str, st->port);
+			if (st->key.sender)
+				printf(" ID %08x/%u", st->key.sender, st->key.stream);
+			if (num_groups > 1)
+				printf(" to [%s]", groups[st->key.group].str);
+			printf(": %.0f pps, %.2f Mbps", (p - st->prev.packets) / sec,
+			       (b - st->prev.bytes) * 8 / sec / 1e6);
+			if (opt_isnum)
+				printf(", %llu lost, %llu late, %llu dups",
+				       (unsigned long long)(lost - st->prev.lost),
+				       (unsigned long long)(late - st->prev.late),
+				       (unsigned long long)(dups - st->prev.dups));
+			if (lat) {
+				hist_diff(&h, &lat[0], &lat[1]);
+				if (h.count)
+					printf(", latency p50 %.1f, p99 %.1f, max %.1f us",
+					       hist_pct(&h, 50.0) / 1000.0, hist_pct(&h, 99.0) / 1000.0,
+					       h.max / 1000.0);
+				lat[1] = lat[0];
+			}
+			printf("\n");
+
+			st->prev.packets = p;
+			st->prev.bytes   = b;
+			st->prev.lost    = lost;
+			st->prev.late    = late;
+			st->prev.dups    = dups;
+		}
+	}
+}
+
+/* Interval report, traffic with -r, latency percentiles with -L */
+static void report(uint64_t now)
+{
+	struct hist h;
+	FILE *fp = stdout;
+	char *buf = NULL;
+	size_t len = 0;
+
+	if (opt_interval)
+		traffic(now);
+
+	if (!opt_latency) {
+		fflush(stdout);
+		return;
+	}
+
+	collect();
+
+	/* per-packet lines are written by the log writer, queue ours to it */
+	if (logging) {
+		fp = open_memstream(&buf, &len);
+		if (!fp)
+			return;
+	}
+
+	hist_diff(&h, &lat, &lat_prev);
+	hist_print(&h, fp, "Latency, all groups", 1000.0, "us");
+	lat_prev = lat;
+
+	if (opt_tstamp) {
+		hist_diff(&h, &net, &net_prev);
+		hist_print(&h, fp, "  Network", 1000.0, "us");
+		net_prev = net;
+
+		hist_diff(&h, &host, &host_prev);
+		hist_print(&h, fp, "  Host", 1000.0, "us");
+		host_prev = host;
+	}
+
+	if (!logging) {
+		fflush(stdout);
+		return;
+	}
+
+	fclose(fp);
+	logring_print(buf, len);
+	free(buf);
+}
+
+/* Runs in the log writer thread, streams and groups outlive it */
+static size_t logfmt(const struct logrec *r, char *buf, size_t len)
+{
+	const struct stream *st = r->ptr[0];
+	const struct group *g = r->ptr[1];
+	unsigned long long a = r->arg[0], b = r->arg[1];
+	int n = 0;
+
+	switch (r->type) {
+	case LOG_NUM:
+		n = snprintf(buf, len, "%5llu\t[%s]:%5d\t%llu.%03llu\t%5llu%s%s\n", a, st->str, st->port,
+			     b / 1000000, (b % 1000000) / 1000, (unsigned long long)r->arg[2],
+			     g ? "\t" : "", g ? g->str : "");
+		break;
+	case LOG_MSG:
+		if (g)
+			n = snprintf(buf, len, "Receive msg %llu from [%s]:%d to [%s]: %.*s\n", a,
+				     st->str, st->port, g->str, (int)r->len, r->text);
+		else
+			n = snprintf(buf, len, "Receive msg %llu from [%s]:%d: %.*s\n", a,
+				     st->str, st->port, (int)r->len, r->text);
+		break;
+	case LOG_GAP:
+		if (a == b)
+			n = snprintf(buf, len, "****************\nMessage not received: %llu\n"
+				     "****************\n", a);
+		else
+			n = snprintf(buf, len, "****************\nMessages not received: %llu to %llu\n"
+				     "****************\n", a, b);
+		break;
+	case LOG_LATE:
+		n = snprintf(buf, len, "****************\nLate message received: %llu, expected %llu\n"
+			     "****************\n", a, b);
+		break;
+	case LOG_DUP:
+		n = snprintf(buf, len, "Duplicate message received: %llu\n", a);
+		break;
+	case LOG_STALE:
+		n = snprintf(buf, len, "Message received too late, already counted as lost: %llu\n", a);
+		break;
+	case LOG_RESET:
+		n = snprintf(buf, len, "****************\nSequence reset, sender restarted: %llu after %llu\n"
+			     "****************\n", a, b);
+		break;
+	}
+
+	if (n < 0)
+		return 0;
+
+	return (size_t)n < len ? (size_t)n : len - 1;
+}
+
+/* Queue a log record for the writer thread, dropped if the ring is full */
+static void logput(struct worker *w, uint32_t type, uint64_t a, uint64_t b, uint64_t c,
+		   const struct stream *st, const struct group *g, const char *text, size_t len)
+{
+	struct logrec *r;
+
+	r = logring_claim(w->log);
+	if (!r)
+		return;
+
+	r->type   = type;
+	r->arg[0] = a;
+	r->arg[1] = b;
+	r->arg[2] = c;
+	r->ptr[0] = st;
+	r->ptr[1] = num_groups > 1 ? g : NULL;
+	r->len    = text ? strnlen(text, len < sizeof(r->text) ? len : sizeof(r->text)) : 0;
+	if (r->len)
+		memcpy(r->text, text, r->len);
+
+	logring_commit(w->log);
+}
+
+/*
+ * Sequence accounting, and notify of anything out of the ordinary.
+ * Returns number of datagrams missing right before this one.
+ */
+static uint64_t track(struct worker *w, struct seq *s, unsigned long long curr)
+{
+	unsigned long long next = s->next;
+	int rc;
+
+	rc = seq_update(s, curr);
+	if (opt_interval)
+		return rc == SEQ_GAP ? curr - next : 0;	/* only counters */
+
+	switch (rc) {
+	case SEQ_GAP:
+		logput(w, LOG_GAP, next, curr - 1, 0, NULL, NULL, NULL, 0);
+		return curr - next;
+	case SEQ_LATE:
+		logput(w, LOG_LATE, curr, next, 0, NULL, NULL, NULL, 0);
+		break;
+	case SEQ_DUP:
+		logput(w, LOG_DUP, curr, 0, 0, NULL, NULL, NULL, 0);
+		break;
+	case SEQ_STALE:
+		logput(w, LOG_STALE, curr, 0, 0, NULL, NULL, NULL, 0);
+		break;
+	case SEQ_RESET:
+		logput(w, LOG_RESET, curr, next - 1, 0, NULL, NULL, NULL, 0);
+		break;
+	}
+
+	return 0;
+}
+
+/* Message need not be NUL terminated, it may be read in place from a ring */
+static unsigned long long counter(const char *msg, size_t len)
+{
+	char buf[24];
+
+	if (len >= sizeof(buf))
+		len = sizeof(buf) - 1;
+	memcpy(buf, msg, len);
+	buf[len] = 0;
+
+	return strtoull(buf, NULL, 10);
+}
+
+/* trunc: the kernel says there was more than len */
+static void process(struct worker *w, struct group *g, const char *msg, size_t len, int trunc,
+		    const inet_addr_t *from, uint64_t now, uint64_t kern)
+{
+	struct stream_key key;
+	struct proto_info pi;
+	struct stream *st;
+	uint64_t gaps = 0;
+	int noproto;	/* no msend -n header, pi not valid */
+
+	STAT_INC(g->packets);
+	STAT_ADD(g->bytes, len);
+
+	/* binary header from msend -n, or ASCII counter from older msend */
+	noproto = proto_parse(msg, len, &pi);
+
+	/* the header knows what was sent, in case it was cut on the way */
+	if (trunc || (!noproto && pi.length > len))
+		STAT_INC(w->truncated);
+
+	stream_key(&key, from, g - w->groups, noproto ? 0 : pi.sender, noproto ? 0 : pi.stream);
+	st = stream_get(&w->streams, &key, now);
+	if (opt_latency)
+		latency(w, st, noproto ? NULL : &pi, now, kern);
+	if (!st) {
+		STAT_INC(w->untracked);
+		size_count(&w->sizes, len, 0, now);
+		return;
+	}
+	STAT_INC(st->packets);
+	STAT_ADD(st->bytes, len);
+	STAT_SET(st->last, now);
+
+	if (opt_isnum) {
+		unsigned long long curr = noproto ? counter(msg, len) : pi.seq;
+
+		if (opt_verbose && !opt_interval) {
+			if (w->counter == 1)
+				/* 500 to adjust for already executed instructions */
+				w->starttime = now - 500000;
+
+			logput(w, LOG_NUM, w->counter, (now - w->starttime) / 1000, curr, st, g, NULL, 0);
+		}
+
+		gaps = track(w, &st->seq, curr);
+	} else if (opt_verbose && !opt_interval) {
+		logput(w, LOG_MSG, w->counter, 0, 0, st, g, msg, len);
+	}
+	size_count(&w->sizes, len, gaps, now);
+	w->counter++;
+}
+
+/* Drain one batch from a group socket */
+static void receive(struct worker *w, struct group *g)
+{
+	uint64_t now;
+	int len;
+
+	for (int i = 0; i < batch; i++) {
+		w->vec[i].msg_hdr.msg_namelen = sizeof(w->from[i]);
+		if (w->ctrl) {
+			w->vec[i].msg_hdr.msg_control    = &w->ctrl[i * ctrlsize];
+			w->vec[i].msg_hdr.msg_controllen = ctrlsize;
+		}
+	}
+
+	/* receive from the multicast address */
+	len = recvmmsg(g->sd, w->vec, batch, flags, flags ? NULL : &timeout);
+	if (len < 0) {
+		if (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK)
+			return;
+		perror("recvmmsg");
+		exit(1);
+	}
+	STAT_INC(w->calls);
+
+	/* one timestamp per batch */
+	now = clock_ns(CLOCK_REALTIME);
+	for (int i = 0; i < len; i++) {
+		size_t seg, off = 0, total = w->vec[i].msg_len;
+		int trunc = w->vec[i].msg_hdr.msg_flags & MSG_TRUNC;
+		char *msg = w->iov[i].iov_base;
+		uint64_t sw = 0, hw = 0;
+
+		if (opt_tstamp)
+			tstamp_rx_parse(&w->vec[i].msg_hdr, &sw, &hw);
+
+		/* coalesced by GRO, all segments but the last are seg long */
+		seg = opt_gro ? sock_gro_size(&w->vec[i].msg_hdr) : 0;
+		if (!seg || seg > total)
+			seg = total;
+
+		msg[total] = 0;
+		do {
+			size_t n = total - off < seg ? total - off : seg;
+
+			if (w->cap)
+				capture_add(w->cap, hw ? hw : sw ? sw : now, &w->from[i], &g->addr,
+					    &msg[off], n);
+
+			STAT_INC(w->packets);
+			STAT_ADD(w->bytes, n);
+			off += n;
+			process(w, g, &msg[off - n], n, trunc && off == total, &w->from[i], now,
+				hw ? hw : sw);
+		} while (off < total);
+	}
+}
+
+/*
+ * Drain all frames the kernel has handed over in the ring, one timestamp
+ * per wakeup.  The filter has already dropped everything but UDP to our
+ * port and a multicast group, look up which.
+ */
+static void receive_ring(struct worker *w)
+{
+	struct packet_frame pf;
+	uint64_t now;
+
+	now = clock_ns(CLOCK_REALTIME);
+	while (packet_rx_next(&w->ring, &pf)) {
+		struct group *g;
+		struct frame f;
+		long i;
+
+		if (frame_parse(LINKTYPE_ETHERNET, pf.data, pf.len, &f))
+			continue;
+
+		i = group_index_find(&gindex, w->groups, &f.dst);
+		if (i < 0)
+			continue;
+		g = &w->groups[i];
+
+		if (w->cap)
+			capture_add(w->cap, pf.ts, &f.src, &g->addr, f.data, f.len);
+
+		STAT_INC(w->packets);
+		STAT_ADD(w->bytes, f.len);
+		process(w, g, f.data, f.len, pf.trunc, &f.src, now, pf.ts);
+	}
+	STAT_SET(w->calls, w->ring.blocks);
+}
+
+/* (Re)arm multishot receive on group socket, stays armed until error */
+static void uring_arm(struct worker *w, size_t i)
+{
+	struct io_uring_sqe *sqe;
+
+	while (!(sqe = uring_sqe(&w->uring))) {
+		if (uring_submit(&w->uring, 0, 0) < 0 && errno != EINTR) {
+			perror("io_uring_enter");
+			exit(1);
+		}
+	}
+
+	sqe->opcode    = IORING_OP_RECVMSG;
+	sqe->fd        = i;		/* fixed file */
+	sqe->flags     = IOSQE_FIXED_FILE | IOSQE_BUFFER_SELECT;
+	sqe->ioprio    = IORING_RECV_MULTISHOT;
+	sqe->addr      = (uint64_t)(uintptr_t)&w->umsg;
+	sqe->len       = 1;
+	sqe->buf_group = w->ubufs.bgid;
+	sqe->user_data = i + 1;
+}
+
+/* One datagram from a multishot completion, in a provided buffer */
+static void uring_msg(struct worker *w, struct group *g, void *buf, uint64_t now)
+{
+	struct io_uring_recvmsg_out *o = buf;
+	uint64_t sw = 0, hw = 0;
+	inet_addr_t from;
+	size_t len;
+	char *msg;
+
+	memset(&from, 0, sizeof(from));
+	memcpy(&from, uring_recvmsg_name(o), o->namelen < sizeof(from) ? o->namelen : sizeof(from));
+
+	if (o->controllen) {
+		struct msghdr m = {
+			.msg_control    = uring_recvmsg_control(o, &w->umsg),
+			.msg_controllen = o->controllen,
+		};
+
+		tstamp_rx_parse(&m, &sw, &hw);
+	}
+
+	msg = uring_recvmsg_payload(o, &w->umsg);
+	len = o->payloadlen < rxsize ? o->payloadlen : rxsize;
+
+	if (w->cap)
+		capture_add(w->cap, hw ? hw : sw ? sw : now, &from, &g->addr, msg, len);
+
+	STAT_INC(w->packets);
+	STAT_ADD(w->bytes, len);
+	process(w, g, msg, len, o->flags & MSG_TRUNC, &from, now, hw ? hw : sw);
+}
+
+/*
+ * Wait for completions from all groups in one system call, which also
+ * submits any re-arming.  Buffers are given back in bulk when done.
+ */
+static void *receiver_uring(struct worker *w)
+{
+	while (1) {
+		struct io_uring_cqe *cqe;
+		uint64_t now;
+
+		/* wake up now and then to hand partial capture buffers to disk */
+		if (uring_submit(&w->uring, 1, w->cap ? 1000000000 : 0) < 0 &&
+		    errno != EINTR && errno != ETIME && errno != EBUSY) {
+			perror("io_uring_enter");
+			exit(1);
+		}
+		STAT_INC(w->calls);
+		if (w->cap)
+			capture_tick(w->cap, clock_ns(CLOCK_MONOTONIC));
+
+		/* one timestamp per wakeup */
+		now = clock_ns(CLOCK_REALTIME);
+		while ((cqe = uring_cqe(&w->uring))) {
+			uint64_t id = cqe->user_data;
+			uint32_t flags = cqe->flags;
+			int res = cqe->res;
+
+			uring_cqe_seen(&w->uring);
+
+			/* stopfd */
+			if (!id)
+				return NULL;
+
+			if (res >= 0 && (flags & IORING_CQE_F_BUFFER)) {
+				uint16_t bid = flags >> IORING_CQE_BUFFER_SHIFT;
+
+				uring_msg(w, &w->groups[id - 1], uring_bufs_get(&w->ubufs, bid), now);
+				uring_bufs_put(&w->ubufs, bid);
+			} else if (res < 0 && res != -ENOBUFS) {
+				errno = -res;
+				perror("io_uring recvmsg");
+				exit(1);
+			}
+
+			/* out of buffers, or the kernel ended it for some other reason */
+			if (!(flags & IORING_CQE_F_MORE))
+				uring_arm(w, id - 1);
+		}
+		uring_bufs_commit(&w->ubufs);
+		if (logging)
+			logring_notify(w->log);
+	}
+
+	return NULL;
+}
+
+static void *receiver(void *arg)
+{
+	struct epoll_event evs[MAXEVENTS];
+	struct worker *w = arg;
+
+	if (opt_engine == ENGINE_URING)
+		return receiver_uring(w);
+
+	while (1) {
+		int num;
+
+		/* wake up now and then to hand partial capture buffers to disk */
+		num = epoll_wait(w->ep, evs, NELEMS(evs), w->cap ? 1000 : -1);
+		if (num < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("epoll_wait");
+			exit(1);
+		}
+		if (w->cap)
+			capture_tick(w->cap, clock_ns(CLOCK_MONOTONIC));
+
+		for (int e = 0; e < num; e++) {
+			void *ptr = evs[e].data.ptr;
+
+			/* stopfd */
+			if (!ptr)
+				return NULL;
+
+			if (ptr == &w->ring)
+				receive_ring(w);
+			else
+				receive(w, ptr);
+		}
+		if (logging)
+			logring_notify(w->log);
+	}
+
+	return NULL;
+}
+
+/* Make sure we can open one socket per group and thread */
+static void nofile(size_t num)
+{
+	struct rlimit rl;
+
+	if (getrlimit(RLIMIT_NOFILE, &rl))
+		return;
+
+	if (rl.rlim_cur >= num + 32)
+		return;
+
+	rl.rlim_cur = num + 32;
+	if (rl.rlim_max != RLIM_INFINITY && rl.rlim_cur > rl.rlim_max)
+		rl.rlim_cur = rl.rlim_max;
+	if (setrlimit(RLIMIT_NOFILE, &rl))
+		perror("setrlimit() RLIMIT_NOFILE");
+}
+
+static int open_group(struct worker *w, struct group *g)
+{
+	if (g->addr.ss_family == AF_INET6 && num_ifaddr) {
+		fprintf(stderr, "Joining IPv6 groups by source address not supported, use -I\n");
+		return -1;
+	}
+
+	if (g->addr.ss_family == AF_INET6 && !opt_ifname) {
+		fprintf(stderr, "-I is mandatory with IPv6\n");
+		return -1;
+	}
+
+	/* get a datagram socket */
+	g->sd = sock_create(&g->addr, NULL, opt_threads > 1 ? SOCK_F_REUSEPORT : 0);
+	if (g->sd < 0)
+		return -1;
+
+	/* only accept this thread's share of the senders */
+	if (opt_threads > 1 && opt_engine != ENGINE_PACKET &&
+	    sock_steer(g->sd, g->addr.ss_family, opt_steer, opt_threads, w->id))
+		return -1;
+
+	/* join the multicast group. */
+	if (sock_mc_join(g->sd, source, &g->addr, opt_ifname, num_ifaddr, ifaddr))
+		return -1;
+
+	/* only holds the membership, traffic is read from the ring */
+	if (opt_engine == ENGINE_PACKET)
+		return sock_drop(g->sd);
+
+	if (opt_tstamp && tstamp_rx_enable(g->sd, opt_ifname, opt_tstamp > 1))
+		return -1;
+
+	if (opt_gro && sock_gro(g->sd))
+		return -1;
+
+	if (!flags) {
+		struct timeval tv = {
+			.tv_sec  = timeout.tv_sec,
+			.tv_usec = timeout.tv_nsec / 1000,
+		};
+
+		/* bound the wait for the first packet of a batch as well */
+		if (setsockopt(g->sd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv))) {
+			perror("setsockopt() SO_RCVTIMEO");
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * One ring for all groups of the thread, with the sockets as fixed files
+ * and one pool of provided buffers.  Each buffer has room for the
+ * recvmsg() header, source address, timestamps, and the datagram.
+ */
+static int uring_setup(struct worker *w)
+{
+	struct io_uring_sqe *sqe;
+	unsigned int num;
+	size_t size;
+	int *fds;
+
+	for (size_t i = 0; i < num_groups; i++) {
+		if (open_group(w, &w->groups[i]))
+			return -1;
+	}
+
+	if (uring_init(&w->uring, 256)) {
+		perror("io_uring_setup");
+		return -1;
+	}
+
+	fds = calloc(num_groups, sizeof(*fds));
+	if (!fds) {
+		perror("calloc");
+		return -1;
+	}
+	for (size_t i = 0; i < num_groups; i++)
+		fds[i] = w->groups[i].sd;
+	if (uring_files(&w->uring, fds, num_groups)) {
+		perror("io_uring_register() files");
+		return -1;
+	}
+	free(fds);
+
+	w->umsg.msg_namelen    = sizeof(inet_addr_t);
+	w->umsg.msg_controllen = opt_tstamp ? TSTAMP_CTRLSZ : 0;
+	size = sizeof(struct io_uring_recvmsg_out) + w->umsg.msg_namelen + w->umsg.msg_controllen + rxsize;
+	size = (size + 63) & ~63UL;
+
+	/* as many as fit in URINGMEM, power of two for the ring */
+	for (num = URINGBUFS; num > 16 && num * size > URINGMEM; num /= 2)
+		;
+	if (uring_bufs_init(&w->uring, &w->ubufs, 0, num, size)) {
+		perror("io_uring_register() buffers");
+		return -1;
+	}
+
+	for (size_t i = 0; i < num_groups; i++)
+		uring_arm(w, i);
+
+	/* stopfd, poll does not consume it, all threads see it */
+	while (!(sqe = uring_sqe(&w->uring)))
+		uring_submit(&w->uring, 0, 0);
+	sqe->opcode        = IORING_OP_POLL_ADD;
+	sqe->fd            = stopfd;
+	sqe->poll32_events = POLLIN;
+	sqe->user_data     = 0;
+
+	return 0;
+}
+
+static int worker_init(struct worker *w, int id, int cpu)
+{
+	struct epoll_event ev = { .events = EPOLLIN, .data.ptr = NULL };
+
+	w->id      = id;
+	w->cpu     = cpu;
+	w->log     = &logs[id];
+	w->counter = 1;
+
+	if (caps) {
+		w->cap = &caps[id];
+		if (capture_init(w->cap)) {
+			perror("capture_init");
+			return -1;
+		}
+	}
+
+	w->ep = epoll_create1(0);
+	if (w->ep < 0) {
+		perror("epoll_create1");
+		return -1;
+	}
+
+	if (epoll_ctl(w->ep, EPOLL_CTL_ADD, stopfd, &ev)) {
+		perror("epoll_ctl");
+		return -1;
+	}
+
+	w->groups = cache_alloc(num_groups, sizeof(*groups));
+	if (!w->groups) {
+		perror("cache_alloc");
+		return -1;
+	}
+	memcpy(w->groups, groups, num_groups * sizeof(*groups));
+
+	if (opt_engine == ENGINE_PACKET) {
+		inet_addr_t *addrs;
+		int rc;
+
+		/* one thread joins for all, each has its own ring in a fanout group */
+		for (size_t i = 0; i < num_groups && id == 0; i++) {
+			if (open_group(w, &w->groups[i]))
+				return -1;
+		}
+
+		addrs = calloc(num_groups, sizeof(*addrs));
+		if (!addrs) {
+			perror("calloc");
+			return -1;
+		}
+		for (size_t i = 0; i < num_groups; i++)
+			addrs[i] = groups[i].addr;
+
+		rc = packet_rx_open(&w->ring, opt_ifname, gfamily, addrs, num_groups, source,
+				    group_port, opt_threads, opt_steer, opt_tstamp > 1);
+		free(addrs);
+		if (rc)
+			return -1;
+
+		ev.data.ptr = &w->ring;
+		if (epoll_ctl(w->ep, EPOLL_CTL_ADD, w->ring.sd, &ev)) {
+			perror("epoll_ctl");
+			return -1;
+		}
+
+		goto done;
+	}
+
+	if (opt_engine == ENGINE_URING) {
+		if (uring_setup(w))
+			return -1;
+		goto done;
+	}
+
+	for (size_t i = 0; i < num_groups; i++) {
+		struct group *g = &w->groups[i];
+
+		if (open_group(w, g))
+			return -1;
+
+		ev.data.ptr = g;
+		if (epoll_ctl(w->ep, EPOLL_CTL_ADD, g->sd, &ev)) {
+			perror("epoll_ctl");
+			return -1;
+		}
+	}
+
+	/* preallocated buffer ring, one slot per datagram in a batch */
+	w->vec  = calloc(batch, sizeof(*w->vec));
+	w->iov  = calloc(batch, sizeof(*w->iov));
+	w->from = calloc(batch, sizeof(*w->from));
+	w->buf  = malloc(batch * (rxsize + 1));
+	if (ctrlsize)
+		w->ctrl = calloc(batch, ctrlsize);
+	if (!w->vec || !w->iov || !w->from || !w->buf || (ctrlsize && !w->ctrl)) {
+		perror("calloc");
+		return -1;
+	}
+
+	for (int i = 0; i < batch; i++) {
+		w->iov[i].iov_base           = &w->buf[i * (rxsize + 1)];
+		w->iov[i].iov_len            = rxsize;
+		w->vec[i].msg_hdr.msg_iov    = &w->iov[i];
+		w->vec[i].msg_hdr.msg_iovlen = 1;
+		w->vec[i].msg_hdr.msg_name   = &w->from[i];
+	}
+done:
+	if (stream_init(&w->streams, 64)) {
+		perror("stream_init");
+		return -1;
+	}
+
+	hist_init(&w->lat);
+	hist_init(&w->net);
+	hist_init(&w->host);
+
+	return 0;
+}
+
+static int worker_start(struct worker *w)
+{
+	pthread_attr_t attr;
+	int rc;
+
+	pthread_attr_init(&attr);
+	if (w->cpu >= 0) {
+		cpu_set_t set;
+
+		CPU_ZERO(&set);
+		CPU_SET(w->cpu, &set);
+		pthread_attr_setaffinity_np(&attr, sizeof(set), &set);
+	}
+
+	rc = pthread_create(&w->tid, &attr, receiver, w);
+	pthread_attr_destroy(&attr);
+	if (rc) {
+		errno = rc;
+		perror("pthread_create");
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Summary of one sender */
+static void sender(struct stream *st)
+{
+	uint64_t packets = STAT_GET(st->packets);
+	uint64_t bytes = STAT_GET(st->bytes);
+	double sec = (STAT_GET(st->last) - st->first) / 1e9;
+
+	printf("Source [%s]:%d", st->str, st->port);
+	if (st->key.sender)
+		printf(" ID %08x/%u", st->key.sender, st->key.stream);
+	if (num_groups > 1)
+		printf(" to [%s]", groups[st->key.group].str);
+	printf(": %llu packets, %llu bytes", (unsigned long long)packets, (unsigned long long)bytes);
+	if (sec > 0)
+		printf(", %.0f pps, %.2f Mbps", packets / sec, bytes * 8 / sec / 1e6);
+	printf("\n");
+
+	if (opt_isnum && st->seq.arrivals)
+		seq_print(&st->seq, stdout, "  Sequence");
+}
+
+static void summary(void)
+{
+	static struct size_stats sizes;
+	uint64_t total = 0, truncated = 0;
+
+	if (opt_threads > 1) {
+		for (int i = 0; i < opt_threads; i++)
+			total += STAT_GET(workers[i].packets);
+
+		for (int i = 0; i < opt_threads; i++) {
+			struct worker *w = &workers[i];
+			uint64_t packets = STAT_GET(w->packets);
+			uint64_t calls = STAT_GET(w->calls);
+
+			printf("Thread %d, CPU %d: %llu packets (%.1f%%), %llu bytes, %.1f packets/%s\n",
+			       w->id, w->cpu, (unsigned long long)packets,
+			       total ? 100.0 * packets / total : 0.0,
+			       (unsigned long long)STAT_GET(w->bytes),
+			       calls ? (double)packets / calls : 0.0,
+			       opt_engine == ENGINE_PACKET ? "block" : "call");
+		}
+	}
+
+	if (opt_engine == ENGINE_PACKET) {
+		uint64_t frames = 0, drops = 0;
+
+		for (int i = 0; i < opt_threads; i++) {
+			struct packet_rx *r = &workers[i].ring;
+
+			if (packet_rx_stats(r))
+				continue;
+			frames += r->packets;
+			drops  += r->drops;
+		}
+		printf("Ring: %llu frames", (unsigned long long)frames);
+		if (drops)
+			printf(", %llu dropped, ring full", (unsigned long long)drops);
+		printf("\n");
+	}
+
+	for (int i = 0; i < opt_threads; i++) {
+		struct worker *w = &workers[i];
+
+		for (struct stream *st = stream_first(&w->streams); st; st = stream_next(st))
+			sender(st);
+
+		if (STAT_GET(w->untracked))
+			printf("%llu packets from untracked sources, more than %d\n",
+			       (unsigned long long)STAT_GET(w->untracked), STREAM_MAX);
+	}
+
+	/* threads are done, their size counters are safe to read */
+	memset(&sizes, 0, sizeof(sizes));
+	for (int i = 0; i < opt_threads; i++) {
+		truncated += STAT_GET(workers[i].truncated);
+		size_merge(&sizes, &workers[i].sizes);
+	}
+	if (truncated)
+		printf("%llu datagrams truncated\n", (unsigned long long)truncated);
+	if (sizes.num > 1 || sizes.other)
+		size_print(&sizes, stdout, opt_isnum);
+
+	if (num_groups < 2)
+		return;
+
+	for (size_t i = 0; i < num_groups; i++) {
+		uint64_t packets = 0, bytes = 0;
+
+		for (int j = 0; j < opt_threads; j++) {
+			packets += STAT_GET(workers[j].groups[i].packets);
+			bytes   += STAT_GET(workers[j].groups[i].bytes);
+		}
+
+		printf("Group [%s]:%d: %llu packets, %llu bytes\n", groups[i].str, group_port,
+		       (unsigned long long)packets, (unsigned long long)bytes);
+	}
+}
+
 int main(int argc, char *argv[])
 {
-	inet_addr_t *source = NULL, group;
-	inet_addr_t ifaddr[MAXIP];
-	size_t num_ifaddr = 0;
-	char msg[BUFSIZE];
-	int starttime;
-	int prev = 0;
+	char *gfile[MAXIP], *garg[MAXIP];
+	size_t num_gfile = 0, num_garg = 0;
+	uint64_t stop = 1, next, interval;
+	int cpus[THREADMAX], num_cpus;
+	sigset_t set;
 	int ret, c;
-	int sd;
 
-	while ((c = getopt(argc, argv, "46g:hi:I:np:qs:v")) != EOF) {
+	while ((c = getopt(argc, argv, "46b:e:f:g:GhH:i:I:K:Lnp:qr:s:t:T:vw:W:")) != EOF) {
 		switch (c) {
 		case '4':
 			opt_family = AF_INET; /* for completeness */
@@ -66,11 +1198,51 @@ int main(int argc, char *argv[])
 		case '6':
 			opt_family = AF_INET6;
 			break;
+		case 'b':
+			batch = atoi(optarg);
+			if (batch < 1 || batch > BATCHMAX) {
+				fprintf(stderr, "Invalid batch size, 1-%d\n", BATCHMAX);
+				exit(1);
+			}
+			break;
+		case 'e':
+			if (!strcmp(optarg, "socket"))
+				opt_engine = ENGINE_SOCKET;
+			else if (!strcmp(optarg, "packet"))
+				opt_engine = ENGINE_PACKET;
+			else if (!strcmp(optarg, "uring"))
+				opt_engine = ENGINE_URING;
+			else
+				return usage(1);
+			break;
+		case 'f':
+			if (num_gfile >= NELEMS(gfile)) {
+				fprintf(stderr, "Too many group files, max %zu supported.\n", NELEMS(gfile));
+				exit(1);
+			}
+			gfile[num_gfile++] = optarg;
+			break;
 		case 'g':
-			group_addr = optarg;
+			if (num_garg >= NELEMS(garg)) {
+				fprintf(stderr, "Too many -g, max %zu supported, use ranges or -f FILE.\n",
+					NELEMS(garg));
+				exit(1);
+			}
+			garg[num_garg++] = optarg;
 			break;
 		case 'h':
 			return usage(0);
+		case 'G':
+			opt_gro = 1;
+			break;
+		case 'H':
+			if (!strcmp(optarg, "src"))
+				opt_steer = SOCK_STEER_SRC;
+			else if (!strcmp(optarg, "flow"))
+				opt_steer = SOCK_STEER_FLOW;
+			else
+				return usage(1);
+			break;
 		case 'i':
 			if (num_ifaddr >= NELEMS(ifaddr)) {
 				fprintf(stderr, "Too many addresses, max %zu supported.\n", NELEMS(ifaddr));
@@ -91,6 +1263,18 @@ int main(int argc, char *argv[])
 
 			opt_ifname = optarg;
 			break;
+		case 'K':
+			if (!strcmp(optarg, "sw"))
+				opt_tstamp = 1;
+			else if (!strcmp(optarg, "hw"))
+				opt_tstamp = 2;
+			else
+				return usage(1);
+			opt_latency = 1;
+			break;
+		case 'L':
+			opt_latency = 1;
+			break;
 		case 'n':
 			opt_isnum = 1;
 			break;
@@ -100,6 +1284,13 @@ int main(int argc, char *argv[])
 		case 'q':
 			opt_verbose = 0;
 			break;
+		case 'r':
+			opt_interval = strtod(optarg, NULL) * 1e9;
+			if (opt_interval < 1000000) {
+				fprintf(stderr, "Invalid report interval, min 0.001 sec\n");
+				exit(1);
+			}
+			break;
 		case 's':
 			if (source) {
 				fprintf(stderr, "Only single source filtering supported currently.\n");
@@ -114,100 +1305,255 @@ int main(int argc, char *argv[])
 			if (ret)
 				exit(1);
 			break;
+		case 't':
+			ret = atoi(optarg);
+			if (ret < 0) {
+				fprintf(stderr, "Invalid batch timeout %s\n", optarg);
+				exit(1);
+			}
+			/* zero would block forever, same as the default instead */
+			timeout.tv_sec  = ret / 1000000;
+			timeout.tv_nsec = (ret % 1000000) * 1000;
+			flags = ret ? 0 : MSG_DONTWAIT;
+			break;
+		case 'T':
+			opt_threads = atoi(optarg);
+			if (opt_threads < 1 || opt_threads > THREADMAX) {
+				fprintf(stderr, "Invalid number of threads, 1-%d\n", THREADMAX);
+				exit(1);
+			}
+			break;
 		case 'v':
 			printf("mreceive version %s\n", VERSION);
 			return 0;
+		case 'w':
+			opt_capture = optarg;
+			break;
+		case 'W':
+			if (capture_limit(optarg, &opt_capsize, &opt_captime)) {
+				fprintf(stderr, "Invalid capture file limit %s, e.g. 100M or 10m\n", optarg);
+				exit(1);
+			}
+			break;
 		default:
 			fprintf(stderr, "wrong parameters!\n\n");
 			return usage(1);
 		}
 	}
 
-	if (group_addr == NULL) {
+	/* port is known only after all options have been parsed */
+	for (size_t i = 0; i < num_garg; i++) {
+		if (group_add(&groups, &num_groups, garg[i], group_port))
+			exit(1);
+	}
+	for (size_t i = 0; i < num_gfile; i++) {
+		if (group_file(&groups, &num_groups, gfile[i], group_port))
+			exit(1);
+	}
+
+	if (!num_groups) {
 		if (opt_family == AF_INET)
 			group_addr = TEST_ADDR_IPV4;
 		else if (opt_family == AF_INET6)
 			group_addr = TEST_ADDR_IPV6;
 		else
 			exit(1);
+
+		if (group_add(&groups, &num_groups, group_addr, group_port))
+			exit(1);
 	}
 
-	ret = inet_parse(&group, group_addr, group_port);
-	if (ret)
-		exit(1);
+	if (opt_engine == ENGINE_PACKET) {
+		if (!opt_ifname) {
+			fprintf(stderr, "-e packet needs an interface, -I\n");
+			exit(1);
+		}
 
-	if (group.ss_family == AF_INET6 && num_ifaddr) {
-		fprintf(stderr, "Joining IPv6 groups by source address not supported, use -I\n");
-		exit(1);
+		gfamily = groups[0].addr.ss_family;
+		for (size_t i = 1; i < num_groups; i++) {
+			if (groups[i].addr.ss_family != gfamily)
+				gfamily = 0;
+		}
+
+		if (group_index_init(&gindex, groups, num_groups)) {
+			perror("group_index_init");
+			exit(1);
+		}
 	}
 
-	if (group.ss_family == AF_INET6 && !opt_ifname) {
-		fprintf(stderr, "-I is mandatory with IPv6\n");
+	/* a blocking read on one group would stall all others of the thread */
+	if (!flags && num_groups > 1) {
+		fprintf(stderr, "-t only works with a single group, ignored\n");
+		flags = MSG_DONTWAIT;
+	}
+
+	if (opt_gro && opt_engine != ENGINE_SOCKET) {
+		fprintf(stderr, "-G only works with -e socket\n");
 		exit(1);
 	}
 
-	/* get a datagram socket */
-	sd = sock_create(&group, NULL);
-	if (sd < 0)
+	if (opt_engine == ENGINE_URING && uring_probe(1)) {
+		fprintf(stderr, "io_uring not available (%s), using socket engine\n", strerror(errno));
+		opt_engine = ENGINE_SOCKET;
+	}
+
+	stopfd = eventfd(0, 0);
+	if (stopfd < 0) {
+		perror("eventfd");
 		exit(1);
+	}
 
-	/* join the multicast group. */
-	ret = sock_mc_join(sd, source, &group, opt_ifname, num_ifaddr, ifaddr);
-	if (ret)
+	workers = cache_alloc(opt_threads, sizeof(*workers));
+	logs    = cache_alloc(opt_threads, sizeof(*logs));
+	if (!workers || !logs) {
+		perror("cache_alloc");
 		exit(1);
+	}
+
+	if (opt_capture) {
+		caps = cache_alloc(opt_threads, sizeof(*caps));
+		if (!caps) {
+			perror("cache_alloc");
+			exit(1);
+		}
+		/* capture kernel receive time, not when we got around to it */
+		if (!opt_tstamp)
+			opt_tstamp = 1;
+	}
 
-	logit("Now receiving from multicast group: [%s]:%d\n", group_addr, group_port);
+	ctrlsize = (opt_tstamp ? TSTAMP_CTRLSZ : 0) + (opt_gro ? SOCK_GRO_CTRLSZ : 0);
 
-	for (int i = 0;; i++) {
-		char from_buf[INET_ADDRSTR_LEN];
-		inet_addr_t from = group;
-		static int counter = 1;
-		const char *from_str;
-		socklen_t len;
+	/* pin threads round-robin over the CPUs we may run on, if more than one */
+	num_cpus = opt_threads > 1 ? cpu_list(cpus, NELEMS(cpus)) : 0;
 
-		/* receive from the multicast address */
-		len = inet_addrlen(&from);
-		ret = recvfrom(sd, msg, sizeof(msg), 0, (struct sockaddr *)&from, &len);
-		if (ret < 0) {
-			perror("recvfrom");
+	nofile(num_groups * opt_threads);
+	for (int i = 0; i < opt_threads; i++) {
+		if (worker_init(&workers[i], i, num_cpus ? cpus[i % num_cpus] : -1))
 			exit(1);
+	}
+
+	if (num_groups == 1) {
+		logit("Now receiving from multicast group: [%s]:%d\n", groups[0].str, group_port);
+	} else {
+		logit("Now receiving from %zu multicast groups, port %d\n", num_groups, group_port);
+	}
+	if (opt_threads > 1) {
+		logit("Using %d threads, senders sharded by %s\n", opt_threads,
+		      opt_steer == SOCK_STEER_SRC ? "source address" : "flow");
+	}
+
+	if (opt_latency) {
+		int64_t diff = clock_ns(CLOCK_TAI) - clock_ns(CLOCK_REALTIME);
+
+		/* TAI-UTC is a whole number of seconds, 0 if not set by NTP */
+		tai_offset = (diff + 500000000) / 1000000000 * 1000000000;
+		hist_init(&lat_prev);
+		hist_init(&net_prev);
+		hist_init(&host_prev);
+	}
+
+	/* workers inherit the mask, signals are only handled by main */
+	sigemptyset(&set);
+	sigaddset(&set, SIGINT);
+	sigaddset(&set, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+	if (opt_capture && capture_start(caps, opt_threads, opt_capture, opt_capsize, opt_captime)) {
+		perror("capture");
+		exit(1);
+	}
+
+	/* per-packet output is formatted and written by a thread of its own */
+	if (!opt_interval) {
+		for (int i = 0; i < opt_threads; i++) {
+			if (logring_init(&logs[i])) {
+				perror("logring_init");
+				exit(1);
+			}
 		}
 
-		from_str = inet_address(&from, from_buf, sizeof(from_buf));
-		if (!from_str) {
-			perror("inet_ntop");
+		fflush(stdout);
+		if (logring_start(logs, opt_threads, logfmt, STDOUT_FILENO)) {
+			perror("logring_start");
 			exit(1);
 		}
+		logging = 1;
+	}
 
-		if (opt_isnum) {
-			int now, curr = atoi(msg);
-			struct timeval tv;
+	for (int i = 0; i < opt_threads; i++) {
+		if (worker_start(&workers[i]))
+			exit(1);
+	}
 
-			gettimeofday(&tv, NULL);
-			if (i == 0)
-				/* 500 to adjust for already executed instructions */
-				starttime = tv.tv_sec * 1000000 + tv.tv_usec - 500;
-
-			now = tv.tv_sec * 1000000 + tv.tv_usec - starttime;
-			logit("%5d\t[%s]:%5d\t%d.%03d\t%5u\n", counter, from_str, inet_port(&from),
-			      now / 1000000, (now % 1000000) / 1000, curr);
-
-			if (curr > prev + 1) {
-				if (prev + 1 == curr - 1)
-					printf("****************\nMessage not received: %d\n****************\n", prev + 1);
-				else
-					printf("****************\nMessages not received: %d to %d\n****************\n",
-					       prev + 1, curr - 1);
-			}
-			if (curr == prev)
-				printf("Duplicate message received: %d\n", curr);
-			if (curr < prev)
-				printf("****************\nGap detected: %d from %d\n****************\n", curr, prev);
-			prev = curr;
+	/* main thread only reports and waits for ^C */
+	interval = opt_interval ? opt_interval : opt_latency ? INTERVAL : 0;
+	starttime = clock_ns(CLOCK_REALTIME);
+	next = starttime + interval;
+	while (1) {
+		struct timespec ts;
+		uint64_t now;
+		int sig;
+
+		if (!interval) {
+			sig = sigwaitinfo(&set, NULL);
 		} else {
-			logit("Receive msg %d from [%s]:%d: %s\n", counter, from_str, inet_port(&from), msg);
+			now = clock_ns(CLOCK_REALTIME);
+			ns_timespec(next > now ? next - now : 0, &ts);
+			sig = sigtimedwait(&set, NULL, &ts);
+		}
+
+		if (sig > 0)
+			break;
+		if (errno == EAGAIN) {
+			report(next);
+			next += interval;
+		}
+	}
+
+	if (write(stopfd, &stop, sizeof(stop)) != sizeof(stop))
+		perror("write");
+	for (int i = 0; i < opt_threads; i++)
+		pthread_join(workers[i].tid, NULL);
+
+	if (!opt_interval) {
+		uint64_t dropped;
+
+		logring_stop();
+		logging = 0;
+		dropped = logring_dropped(logs, opt_threads);
+		if (dropped)
+			printf("%llu log records dropped, output too slow\n", (unsigned long long)dropped);
+	}
+
+	if (opt_capture) {
+		uint64_t packets = 0, dropped = 0;
+
+		capture_stop();
+		for (int i = 0; i < opt_threads; i++) {
+			packets += STAT_GET(caps[i].packets);
+			dropped += STAT_GET(caps[i].dropped);
+		}
+		printf("Captured %llu packets to %s", (unsigned long long)packets, opt_capture);
+		if (dropped)
+			printf(", %llu dropped, disk too slow", (unsigned long long)dropped);
+		printf("\n");
+	}
+
+	/* last, partial, interval */
+	if (interval)
+		report(clock_ns(CLOCK_REALTIME));
+
+	summary();
+
+	if (opt_latency) {
+		hist_print(&lat, stdout, "Latency total", 1000.0, "us");
+		hist_dump(&lat, stdout, 1000.0, "us");
+		if (opt_tstamp) {
+			hist_print(&net, stdout, "Network total", 1000.0, "us");
+			hist_dump(&net, stdout, 1000.0, "us");
+			hist_print(&host, stdout, "Host total", 1000.0, "us");
+			hist_dump(&host, stdout, 1000.0, "us");
 		}
-		counter++;
 	}
 
 	return 0;
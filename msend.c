@@ -20,69 +20,1249 @@
  * 
  */
 
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
 #include "common.h"
+#include "frame.h"
+#include "hist.h"
+#include "logring.h"
+#include "pace.h"
+#include "packet.h"
+#include "proto.h"
+#include "replay.h"
+#include "size.h"
+#include "tstamp.h"
+#include "uring.h"
+
+#define TXRING 65536		/* in-flight TX timestamps, power of two */
+#define ZCDEPTH 8		/* -Z, batches in flight before reusing buffers */
+#define ZCPROBE 256		/* -Z, completions to judge if it is worth it */
+
+/* send engines, -e */
+enum {
+	ENGINE_SOCKET,		/* sendto() or sendmmsg() on a UDP socket */
+	ENGINE_PACKET,		/* prebuilt frames in an AF_PACKET send ring */
+	ENGINE_URING,		/* batch of sendmsg() submissions to io_uring */
+};
+
+/* log records, formatted by the log writer thread */
+enum {
+	LOG_SEND,		/* seq; text */
+	LOG_SENT,		/* number of msgs */
+	LOG_TX,			/* seq, TSTAMP_*, delay ns */
+};
+
+/*
+ * One sender thread, with its own socket, sequence space (stream ID),
+ * pacer, and payload.  Counters are only written by the thread itself,
+ * and each sender starts on a cache line of its own.
+ */
+struct sender {
+	unsigned long long packets;
+	unsigned long long bytes;
+	unsigned long long calls;
+	uint64_t           counter;	/* next sequence number */
+	uint64_t           start;
+	uint64_t           end;
+
+	int                id;
+	int                cpu;		/* -1: not pinned */
+	int                sd;
+	unsigned long long count;	/* packets to send, 0: until ^C */
+	pthread_t          tid;
+
+	struct pace        pace;
+	struct pace       *pacer;
+
+	/* batched transmit, each packet has its own copy of the payload */
+	struct mmsghdr    *vec;
+	struct iovec      *iov;
+
+	/* -Z, message slot i is busy until the kernel is done with send i */
+	uint8_t           *zc_busy;
+	unsigned int       zc_slots;
+	uint32_t           zc_next;	/* ID of next send, counted by kernel */
+	int                zc_flags;	/* MSG_ZEROCOPY, or 0 when not worth it */
+	unsigned long long zc_sends;
+	unsigned long long zc_done;
+	unsigned long long zc_copied;
+
+	char              *msg;		/* template, as large as largest -s */
+	char              *text;
+	inet_addr_t       *to;		/* per packet destination, for replay */
+
+	/* -e packet, every slot holds the frame, seq and tstamp patched */
+	struct packet_tx   tx;
+	size_t             framelen;
+	uint32_t           csum;	/* UDP checksum sum, seq and tstamp 0 */
+
+	/* -e uring, socket is fixed file 0, batch messages are reused */
+	struct uring       uring;
+
+	/* -s, current step of sweep, random state for mix, and what was sent */
+	unsigned int       step;
+	uint64_t           step_end;	/* ns, CLOCK_MONOTONIC */
+	uint64_t           rng;
+	struct size_stats  sizes;
+
+	struct logring    *log;		/* to log writer, if -v */
+
+	/* at last interval report, only used by main */
+	struct {
+		unsigned long long packets;
+		unsigned long long bytes;
+	} prev;
+} __attribute__((aligned(CACHELINE)));
+
+static volatile sig_atomic_t running = 1;
+static int      tsflags;
+
+static struct sender *senders;
+static struct logring *logs;	/* one per sender, and one for TX timestamps */
+static int      logging;
+static int      alive;
+static pthread_t mainthr;
+
+static inet_addr_t group;
+static int      batch;
+static int      opt_batch;	/* -b given, paced in whole batches */
+static int      gso = 1;	/* -G, datagrams per buffer */
+static struct size_profile profile;	/* -s, datagram sizes */
+static uint64_t opt_step = 1000000000ULL;	/* -step, ns per size of sweep */
+static int      opt_zerocopy;
+static int      opt_engine = ENGINE_SOCKET;
+static uint64_t opt_interval;	/* -r, ns */
+static int      opt_threads = 1;
+
+/* -replay FILE, datagrams with their original timing, group and port */
+static char    *opt_replay;
+static double   opt_speed = 1.0;	/* -speed, 0: max */
+static unsigned long long opt_loop = 1;	/* -loop, 0: forever */
+static struct replay replay;
+static int      replay_group;	/* -g, rewrite group */
+static int      replay_port;	/* -p, rewrite port */
+static uint64_t replay_offset;	/* capture time at start of current loop */
+static unsigned long long replay_loops;
+static unsigned long long replay_skipped;
+
+/*
+ * Send time of each datagram, indexed by its SO_TIMESTAMPING ID, which
+ * the kernel counts from zero per socket.  Written by the send loop and
+ * read by the thread draining the error queue.
+ */
+static struct txslot {
+	uint32_t id;
+	uint64_t seq;
+	uint64_t sent;
+} *txring;
+static uint32_t txid;
+static volatile int txdone;
+static unsigned long long txstale;
+static struct hist sched, snd;
 
 
 static int usage(int rc)
 {
 	printf("\
-Usage:  msend [-46hnv] [-c NUM] [-g GROUP] [-p PORT] [-join] [-i ADDRESS]\n\
-	      [-I INTERFACE] [-P PERIOD] [-t TTL] [-text \"text\"]\n\
+Usage:  msend [-46hKnv] [-A CPUS] [-b NUM] [-B NUM] [-c NUM] [-e ENGINE] [-g GROUP] [-G NUM]\n\
+	      [-join] [-i ADDRESS] [-I INTERFACE] [-p PORT] [-P PERIOD] [-r SEC] [-R RATE]\n\
+	      [-s SIZE [-step SEC]] [-S ID] [-t TTL] [-T NUM] [-tai] [-text \"text\"] [-Z]\n\
+	      [-replay FILE [-speed X|max] [-loop NUM]]\n\
 \n\
   -4 | -6      Select IPv4 or IPv6, use with -I, when -i is not used\n\
+  -A CPUS      Pin sender threads round-robin to CPUS, e.g. 2,4-7\n\
+  -b NUM       Batch up to NUM packets per sendmmsg() call, paced in whole batches\n\
+  -B NUM       Burst size for -R, max packets sent back-to-back.  Default: 1\n\
   -c NUM       Number of packets to send. Default: send indefinitely\n\
+  -e ENGINE    Send engine, socket: UDP socket, packet: prebuilt frames in an\n\
+               AF_PACKET send ring on -I INTERFACE, one send() per batch,\n\
+               not looped back to local receivers, uring: one io_uring\n\
+               system call per batch of sendmsg().  Default: socket\n\
   -g GROUP     IP multicast group address to send to.\n\
                Default for IPv4: 224.1.1.1, IPv6: ff2e::1\n\
+  -G NUM       Generic segmentation offload, UDP_SEGMENT, hand the kernel NUM\n\
+               datagrams in one buffer, split after routing.  Use with -P 0\n\
+               or -R, combines with -b\n\
   -h           This help text.\n\
   -i ADDRESS   IP address of the interface to use to send the packets.\n \
                The default is to use the system default interface.\n\
   -I INTERFACE The interface on which to send. Can be specified as an\n\
                alternative to -i.\n\
+  -K           Enable kernel TX timestamps, report time from send syscall\n\
+               to packet scheduler (qdisc) and to driver at exit\n\
   -join        Multicast sender will join the multicast group.\n\
                By default a sender never joins the group.\n\
-  -n           Encode -text argument as a number instead of a string.\n\
+  -loop NUM    Replay the capture NUM times, 0 for forever.  Default: 1\n\
+  -n           Prepend a binary header with 64-bit sequence number and send\n\
+               time to each packet.  Use with `mreceive -n`\n\
   -p PORT      UDP port number used in the multicast packets.  Default: 4444\n\
   -P PERIOD    Interval in milliseconds between packets.  Default 1000 msec\n\
+               Use -P 0 to send as fast as possible, rate shown at exit.\n\
   -q           Quiet, don't print 'Sedning msg ...' for every packet\n\
+  -r SEC       Report send rate every SEC seconds instead of every packet\n\
+  -R RATE      Send at RATE packets/s, or bits/s with bps suffix.  Accepts\n\
+               k, M, and G multipliers, e.g. 10k, 1Mpps, 250Mbps\n\
+  -replay FILE Replay UDP datagrams from a pcap or pcapng FILE, with their\n\
+               original timing, group, and port.  Use -g and -p to rewrite\n\
+               group and port, and -t for TTL\n\
+  -s SIZE      UDP payload size, up to 65507 bytes for IPv4, 65527 for IPv6,\n\
+               or a profile: FIRST-LAST[/STEP] sweep, doubling without STEP,\n\
+               SIZE:WEIGHT,... random mix, or imix.  Default: 1024\n\
+  -S ID        Sender ID in header, for -n.  Default: random\n\
+  -speed X|max Replay at X times the original speed, e.g. 0.5 or 2, or as\n\
+               fast as possible.  Default: 1\n\
+  -step SEC    Time to send each size of a -s sweep.  Default: 1\n\
   -t TTL       The TTL value (1-255) used in the packets.  You must set\n\
                this higher if you want to route the traffic, otherwise\n\
                the first router will drop the packets!  Default: 1\n\
+  -T NUM       Send using NUM threads, each with its own socket, source port,\n\
+               and stream ID in the header.  Rate and count are split evenly\n\
+  -tai         Use CLOCK_TAI instead of CLOCK_REALTIME for send time, for -n\n\
   -text \"text\" Specify a string to use as payload in the packets, also\n\
                displayed by the mreceive command.  Default: empty\n\
-  -v           Print version information.\n\n");
+  -v           Print version information.\n\
+  -Z           Zero-copy transmit, MSG_ZEROCOPY, from a pool of locked buffers\n\
+               recycled when the kernel reports it is done with them.  With\n\
+               -e uring, zero-copy sends from registered buffers\n\n");
 
 	return rc;
 }
 
-static int do_send(int sd, inet_addr_t *to, char *msg, size_t len, int isnum)
+static void sigcb(int signo)
+{
+	(void)signo;
+	running = 0;
+}
+
+/* Runs in the log writer thread */
+static size_t logfmt(const struct logrec *r, char *buf, size_t len)
+{
+	unsigned long long a = r->arg[0];
+	int n = 0;
+
+	switch (r->type) {
+	case LOG_SEND:
+		n = snprintf(buf, len, "Sending msg %llu, TTL %d, to [%s]:%d: %.*s\n", a, opt_ttl,
+			     group_addr, group_port, (int)r->len, r->text);
+		break;
+	case LOG_SENT:
+		n = snprintf(buf, len, "Sent %llu msgs, TTL %d, to [%s]:%d\n", a, opt_ttl,
+			     group_addr, group_port);
+		break;
+	case LOG_TX:
+		n = snprintf(buf, len, "Msg %llu %s after %.1f us\n", a,
+			     r->arg[1] == TSTAMP_SCHED ? "in qdisc" : "to driver",
+			     (int64_t)r->arg[2] / 1000.0);
+		break;
+	}
+
+	if (n < 0)
+		return 0;
+
+	return (size_t)n < len ? (size_t)n : len - 1;
+}
+
+/*
+ * Queue a log record for the writer thread, dropped if the ring is full.
+ * Records are one per system call here, so each may as well notify.
+ */
+static void logput(struct logring *log, uint32_t type, uint64_t a, uint64_t b, uint64_t c,
+		   const char *text)
+{
+	struct logrec *r;
+
+	r = logring_claim(log);
+	if (!r)
+		return;
+
+	r->type   = type;
+	r->arg[0] = a;
+	r->arg[1] = b;
+	r->arg[2] = c;
+	r->len    = text ? strnlen(text, sizeof(r->text)) : 0;
+	if (r->len)
+		memcpy(r->text, text, r->len);
+
+	logring_commit(log);
+	logring_notify(log);
+}
+
+/* Record send time of next num datagrams, called before send syscall */
+static void txrecord(struct sender *s, int num)
+{
+	uint64_t now = clock_ns(CLOCK_REALTIME);
+
+	for (int i = 0; i < num; i++) {
+		struct txslot *slot = &txring[(txid + i) & (TXRING - 1)];
+
+		slot->seq  = s->counter + i;
+		slot->sent = now;
+		__atomic_store_n(&slot->id, txid + i, __ATOMIC_RELEASE);
+	}
+}
+
+static void txstamp(uint32_t id, int type, uint64_t ts, void *arg)
+{
+	struct txslot *slot = &txring[id & (TXRING - 1)];
+	int64_t delay;
+
+	(void)arg;
+	if (__atomic_load_n(&slot->id, __ATOMIC_ACQUIRE) != id) {
+		txstale++;
+		return;
+	}
+
+	delay = ts - slot->sent;
+	hist_add(type == TSTAMP_SCHED ? &sched : &snd, delay);
+	if (logging)
+		logput(&logs[opt_threads], LOG_TX, slot->seq, type, delay, NULL);
+}
+
+/* Drain the error queue asynchronously, off the send path */
+static void *txthread(void *arg)
+{
+	struct pollfd pfd = {
+		.fd     = *(int *)arg,
+		.events = 0,	/* POLLERR is always reported */
+	};
+
+	while (!txdone) {
+		if (poll(&pfd, 1, 100) > 0)
+			tstamp_tx_drain(pfd.fd, txstamp, NULL);
+	}
+	tstamp_tx_drain(pfd.fd, txstamp, NULL);
+
+	return NULL;
+}
+
+/* Size of next datagram, -s */
+static size_t next_size(struct sender *s)
+{
+	if (profile.mode == SIZE_MIX)
+		return size_pick(&profile, &s->rng);
+
+	return profile.ent[s->step].size;
+}
+
+/* Sent datagram by size, only if there is more than one, now is read once */
+static void count_size(struct sender *s, size_t len, uint64_t *now)
+{
+	if (profile.mode == SIZE_FIXED)
+		return;
+
+	if (!*now)
+		*now = clock_ns(CLOCK_MONOTONIC);
+	size_count(&s->sizes, len, 0, *now);
+}
+
+static uint64_t do_send(struct sender *s, inet_addr_t *to, size_t len, int isnum)
 {
-	static int counter = 1;
+	uint64_t now = 0;
 	int ret;
 
+	if (isnum) {
+		now = clock_ns(proto_clock(tsflags));
+		proto_stamp(s->msg, s->counter, now);
+		proto_length(s->msg, len);
+	}
+	if (txring)
+		txrecord(s, 1);
+
+	/* interrupted, send the same datagram again unless stopping */
+	while ((ret = sendto(s->sd, s->msg, len, 0, (struct sockaddr *)to, inet_addrlen(to))) < 0) {
+		if (errno == EINTR && running)
+			continue;
+		if (errno == EINTR)
+			return s->counter;
+		perror("sendto");
+		exit(1);
+	}
+
+	STAT_INC(s->packets);
+	STAT_ADD(s->bytes, len);
+	STAT_INC(s->calls);
+	count_size(s, len, &now);
+	txid++;
+
+	return s->counter++;
+}
+
+/* Batched transmit of replayed datagrams, payloads point into the capture */
+static void replay_init(struct sender *s, int num)
+{
+	s->vec = calloc(num, sizeof(*s->vec));
+	s->iov = calloc(num, sizeof(*s->iov));
+	s->to  = calloc(num, sizeof(*s->to));
+	if (!s->vec || !s->iov || !s->to) {
+		perror("calloc");
+		exit(1);
+	}
+
+	for (int i = 0; i < num; i++) {
+		s->vec[i].msg_hdr.msg_iov    = &s->iov[i];
+		s->vec[i].msg_hdr.msg_iovlen = 1;
+	}
+}
+
+/*
+ * Batched transmit, each packet has its own copy of the payload so
+ * every datagram can carry a unique sequence number.  The whole batch
+ * is handed to the kernel in a single sendmmsg() call.  With -G each
+ * message holds segs datagrams back to back, split by the kernel.  Slots
+ * are len apart, datagrams may be shorter, see do_send_batch().
+ */
+static void batch_init(struct sender *s, size_t len, int num, int segs)
+{
+	char *buf;
+
+	s->vec = calloc(num, sizeof(*s->vec));
+	s->iov = calloc(num, sizeof(*s->iov));
+	buf = malloc(num * segs * len);
+	if (!s->vec || !s->iov || !buf) {
+		perror("calloc");
+		exit(1);
+	}
+
+	for (int i = 0; i < num * segs; i++)
+		memcpy(&buf[i * len], s->msg, len);
+
+	/* the kernel pins pages during send, keep the pool resident as well */
+	if (opt_zerocopy && mlock(buf, num * segs * len))
+		fprintf(stderr, "Cannot lock zero-copy buffers (%s), see ulimit -l\n", strerror(errno));
+
+	for (int i = 0; i < num; i++) {
+		s->iov[i].iov_base           = &buf[i * segs * len];
+		s->iov[i].iov_len            = segs * len;
+		s->vec[i].msg_hdr.msg_iov    = &s->iov[i];
+		s->vec[i].msg_hdr.msg_iovlen = 1;
+	}
+}
+
+/*
+ * Zero-copy buffer pool, ZCDEPTH batches of messages.  Message slot
+ * id % zc_slots is reused only when the kernel has reported send id
+ * done, completions can come in any order.
+ */
+static void zc_init(struct sender *s)
+{
+	s->zc_slots = (batch > 1 ? batch : 1) * ZCDEPTH;
+	s->zc_busy  = calloc(s->zc_slots, sizeof(*s->zc_busy));
+	if (!s->zc_busy) {
+		perror("calloc");
+		exit(1);
+	}
+
+	batch_init(s, profile.max, s->zc_slots, gso);
+	if (sock_zerocopy(s->sd))
+		exit(1);
+	s->zc_flags = MSG_ZEROCOPY;
+}
+
+static void zc_complete(uint32_t lo, uint32_t hi, int copied, void *arg)
+{
+	struct sender *s = arg;
+	unsigned int num = hi - lo + 1;
+
+	for (uint32_t id = lo; id != hi + 1; id++)
+		s->zc_busy[id % s->zc_slots] = 0;
+
+	s->zc_done += num;
+	if (copied)
+		s->zc_copied += num;
+
+	/* copying anyway, e.g. no scatter-gather, costs more than a plain send */
+	if (s->zc_flags && s->zc_done >= ZCPROBE && s->zc_copied * 2 > s->zc_done)
+		s->zc_flags = 0;
+}
+
+/* Wait for the kernel to let go of num slots from off */
+static void zc_wait(struct sender *s, unsigned int off, int num)
+{
+	struct pollfd pfd = {
+		.fd     = s->sd,
+		.events = 0,	/* POLLERR is always reported */
+	};
+
+	for (int i = 0; i < num; i++) {
+		while (s->zc_busy[off + i]) {
+			if (sock_zc_drain(s->sd, zc_complete, s) > 0)
+				continue;
+			poll(&pfd, 1, 100);
+		}
+	}
+}
+
+/*
+ * Send num datagrams, in messages of up to gso datagrams each, slots are
+ * len apart.  With -G all datagrams have the same size, otherwise each
+ * message is one datagram of the size next in line.
+ */
+static int do_send_batch(struct sender *s, inet_addr_t *to, size_t len, int isnum, int num)
+{
+	struct mmsghdr *vec = s->vec;
+	struct iovec *iov = s->iov;
+	unsigned long long bytes = 0;
+	struct pollfd pfd = {
+		.fd     = s->sd,
+		.events = 0,	/* POLLERR is always reported */
+	};
+	unsigned int off = 0;
+	uint64_t now = 0;
+	int i, msgs, sent, ret, zc;
+
+	msgs = (num + gso - 1) / gso;
+	if (s->zc_busy) {
+		/* contiguous slots only, at the end of the pool in two calls */
+		off = s->zc_next % s->zc_slots;
+		if ((unsigned int)msgs > s->zc_slots - off) {
+			int first = (s->zc_slots - off) * gso;
+
+			ret = do_send_batch(s, to, len, isnum, first);
+			if (ret < first)
+				return ret;
+			return ret + do_send_batch(s, to, len, isnum, num - first);
+		}
+		zc_wait(s, off, msgs);
+		vec = &s->vec[off];
+		iov = &s->iov[off];
+	}
+
+	/* the whole batch enters the kernel at the same time */
 	if (isnum)
-		snprintf(msg, len, "%d", counter);
+		now = clock_ns(proto_clock(tsflags));
+
+	for (i = 0; i < msgs; i++) {
+		int segs = num - i * gso < gso ? num - i * gso : gso;
+		size_t size = next_size(s);
+		char *buf = iov[i].iov_base;
 
-	ret = sendto(sd, msg, len, 0, (struct sockaddr *)to, inet_addrlen(to));
+		for (int j = 0; isnum && j < segs; j++) {
+			proto_stamp(&buf[j * size], s->counter + i * gso + j, now);
+			proto_length(&buf[j * size], size);
+		}
+		iov[i].iov_len              = segs * size;
+		vec[i].msg_hdr.msg_name    = to;
+		vec[i].msg_hdr.msg_namelen = inet_addrlen(to);
+	}
+	if (txring)
+		txrecord(s, num);
+
+	/*
+	 * Slots are busy before the first send, completions for part of the
+	 * batch may be reaped while waiting for option memory below.  The
+	 * kernel may turn zero-copy off mid batch, keep this batch's mode.
+	 */
+	zc = s->zc_flags;
+	for (i = 0; zc && i < msgs; i++)
+		s->zc_busy[off + i] = 1;
+
+	/* until the whole batch is out, from the first unsent on interrupt */
+	for (sent = 0; sent < msgs; sent += ret) {
+		ret = sendmmsg(s->sd, &vec[sent], msgs - sent, zc);
+		if (ret >= 0)
+			continue;
+
+		ret = 0;
+		if (errno == EINTR && running)
+			continue;
+		if (errno == EINTR)
+			break;
+		/* out of option memory for completions, reap and retry the rest */
+		if (errno == ENOBUFS && zc) {
+			if (!running)
+				break;
+			if (sock_zc_drain(s->sd, zc_complete, s) <= 0)
+				poll(&pfd, 1, 100);
+			continue;
+		}
+		perror("sendmmsg");
+		exit(1);
+	}
+	ret = sent;
+
+	if (zc) {
+		for (i = ret; i < msgs; i++)
+			s->zc_busy[off + i] = 0;
+		s->zc_next  += ret;
+		s->zc_sends += ret;
+	}
+
+	for (i = 0; i < ret; i++) {
+		bytes += iov[i].iov_len;
+		count_size(s, iov[i].iov_len, &now);
+	}
+
+	/* datagrams, only the last message may be short */
+	ret = ret * gso < num ? ret * gso : num;
+	STAT_ADD(s->packets, ret);
+	STAT_ADD(s->bytes, bytes);
+	STAT_INC(s->calls);
+	s->counter += ret;
+	txid       += ret;
+
+	return ret;
+}
+
+/*
+ * Batched transmit from the send ring.  Slots already hold the complete
+ * frame, only sequence number, send time, and UDP checksum change.  The
+ * whole batch is handed to the driver in a single send() call.
+ */
+static void ring_init(struct sender *s, inet_addr_t *ifaddr)
+{
+	struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)ifaddr;
+	struct sockaddr_in *sin = (struct sockaddr_in *)ifaddr;
+	size_t size = frame_hdrlen(group.ss_family) + profile.max;
+	size_t iphdr;		/* IP and UDP, the MTU does not cover Ethernet */
+	uint8_t *frame;
+	inet_addr_t src;
+	socklen_t len = sizeof(src);
+	int mtu, ret;
+
+	/* source port from our socket, address from -i, or the interface */
+	if (getsockname(s->sd, (struct sockaddr *)&src, &len)) {
+		perror("getsockname");
+		exit(1);
+	}
+	if ((ifaddr->ss_family == AF_INET && sin->sin_addr.s_addr == INADDR_ANY) ||
+	    (ifaddr->ss_family == AF_INET6 && IN6_IS_ADDR_UNSPECIFIED(&sin6->sin6_addr))) {
+		in_port_t port = inet_port(&src);
+
+		if (inet_ifaddr(&src, opt_ifname, group.ss_family)) {
+			fprintf(stderr, "No IPv%d address on %s to send from, use -i\n",
+				group.ss_family == AF_INET6 ? 6 : 4, opt_ifname);
+			exit(1);
+		}
+		inet_set_port(&src, port);
+	}
+
+	/* frames bypass IP, nothing fragments a datagram larger than the MTU */
+	mtu = packet_mtu(opt_ifname);
+	if (mtu < 0)
+		exit(1);
+	iphdr = frame_hdrlen(group.ss_family) - 14;
+	if (profile.max + iphdr > (size_t)mtu) {
+		fprintf(stderr, "Invalid size %zu, -e packet max is %zu for the MTU %d of %s\n",
+			profile.max, mtu - iphdr, mtu, opt_ifname);
+		exit(1);
+	}
+
+	if (packet_tx_open(&s->tx, opt_ifname, size))
+		exit(1);
+
+	frame = malloc(size);
+	if (!frame) {
+		perror("malloc");
+		exit(1);
+	}
+
+	/* checksum with seq and tstamp zero, added back per packet */
+	if (opt_isnum)
+		proto_stamp(s->msg, 0, 0);
+	ret = frame_build(frame, size, s->tx.mac, &src, &group, opt_ttl, s->msg,
+			  profile.max, &s->csum);
 	if (ret < 0) {
-		perror("sendto");
+		fprintf(stderr, "Cannot build frame, too large\n");
+		exit(1);
+	}
+	s->framelen = ret;
+
+	packet_tx_fill(&s->tx, frame, s->framelen);
+	free(frame);
+}
+
+static int do_send_ring(struct sender *s, int num)
+{
+	size_t hlen = frame_hdrlen(group.ss_family);
+	uint64_t now = 0;
+	int i = 0;
+
+	if (opt_isnum)
+		now = clock_ns(proto_clock(tsflags));
+
+	while (i < num && running) {
+		struct proto_hdr *hdr;
+		uint16_t csum;
+		uint8_t *f;
+
+		f = packet_tx_next(&s->tx);
+		if (!f) {
+			/* full, get the driver going on what we have */
+			if (packet_tx_kick(&s->tx) || packet_tx_wait(&s->tx))
+				exit(1);
+			continue;
+		}
+
+		if (opt_isnum) {
+			hdr = (struct proto_hdr *)&f[hlen];
+			proto_stamp(hdr, s->counter + i, now);
+			csum = htons(frame_csum(frame_sum(s->csum, &hdr->seq, 16)));
+			memcpy(&f[hlen - 2], &csum, sizeof(csum));
+		}
+		packet_tx_queue(&s->tx, s->framelen);
+		i++;
+	}
+
+	if (packet_tx_kick(&s->tx))
+		exit(1);
+
+	STAT_ADD(s->packets, i);
+	STAT_ADD(s->bytes, (unsigned long long)i * profile.max);
+	STAT_INC(s->calls);
+	s->counter += i;
+
+	return i;
+}
+
+/*
+ * One submission queue entry per packet of a batch, socket as fixed file.
+ * With -Z the batch buffers are registered, sends are zero-copy from them.
+ */
+static void uring_setup(struct sender *s)
+{
+	struct iovec pool;
+
+	if (uring_init(&s->uring, batch)) {
+		perror("io_uring_setup");
+		exit(1);
+	}
+	if (uring_files(&s->uring, &s->sd, 1)) {
+		perror("io_uring_register() files");
 		exit(1);
 	}
+	if (!opt_zerocopy)
+		return;
+
+	/* batch_init() allocates the slots back to back */
+	pool.iov_base = s->iov[0].iov_base;
+	pool.iov_len  = batch * profile.max;
+	if (uring_buffers(&s->uring, &pool, 1)) {
+		perror("io_uring_register() buffers, using copying sends");
+		return;
+	}
+	s->zc_flags = MSG_ZEROCOPY;
+}
+
+/*
+ * Same batch as sendmmsg(), but queued as one sendmsg() each, handed to
+ * the kernel and waited for in a single io_uring_enter() call.  Entries
+ * are linked, so they leave in order even if some are punted to a kernel
+ * worker.  With -Z each is a zero-copy send from a registered buffer,
+ * which completes twice, the second time when the kernel is done with
+ * the buffer.  Copying sends cannot use registered buffers.
+ */
+static int do_send_uring(struct sender *s, inet_addr_t *to, int num)
+{
+	unsigned long long bytes = 0;
+	unsigned int notif = 0;
+	uint64_t now = 0;
+	int i, done = 0, sent = 0;
+
+	if (opt_isnum)
+		now = clock_ns(proto_clock(tsflags));
+
+	for (i = 0; i < num; i++) {
+		struct io_uring_sqe *sqe = uring_sqe(&s->uring);
+		size_t size = next_size(s);
+
+		if (opt_isnum) {
+			proto_stamp(s->iov[i].iov_base, s->counter + i, now);
+			proto_length(s->iov[i].iov_base, size);
+		}
+		s->iov[i].iov_len = size;
+
+		sqe->fd        = 0;
+		sqe->flags     = IOSQE_FIXED_FILE | (i < num - 1 ? IOSQE_IO_LINK : 0);
+		sqe->user_data = i;
+		if (s->zc_flags) {
+			sqe->opcode    = IORING_OP_SEND_ZC;
+			sqe->ioprio    = IORING_RECVSEND_FIXED_BUF | IORING_SEND_ZC_REPORT_USAGE;
+			sqe->buf_index = 0;
+			sqe->addr      = (uint64_t)(uintptr_t)s->iov[i].iov_base;
+			sqe->len       = size;
+			sqe->addr2     = (uint64_t)(uintptr_t)to;
+			sqe->addr_len  = inet_addrlen(to);
+		} else {
+			s->vec[i].msg_hdr.msg_name    = to;
+			s->vec[i].msg_hdr.msg_namelen = inet_addrlen(to);
+
+			sqe->opcode    = IORING_OP_SENDMSG;
+			sqe->addr      = (uint64_t)(uintptr_t)&s->vec[i].msg_hdr;
+			sqe->len       = 1;
+		}
+	}
+
+	/* all completions, and notifications, before the buffers are reused */
+	while (done < num || notif) {
+		struct io_uring_cqe *cqe;
+
+		if (uring_submit(&s->uring, num - done + notif, 0) < 0) {
+			if (errno == EINTR && running)
+				continue;
+			if (errno != EINTR) {
+				perror("io_uring_enter");
+				exit(1);
+			}
+			break;
+		}
+		STAT_INC(s->calls);
+
+		while ((cqe = uring_cqe(&s->uring))) {
+			unsigned int flags = cqe->flags;
+			int res = cqe->res;
+
+			uring_cqe_seen(&s->uring);
+			if (flags & IORING_CQE_F_NOTIF) {
+				if (res & IORING_NOTIF_USAGE_ZC_COPIED)
+					s->zc_copied++;
+				s->zc_done++;
+				notif--;
+				continue;
+			}
+			if (flags & IORING_CQE_F_MORE)
+				notif++;
+
+			done++;
+			if (res < 0) {
+				errno = -res;
+				perror(s->zc_flags ? "io_uring send_zc" : "io_uring sendmsg");
+				exit(1);
+			}
+			count_size(s, res, &now);
+			bytes += res;
+			sent++;
+		}
+	}
+
+	if (s->zc_flags)
+		s->zc_sends += sent;
+	STAT_ADD(s->packets, sent);
+	STAT_ADD(s->bytes, bytes);
+	s->counter += sent;
+
+	return sent;
+}
+
+/* Generated packets: counter, header, or -text */
+static void generate(struct sender *s)
+{
+	int ret;
+
+	while (running) {
+		int num = (batch > 1 ? batch : 1) * gso;
+		size_t len = profile.mode == SIZE_MIX ? profile.mean : profile.ent[s->step].size;
+
+		/* sweep, on to the next size, and done after the last */
+		if (profile.mode == SIZE_SWEEP) {
+			uint64_t now = clock_ns(CLOCK_MONOTONIC);
+
+			if (!s->step_end) {
+				s->step_end = now + opt_step;
+			} else if (now >= s->step_end) {
+				if (++s->step >= profile.num)
+					break;
+				s->step_end += opt_step;
+				continue;
+			}
+		}
+
+		if (s->count) {
+			if (s->packets >= s->count)
+				break;
+			if (s->count - s->packets < (unsigned long long)num)
+				num = s->count - s->packets;
+		}
+
+		if (s->pacer) {
+			/* -b sends whole batches at the average rate, else as tokens allow */
+			if (opt_batch)
+				num = pace_batch(s->pacer, len, num);
+			else
+				num = pace_wait(s->pacer, len, num);
+			if (!num)
+				continue;
+		}
+
+		if (opt_engine == ENGINE_PACKET) {
+			ret = do_send_ring(s, num);
+			if (logging)
+				logput(s->log, LOG_SENT, ret, 0, 0, NULL);
+		} else if (opt_engine == ENGINE_URING) {
+			ret = do_send_uring(s, &group, num);
+			if (logging)
+				logput(s->log, LOG_SENT, ret, 0, 0, NULL);
+		} else if (batch > 1 || gso > 1 || opt_zerocopy) {
+			ret = do_send_batch(s, &group, profile.max, opt_isnum, num);
+			if (logging)
+				logput(s->log, LOG_SENT, ret, 0, 0, NULL);
+		} else {
+			unsigned long long seq;
+
+			seq = do_send(s, &group, next_size(s), opt_isnum);
+			if (logging)
+				logput(s->log, LOG_SEND, seq, 0, 0, s->text);
+		}
+	}
 
-	return counter++;
+	/* collect outstanding completions for the summary */
+	if (s->zc_busy)
+		zc_wait(s, 0, s->zc_slots);
+}
+
+/* Next datagram to replay, rewinds for -loop, returns 0 when done */
+static int replay_get(struct replay_pkt *pkt)
+{
+	uint64_t span = replay.last - replay.first;
+
+	while (!replay_next(&replay, pkt)) {
+		if (opt_loop && ++replay_loops >= opt_loop)
+			return 0;
+
+		/* next round starts one average gap after the last packet */
+		replay_rewind(&replay);
+		replay_offset += span + span / (replay.packets > 1 ? replay.packets - 1 : 1);
+	}
+
+	return 1;
+}
+
+/* Departure of datagram, ns since start of replay */
+static uint64_t replay_due(const struct replay_pkt *pkt)
+{
+	uint64_t ts = pkt->ts > replay.first ? pkt->ts - replay.first : 0;
+
+	return (replay_offset + ts) / opt_speed;
+}
+
+/* Destination of datagram, original group and port unless rewritten */
+static int replay_dest(inet_addr_t *to, const struct replay_pkt *pkt)
+{
+	if (replay_group) {
+		memcpy(to, &group, sizeof(group));
+		if (!replay_port)
+			inet_set_port(to, inet_port(&pkt->dst));
+		return 0;
+	}
+
+	/* socket is of the family of the first datagram, or -g */
+	if (pkt->dst.ss_family != group.ss_family)
+		return -1;
+
+	memcpy(to, &pkt->dst, inet_addrlen(&pkt->dst));
+	if (replay_port)
+		inet_set_port(to, group_port);
+
+	return 0;
+}
+
+/*
+ * Replay datagrams from a capture, payloads straight from the mapped
+ * file.  Departures follow the capture timestamps, scaled by -speed, and
+ * everything due at the same time leaves in the same sendmmsg() call, so
+ * microbursts in the capture are kept.  With -R the capture is paced at
+ * that rate instead, and with -speed max sent as fast as possible.
+ */
+static void replayloop(struct sender *s)
+{
+	struct replay_pkt pkt;
+	int have;
+
+	have = replay_get(&pkt);
+	while (running && have) {
+		int max = batch, num = 0, sent, ret;
+		uint64_t bytes = 0;
+		int64_t now = 0;
+
+		if (s->count) {
+			if (s->packets >= s->count)
+				break;
+			if (s->count - s->packets < (unsigned long long)max)
+				max = s->count - s->packets;
+		}
+
+		if (s->pacer) {
+			max = pace_wait(s->pacer, pkt.len, max);
+			if (!max)
+				continue;
+		} else if (opt_speed > 0) {
+			now = pace_until(&s->pace, replay_due(&pkt));
+			if (now < 0)
+				continue;
+		}
+
+		/* everything due by now goes in the same call */
+		do {
+			if (replay_dest(&s->to[num], &pkt)) {
+				replay_skipped++;
+			} else {
+				s->iov[num].iov_base = (void *)pkt.data;
+				s->iov[num].iov_len  = pkt.len;
+				s->vec[num].msg_hdr.msg_name    = &s->to[num];
+				s->vec[num].msg_hdr.msg_namelen = inet_addrlen(&s->to[num]);
+				num++;
+			}
+			have = replay_get(&pkt);
+		} while (have && num < max && (s->pacer || !opt_speed || replay_due(&pkt) <= (uint64_t)now));
+
+		if (!num)
+			continue;
+
+		if (txring)
+			txrecord(s, num);
+
+		/* datagrams are already taken from the capture, send them all */
+		for (sent = 0; sent < num; sent += ret) {
+			ret = sendmmsg(s->sd, &s->vec[sent], num - sent, 0);
+			if (ret >= 0)
+				continue;
+
+			ret = 0;
+			if (errno == EINTR && running)
+				continue;
+			if (errno == EINTR)
+				break;
+			perror("sendmmsg");
+			exit(1);
+		}
+		ret = sent;
+		if (!ret)
+			continue;
+
+		for (int i = 0; i < ret; i++)
+			bytes += s->iov[i].iov_len;
+		if (!s->pacer && opt_speed > 0)
+			pace_count(&s->pace, ret, bytes);
+
+		STAT_ADD(s->packets, ret);
+		STAT_ADD(s->bytes, bytes);
+		STAT_INC(s->calls);
+		s->counter += ret;
+		txid       += ret;
+
+		if (logging)
+			logput(s->log, LOG_SENT, ret, 0, 0, NULL);
+	}
+}
+
+static void *sendloop(void *arg)
+{
+	struct sender *s = arg;
+	sigset_t set;
+
+	/* for main to interrupt a blocking send or pacer wait */
+	sigemptyset(&set);
+	sigaddset(&set, SIGUSR1);
+	pthread_sigmask(SIG_UNBLOCK, &set, NULL);
+
+	s->start = clock_ns(CLOCK_MONOTONIC);
+	if (opt_replay)
+		replayloop(s);
+	else
+		generate(s);
+	s->end = clock_ns(CLOCK_MONOTONIC);
+
+	/* last one out wakes up main */
+	if (__atomic_sub_fetch(&alive, 1, __ATOMIC_ACQ_REL) == 0)
+		pthread_kill(mainthr, SIGUSR1);
+
+	return NULL;
+}
+
+static int sender_init(struct sender *s, int id, int cpu, inet_addr_t *ifaddr)
+{
+	s->id      = id;
+	s->cpu     = cpu;
+	s->log     = &logs[id];
+	s->counter = 1;
+
+	/* get a datagram socket */
+	s->sd = sock_create(ifaddr, opt_ifname, 0);
+	if (s->sd < 0)
+		return -1;
+
+	/* join the multicast group we are sending to (usually not necessary!) */
+	if (opt_join && sock_mc_join(s->sd, NULL, &group, opt_ifname, 0, NULL))
+		return -1;
+
+	/* set TTL to traverse up to multiple routers */
+	if (sock_mc_ttl(s->sd, opt_ttl))
+		return -1;
+
+	/* enable loopback */
+	if (sock_mc_loop(s->sd, 1))
+		return -1;
+
+	return 0;
+}
+
+static int sender_start(struct sender *s)
+{
+	pthread_attr_t attr;
+	int rc;
+
+	pthread_attr_init(&attr);
+	if (s->cpu >= 0) {
+		cpu_set_t set;
+
+		CPU_ZERO(&set);
+		CPU_SET(s->cpu, &set);
+		pthread_attr_setaffinity_np(&attr, sizeof(set), &set);
+	}
+
+	rc = pthread_create(&s->tid, &attr, sendloop, s);
+	pthread_attr_destroy(&attr);
+	if (rc) {
+		errno = rc;
+		perror("pthread_create");
+		return -1;
+	}
+
+	return 0;
+}
+
+static void report(const char *prefix, unsigned long long packets, unsigned long long bytes,
+		   unsigned long long calls, uint64_t start, uint64_t end)
+{
+	double sec, pps, mbps;
+
+	sec = (end - start) / 1e9;
+	if (sec <= 0.0)
+		sec = 1e-9;
+
+	pps  = packets / sec;
+	mbps = bytes * 8 / sec / 1e6;
+	printf("%sSent %llu packets, %llu bytes in %.3f sec: %.0f pps, %.2f Mbps, %.3f syscalls/packet\n",
+	       prefix, packets, bytes, sec, pps, mbps, packets ? (double)calls / packets : 0.0);
+}
+
+/* Rates since last call, total and per thread */
+static void interval(uint64_t start, uint64_t last, uint64_t now)
+{
+	unsigned long long packets = 0, bytes = 0;
+	double sec = (now - last) / 1e9, elapsed = (now - start) / 1e9;
+
+	for (int i = 0; i < opt_threads; i++) {
+		struct sender *s = &senders[i];
+		unsigned long long p = STAT_GET(s->packets), b = STAT_GET(s->bytes);
+
+		if (opt_threads > 1)
+			printf("[%9.3f]   Thread %d: %.0f pps, %.2f Mbps\n", elapsed, i,
+			       (p - s->prev.packets) / sec, (b - s->prev.bytes) * 8 / sec / 1e6);
+		packets += p - s->prev.packets;
+		bytes   += b - s->prev.bytes;
+		s->prev.packets = p;
+		s->prev.bytes   = b;
+	}
+	printf("[%9.3f] Total: %.0f pps, %.2f Mbps\n", elapsed, packets / sec, bytes * 8 / sec / 1e6);
+	fflush(stdout);
+}
+
+static void summary(void)
+{
+	unsigned long long packets = 0, bytes = 0, calls = 0;
+	uint64_t start = 0, end = 0;
+
+	for (int i = 0; i < opt_threads; i++) {
+		struct sender *s = &senders[i];
+
+		if (opt_threads > 1) {
+			char prefix[32];
+
+			snprintf(prefix, sizeof(prefix), "Thread %d, CPU %d: ", s->id, s->cpu);
+			report(prefix, s->packets, s->bytes, s->calls, s->start, s->end);
+		}
+
+		packets += s->packets;
+		bytes   += s->bytes;
+		calls   += s->calls;
+		if (!start || s->start < start)
+			start = s->start;
+		if (s->end > end)
+			end = s->end;
+	}
+
+	report(opt_threads > 1 ? "Total: " : "", packets, bytes, calls, start, end);
+	if (opt_engine == ENGINE_PACKET) {
+		unsigned long long errors = 0;
+
+		for (int i = 0; i < opt_threads; i++)
+			errors += senders[i].tx.errors;
+		if (errors)
+			printf("%llu frames rejected by the kernel, not sent\n", errors);
+	}
+	if (opt_zerocopy) {
+		unsigned long long sends = 0, done = 0, copied = 0;
+		int off = 0;
+
+		for (int i = 0; i < opt_threads; i++) {
+			sends  += senders[i].zc_sends;
+			done   += senders[i].zc_done;
+			copied += senders[i].zc_copied;
+			off    |= !senders[i].zc_flags;
+		}
+		printf("Zero-copy: %llu of %llu sends without copy (%.1f%%), %llu copied by the kernel",
+		       done - copied, sends, sends ? 100.0 * (done - copied) / sends : 0.0, copied);
+		if (off)
+			printf(", switched to copying sends");
+		printf("\n");
+	}
+	if (profile.mode != SIZE_FIXED) {
+		static struct size_stats sizes;
+
+		for (int i = 0; i < opt_threads; i++)
+			size_merge(&sizes, &senders[i].sizes);
+		size_print(&sizes, stdout, 0);
+	}
+	if (opt_threads == 1 && senders[0].pacer)
+		pace_report(senders[0].pacer, stdout);
+	else if (opt_replay && opt_speed > 0)
+		pace_report(&senders[0].pace, stdout);
+
+	if (opt_replay) {
+		unsigned long long rounds = replay_loops + (replay_loops < opt_loop || !opt_loop);
+
+		printf("Replay: %llu datagrams per round, %llu round%s", (unsigned long long)replay.packets,
+		       rounds, rounds == 1 ? "" : "s");
+		if (replay.skipped)
+			printf(", %llu other records skipped", (unsigned long long)replay.skipped);
+		if (replay_skipped)
+			printf(", %llu datagrams of other address family not sent", replay_skipped);
+		printf("\n");
+	}
 }
 
 int main(int argc, char *argv[])
 {
 	static struct option opts[] = {
 		{ "join",       no_argument,       NULL, 'j' },
-		{ "text",       required_argument, NULL, 'T' },
+		{ "loop",       required_argument, NULL, 'o' },
+		{ "replay",     required_argument, NULL, 'y' },
+		{ "speed",      required_argument, NULL, 'd' },
+		{ "step",       required_argument, NULL, 'u' },
+		{ "tai",        no_argument,       NULL, 'a' },
+		{ "text",       required_argument, NULL, 'x' },
 		{ NULL,         0,                 NULL, 0   }
 	};
-	inet_addr_t ifaddr, group;
-	char msg[BUFSIZE] = { 0 };
-	int ret, c, sd;
+	inet_addr_t ifaddr;
+	struct sigaction sa = { .sa_handler = sigcb };
+	char *opt_text = "";
+	char *opt_size = NULL;
+	int cpus[THREADMAX], num_cpus = 0;
+	int opt_txstamp = 0;
+	uint64_t start, next;
+	sigset_t set;
+	pthread_t txthr;
+	uint32_t sender = 0;
+	unsigned burst = 1;
+	char *rate = NULL;
+	int ret, c;
 
-	while ((c = getopt_long_only(argc, argv, "46c:g:hi:I:jnp:P:qt:T:v", opts, NULL)) != EOF) {
+	while ((c = getopt_long_only(argc, argv, "46A:b:B:c:e:g:G:hi:I:jKnp:P:qr:R:s:S:t:T:vZ", opts, NULL)) != EOF) {
 		switch (c) {
 		case '4':
 			opt_family = AF_INET; /* for completeness */
@@ -90,12 +1270,64 @@ int main(int argc, char *argv[])
 		case '6':
 			opt_family = AF_INET6;
 			break;
+		case 'a':
+			tsflags |= PROTO_F_TAI;
+			break;
+		case 'A':
+			num_cpus = cpu_parse(optarg, cpus, NELEMS(cpus));
+			if (num_cpus <= 0) {
+				fprintf(stderr, "Invalid CPU list %s\n", optarg);
+				exit(1);
+			}
+			break;
+		case 'b':
+			batch = atoi(optarg);
+			if (batch < 1 || batch > BATCHMAX) {
+				fprintf(stderr, "Invalid batch size, 1-%d\n", BATCHMAX);
+				exit(1);
+			}
+			opt_batch = 1;
+			break;
+		case 'B':
+			burst = atoi(optarg);
+			if (burst < 1) {
+				fprintf(stderr, "Invalid burst size\n");
+				exit(1);
+			}
+			break;
 		case 'c':
 			opt_count = atoi(optarg);
 			break;
+		case 'd':
+			if (!strcmp(optarg, "max"))
+				opt_speed = 0.0;
+			else
+				opt_speed = strtod(optarg, NULL);
+			if (opt_speed < 0.0 || (opt_speed == 0.0 && strcmp(optarg, "max"))) {
+				fprintf(stderr, "Invalid replay speed %s\n", optarg);
+				exit(1);
+			}
+			break;
+		case 'e':
+			if (!strcmp(optarg, "socket"))
+				opt_engine = ENGINE_SOCKET;
+			else if (!strcmp(optarg, "packet"))
+				opt_engine = ENGINE_PACKET;
+			else if (!strcmp(optarg, "uring"))
+				opt_engine = ENGINE_URING;
+			else
+				return usage(1);
+			break;
 		case 'g':
 			group_addr = optarg;
 			break;
+		case 'G':
+			gso = atoi(optarg);
+			if (gso < 1 || gso > SOCK_GSO_MAX) {
+				fprintf(stderr, "Invalid GSO segments, 1-%d\n", SOCK_GSO_MAX);
+				exit(1);
+			}
+			break;
 		case 'h':
 			return usage(0);
 		case 'i':
@@ -119,11 +1351,18 @@ int main(int argc, char *argv[])
 		case 'j':
 			opt_join++;
 			break;
+		case 'K':
+			opt_txstamp = 1;
+			break;
 		case 'n':
 			opt_isnum = 1;
 			break;
+		case 'o':
+			opt_loop = strtoull(optarg, NULL, 10);
+			break;
 		case 'p':
 			group_port = atoi(optarg);
+			replay_port = 1;
 			break;
 		case 'P':
 			opt_period = atoi(optarg);
@@ -131,21 +1370,130 @@ int main(int argc, char *argv[])
 		case 'q':
 			opt_verbose = 0;
 			break;
+		case 'r':
+			opt_interval = strtod(optarg, NULL) * 1e9;
+			if (opt_interval < 1000000) {
+				fprintf(stderr, "Invalid report interval, min 0.001 sec\n");
+				exit(1);
+			}
+			break;
+		case 'R':
+			rate = optarg;
+			break;
+		case 's':
+			opt_size = optarg;
+			break;
+		case 'S':
+			sender = strtoul(optarg, NULL, 0);
+			break;
 		case 't':
 			opt_ttl = atoi(optarg);
 			break;
+		case 'u':
+			opt_step = strtod(optarg, NULL) * 1e9;
+			if (opt_step < 1000000) {
+				fprintf(stderr, "Invalid sweep step, min 0.001 sec\n");
+				exit(1);
+			}
+			break;
 		case 'T':
-			strlcpy(msg, optarg, sizeof(msg));
+			opt_threads = atoi(optarg);
+			if (opt_threads < 1 || opt_threads > THREADMAX) {
+				fprintf(stderr, "Invalid number of threads, 1-%d\n", THREADMAX);
+				exit(1);
+			}
+			break;
+		case 'x':
+			opt_text = optarg;
+			break;
+		case 'y':
+			opt_replay = optarg;
 			break;
 		case 'v':
 			printf("msend version %s\n", VERSION);
 			return 0;
+		case 'Z':
+			opt_zerocopy = 1;
+			break;
 		default:
 			fprintf(stderr, "wrong parameters!\n\n");
 			return usage(1);
 		}
 	}
 
+	/* no idle threads */
+	if (opt_count && opt_threads > opt_count)
+		opt_threads = opt_count;
+
+	if (opt_txstamp && opt_threads > 1) {
+		fprintf(stderr, "TX timestamps, -K, only supported with a single thread\n");
+		exit(1);
+	}
+
+	if (gso > 1 && (opt_engine != ENGINE_SOCKET || opt_replay || opt_txstamp)) {
+		fprintf(stderr, "-G only works with -e socket, and not with -replay or -K\n");
+		exit(1);
+	}
+
+	if (opt_zerocopy && (opt_engine == ENGINE_PACKET || opt_replay || opt_txstamp)) {
+		fprintf(stderr, "-Z only works with -e socket or uring, and not with -replay or -K\n");
+		exit(1);
+	}
+
+	if (opt_engine == ENGINE_PACKET) {
+		if (!opt_ifname) {
+			fprintf(stderr, "-e packet needs an interface, -I\n");
+			exit(1);
+		}
+		if (opt_replay || opt_txstamp) {
+			fprintf(stderr, "-e packet cannot be combined with -replay or -K\n");
+			exit(1);
+		}
+
+		/* one send() per batch */
+		if (batch < 2)
+			batch = 64;
+	}
+
+	if (opt_engine == ENGINE_URING) {
+		if (opt_replay || opt_txstamp) {
+			fprintf(stderr, "-e uring cannot be combined with -replay or -K\n");
+			exit(1);
+		}
+
+		if (uring_probe(0)) {
+			fprintf(stderr, "io_uring not available (%s), using socket engine\n", strerror(errno));
+			opt_engine = ENGINE_SOCKET;
+		}
+
+		/* one io_uring_enter() per batch, or sendmmsg() if not available */
+		if (batch < 2)
+			batch = 64;
+	}
+
+	if (opt_replay) {
+		static char buf[INET_ADDRSTR_LEN];
+
+		if (opt_isnum || opt_threads > 1 || opt_size) {
+			fprintf(stderr, "Replay, -replay, cannot be combined with -n, -s, or -T\n");
+			exit(1);
+		}
+		if (replay_open(&replay, opt_replay))
+			exit(1);
+
+		/* original group and port of each datagram, unless given */
+		if (group_addr)
+			replay_group = 1;
+		else
+			group_addr = (char *)inet_address(&replay.dst, buf, sizeof(buf));
+		if (!replay_port)
+			group_port = inet_port(&replay.dst);
+
+		/* packets captured back-to-back should leave back-to-back */
+		if (batch < 2)
+			batch = 64;
+	}
+
 	if (group_addr == NULL) {
 		if (opt_family == AF_INET)
 			group_addr = TEST_ADDR_IPV4;
@@ -164,6 +1512,35 @@ int main(int argc, char *argv[])
 	/* Always derived from group */
 	opt_family = group.ss_family;
 
+	/* UDP payload, room for the header, and at most what fits in an IP packet */
+	if (opt_size) {
+		size_t max = opt_family == AF_INET6 ? SIZE_MAX_IPV6 : SIZE_MAX_IPV4;
+		size_t min = opt_isnum ? PROTO_HDRLEN : 1;
+
+		if (size_parse(&profile, opt_size, min, max, opt_family == AF_INET6 ? 48 : 28)) {
+			if (errno == ERANGE)
+				fprintf(stderr, "Invalid size %s, %zu-%zu\n", opt_size, min, max);
+			else if (errno == E2BIG)
+				fprintf(stderr, "Invalid size %s, max %d sizes\n", opt_size, SIZE_ENTRIES);
+			else
+				fprintf(stderr, "Invalid size %s\n", opt_size);
+			exit(1);
+		}
+	} else {
+		profile.num         = 1;
+		profile.ent[0].size = profile.max = profile.mean = BUFSIZE;
+	}
+
+	if (profile.mode != SIZE_FIXED && (gso > 1 || opt_engine == ENGINE_PACKET)) {
+		fprintf(stderr, "-G and -e packet need a fixed size, -s SIZE\n");
+		exit(1);
+	}
+	if (gso * profile.max > SOCK_GSO_BUFSZ) {
+		fprintf(stderr, "Invalid GSO segments, %d datagrams of %zu bytes exceed %d\n",
+			gso, profile.max, SOCK_GSO_BUFSZ);
+		exit(1);
+	}
+
 	if (!opt_ifaddr) {
 		if (opt_family == AF_INET)
 			opt_ifaddr = "0.0.0.0";
@@ -171,7 +1548,8 @@ int main(int argc, char *argv[])
 			opt_ifaddr = "::";
 	}
 
-	ret = inet_parse(&ifaddr, opt_ifaddr, group_port);
+	/* with many threads, each sends from its own port so receivers can tell them apart */
+	ret = inet_parse(&ifaddr, opt_ifaddr, opt_threads > 1 ? 0 : group_port);
 	if (ret) {
 		fprintf(stderr, "IP address %s not in known format\n", opt_ifaddr);
 		exit(1);
@@ -182,72 +1560,198 @@ int main(int argc, char *argv[])
 		exit(1);
 	}
 
-	/* get a datagram socket */
-	sd = sock_create(&ifaddr, opt_ifname);
-	if (sd < 0)
+	if (opt_isnum && !sender)
+		sender = getpid() ^ clock_ns(CLOCK_REALTIME);
+
+	senders = cache_alloc(opt_threads, sizeof(*senders));
+	logs    = cache_alloc(opt_threads + 1, sizeof(*logs));
+	if (!senders || !logs) {
+		perror("cache_alloc");
 		exit(1);
+	}
 
-	/* join the multicast group we are sending to (usually not necessary!) */
-	if (opt_join) {
-		ret = sock_mc_join(sd, NULL, &group, opt_ifname, 0, NULL);
-		if (ret)
+	for (int i = 0; i < opt_threads; i++) {
+		struct sender *s = &senders[i];
+
+		if (sender_init(s, i, num_cpus ? cpus[i % num_cpus] : -1, &ifaddr))
+			exit(1);
+
+		/* zero filled, text is NUL terminated only if there is room */
+		s->msg = calloc(1, profile.max);
+		if (!s->msg) {
+			perror("calloc");
+			exit(1);
+		}
+		s->text = s->msg;
+		if (opt_isnum) {
+			/* packet template, seq and tstamp patched for each packet */
+			proto_init(s->msg, profile.max, sender, i, tsflags);
+			s->text += PROTO_HDRLEN;
+		}
+		if (profile.max > (size_t)(s->text - s->msg) + 1)
+			strlcpy(s->text, opt_text, profile.max - (s->text - s->msg) - 1);
+		s->rng = (((uint64_t)sender << 32 | getpid()) ^ clock_ns(CLOCK_MONOTONIC) ^ i) | 1;
+
+		/* split count and rate evenly */
+		if (opt_count)
+			s->count = opt_count / opt_threads + (i < opt_count % opt_threads);
+
+		if (rate) {
+			if (pace_init(&s->pace, rate, burst)) {
+				fprintf(stderr, "Invalid rate %s\n", rate);
+				exit(1);
+			}
+			s->pacer = &s->pace;
+		} else if (opt_replay) {
+			pace_schedule(&s->pace);
+		} else if (opt_period > 0) {
+			pace_period(&s->pace, opt_period * 1000000ULL, burst);
+			s->pacer = &s->pace;
+		}
+		if (s->pacer)
+			pace_split(s->pacer, opt_threads);
+
+		if (opt_engine == ENGINE_PACKET)
+			ring_init(s, &ifaddr);
+		else if (opt_replay)
+			replay_init(s, batch);
+		else if (opt_zerocopy && opt_engine == ENGINE_SOCKET)
+			zc_init(s);
+		else if (batch > 1 || gso > 1)
+			batch_init(s, profile.max, batch > 1 ? batch : 1, gso);
+		if (gso > 1 && sock_gso(s->sd, profile.max))
 			exit(1);
+		if (opt_engine == ENGINE_URING)
+			uring_setup(s);
 	}
 
-	/* set TTL to traverse up to multiple routers */
-	ret = sock_mc_ttl(sd, opt_ttl);
-	if (ret)
-		exit(1);
+	if (opt_replay) {
+		logit("Now replaying %llu datagrams, %.3f sec, from %s\n", (unsigned long long)replay.packets,
+		      (replay.last - replay.first) / 1e9, opt_replay);
+	} else {
+		logit("Now sending to multicast group: [%s]:%d\n", group_addr, group_port);
+	}
+	if (opt_threads > 1) {
+		logit("Using %d threads, each with its own socket and stream ID\n", opt_threads);
+	}
 
-	/* enable loopback */
-	ret = sock_mc_loop(sd, 1);
-	if (ret)
-		exit(1);
+	/* no SA_RESTART, we want a blocked send or pacer wait to return on ^C */
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	sigaction(SIGUSR1, &sa, NULL);
 
-	logit("Now sending to multicast group: [%s]:%d\n", group_addr, group_port);
-
-	opt_period *= 1000;	/* convert to microsecond */
-	if (opt_period > 0) {
-		struct itimerval it;
-		sigset_t set;
-
-		/* block SIGALRM */
-		sigemptyset(&set);
-		sigaddset(&set, SIGALRM);
-		sigaddset(&set, SIGINT);
-		sigprocmask(SIG_BLOCK, &set, NULL);
-
-		/*
-		 * set up interval timer, sends SIGALRM every opt_period msec
-		 */
-		it.it_value.tv_sec     = 0;	/* wait a bit for system to "stabilize"  */
-		it.it_value.tv_usec    = 1;	/* tv_sec or tv_usec cannot be both zero */
-		it.it_interval.tv_sec  = (time_t)(opt_period / 1000000);
-		it.it_interval.tv_usec =   (long)(opt_period % 1000000);
-		setitimer(ITIMER_REAL, &it, NULL);
-
-		for (;;) {
-			int signo = sigwaitinfo(&set, NULL);
-
-			if (signo == SIGALRM) {
-				ret = do_send(sd, &group, msg, sizeof(msg), opt_isnum);
-				logit("Sending msg %d, TTL %d, to [%s]:%d: %s\n", ret, opt_ttl, group_addr, group_port, msg);
-			} else {
-				logit("Git signal %d, exiting!\n", signo);
-				break;
+	if (opt_txstamp) {
+		hist_init(&sched);
+		hist_init(&snd);
+		txring = calloc(TXRING, sizeof(*txring));
+		if (!txring) {
+			perror("calloc");
+			exit(1);
+		}
+		if (tstamp_tx_enable(senders[0].sd))
+			exit(1);
+	}
+
+	/*
+	 * Signals are handled by main, which then interrupts the senders'
+	 * blocking send or pacer wait with SIGUSR1.  All threads inherit
+	 * this mask, the senders unblock SIGUSR1 for themselves.
+	 */
+	sigemptyset(&set);
+	sigaddset(&set, SIGINT);
+	sigaddset(&set, SIGTERM);
+	sigaddset(&set, SIGUSR1);
+	pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+	/* per-packet output is formatted and written by a thread of its own */
+	logging = opt_verbose && !opt_interval;
+	if (logging) {
+		for (int i = 0; i < opt_threads + 1; i++) {
+			if (logring_init(&logs[i])) {
+				perror("logring_init");
+				exit(1);
 			}
+		}
 
-			if (ret == opt_count)
-				break;
+		fflush(stdout);
+		if (logring_start(logs, opt_threads + 1, logfmt, STDOUT_FILENO)) {
+			perror("logring_start");
+			exit(1);
 		}
+	}
 
-		return 0;
-	} else {
-		for (int i = 0; i < opt_count; i++) {
-			do_send(sd, &group, msg, sizeof(msg), opt_isnum);
-			logit("Send out msg %d to [%s]:%d: %s\n", i, group_addr, group_port, msg);
+	if (opt_txstamp) {
+		errno = pthread_create(&txthr, NULL, txthread, &senders[0].sd);
+		if (errno) {
+			perror("pthread_create");
+			exit(1);
+		}
+	}
+
+	mainthr = pthread_self();
+	alive   = opt_threads;
+	for (int i = 0; i < opt_threads; i++) {
+		if (sender_start(&senders[i]))
+			exit(1);
+	}
+
+	/* wait for ^C, or all senders done, reporting every -r SEC */
+	start = clock_ns(CLOCK_MONOTONIC);
+	next  = start + opt_interval;
+	while (1) {
+		struct timespec ts;
+		uint64_t now;
+		int sig;
+
+		if (!opt_interval) {
+			sig = sigwaitinfo(&set, NULL);
+		} else {
+			now = clock_ns(CLOCK_MONOTONIC);
+			ns_timespec(next > now ? next - now : 0, &ts);
+			sig = sigtimedwait(&set, NULL, &ts);
+		}
+
+		if (sig > 0)
+			break;
+		if (errno == EAGAIN) {
+			interval(start, next - opt_interval, next);
+			next += opt_interval;
 		}
 	}
+	running = 0;
+
+	for (int i = 0; i < opt_threads; i++) {
+		pthread_kill(senders[i].tid, SIGUSR1);
+		pthread_join(senders[i].tid, NULL);
+	}
+
+	if (opt_txstamp) {
+		/* allow for stragglers */
+		usleep(100000);
+		txdone = 1;
+		pthread_join(txthr, NULL);
+	}
+
+	if (logging) {
+		unsigned long long dropped;
+
+		logring_stop();
+		dropped = logring_dropped(logs, opt_threads + 1);
+		if (dropped)
+			printf("%llu log records dropped, output too slow\n", dropped);
+	}
+
+	summary();
+
+	if (opt_txstamp) {
+		hist_print(&sched, stdout, "Syscall to qdisc", 1000.0, "us");
+		hist_print(&snd, stdout, "Syscall to driver", 1000.0, "us");
+		if (txstale)
+			printf("%llu TX timestamps too late to correlate\n", txstale);
+		if (snd.count + snd.under < txid)
+			printf("%llu TX timestamps lost, error queue full, try larger rmem_max\n",
+			       (unsigned long long)(txid - snd.count - snd.under));
+	}
 
 	return 0;
 }
@@ -0,0 +1,313 @@
+/*
+ * pace.c -- Packet pacing engine, token bucket on CLOCK_MONOTONIC
+ *
+ * Departures are scheduled against absolute deadlines, so the time it
+ * takes to wake up and send a packet does not add up over time.  Each
+ * deadline is approached with clock_nanosleep() and the last stretch,
+ * PACE_SPIN_NS, is busy-waited to avoid timer slack.
+ *
+ * The token bucket is implemented as a GCRA, a virtual scheduling
+ * algorithm: with a burst of N, up to N packets may depart back-to-back
+ * if the sender has fallen behind or been idle.
+ */
+
+#include <errno.h>
+#include <math.h>
+#include <string.h>
+#include <time.h>
+
+#include "common.h"
+#include "pace.h"
+
+#define PS_PER_NS  1000ULL
+#define PS_PER_SEC 1000000000000ULL
+
+/* Cost of sending a packet of len bytes, in picoseconds */
+static uint64_t cost(struct pace *p, size_t len)
+{
+	if (p->bps)
+		return (uint64_t)len * 8 * PS_PER_SEC / p->bps;
+
+	return p->pkt_ps;
+}
+
+static uint64_t now(struct pace *p)
+{
+	return (clock_ns(CLOCK_MONOTONIC) - p->start) * PS_PER_NS;
+}
+
+/* Sleep, then spin, until deadline (ps since start).  Returns -1 on signal */
+static int wait_until(struct pace *p, uint64_t deadline)
+{
+	uint64_t abs = p->start + deadline / PS_PER_NS;
+
+	if (abs > clock_ns(CLOCK_MONOTONIC) + PACE_SPIN_NS) {
+		struct timespec ts;
+
+		ns_timespec(abs - PACE_SPIN_NS, &ts);
+		if (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL))
+			return -1;
+	}
+
+	while (now(p) < deadline)
+		;
+
+	return 0;
+}
+
+static void init(struct pace *p, unsigned burst)
+{
+	p->burst = burst ? burst : 1;
+	p->start = clock_ns(CLOCK_MONOTONIC);
+	p->tat   = 0;
+	p->first = 0;
+	p->last  = 0;
+	p->gap   = 0;
+}
+
+/*
+ * Parse rate, in packets per second (default), or bits per second, with
+ * an optional k, M, or G multiplier, e.g. 10k, 1.5Mpps, 100Mbps, 1G.
+ */
+int pace_init(struct pace *p, const char *rate, unsigned burst)
+{
+	double val;
+	char *ptr;
+
+	memset(p, 0, sizeof(*p));
+
+	val = strtod(rate, &ptr);
+	switch (*ptr) {
+	case 'k':
+	case 'K':
+		val *= 1e3;
+		ptr++;
+		break;
+	case 'm':
+	case 'M':
+		val *= 1e6;
+		ptr++;
+		break;
+	case 'g':
+	case 'G':
+		val *= 1e9;
+		ptr++;
+		break;
+	}
+
+	if (val < 1.0)
+		goto fail;
+
+	if (!*ptr || !strcmp(ptr, "pps"))
+		p->pkt_ps = PS_PER_SEC / val;
+	else if (!strcmp(ptr, "bps") || !strcmp(ptr, "bit"))
+		p->bps = val;
+	else
+		goto fail;
+
+	init(p, burst);
+	return 0;
+fail:
+	errno = EINVAL;
+	return -1;
+}
+
+/* Fixed period between packets, for compat with msend -P */
+void pace_period(struct pace *p, uint64_t ns, unsigned burst)
+{
+	memset(p, 0, sizeof(*p));
+	p->pkt_ps = ns * PS_PER_NS;
+	init(p, burst);
+}
+
+/* Share the rate evenly among num pacers, e.g., one per sender thread */
+void pace_split(struct pace *p, unsigned num)
+{
+	if (num < 2)
+		return;
+
+	if (p->bps)
+		p->bps /= num;
+	else
+		p->pkt_ps *= num;
+}
+
+/* Target rate in bytes per second, for packets of len bytes */
+double pace_rate(struct pace *p, size_t len)
+{
+	if (p->bps)
+		return p->bps / 8.0;
+	if (p->pkt_ps)
+		return (double)len * PS_PER_SEC / p->pkt_ps;
+
+	return 0.0;
+}
+
+/* Account for num packets of len leaving at t, and the jitter against plan */
+static void depart(struct pace *p, uint64_t t, size_t len, int num, uint64_t c)
+{
+	if (!p->packets)
+		p->first = t;
+	else {
+		double dev = ((double)(t - p->last) - (double)p->gap) / PS_PER_NS;
+
+		p->samples++;
+		p->sum  += dev;
+		p->sum2 += dev * dev;
+		if (dev < 0)
+			dev = -dev;
+		if (dev > p->max)
+			p->max = dev;
+	}
+	p->last     = t;
+	p->gap      = num * c;
+	p->num      = num;
+	p->packets += num;
+	p->bytes   += num * len;
+}
+
+/*
+ * Block until at least one packet of len bytes may be sent.  Returns the
+ * number of packets, at most max, allowed to depart now, or 0 if a
+ * signal interrupted the wait.
+ */
+int pace_wait(struct pace *p, size_t len, int max)
+{
+	uint64_t c = cost(p, len);
+	uint64_t tau = (p->burst - 1) * c;
+	uint64_t t = now(p);
+	int num = 1;
+
+	if (t + tau < p->tat) {
+		if (wait_until(p, p->tat - tau))
+			return 0;
+		t = now(p);
+	} else if (t > p->tat) {
+		/* idle, or sender cannot keep up, no catch up beyond burst */
+		p->tat = t;
+	}
+
+	/* with a burst, release as many tokens as have accumulated */
+	while (num < max && p->tat + num * c <= t + tau)
+		num++;
+	p->tat += num * c;
+	depart(p, t, len, num, c);
+
+	return num;
+}
+
+/*
+ * Block until a whole batch of num packets may be sent, for msend -b.
+ * The batch is one departure, costing num packets, so the average rate
+ * is kept and packets leave in groups of num.  Returns num, or 0 if a
+ * signal interrupted the wait.
+ */
+int pace_batch(struct pace *p, size_t len, int num)
+{
+	uint64_t c = cost(p, len);
+	uint64_t tau = (p->burst - 1) * c;
+	uint64_t t = now(p);
+
+	if (t + tau < p->tat) {
+		if (wait_until(p, p->tat - tau))
+			return 0;
+		t = now(p);
+	} else if (t > p->tat) {
+		p->tat = t;
+	}
+
+	p->tat += num * c;
+	depart(p, t, len, num, c);
+
+	return num;
+}
+
+/* Departure times given by the caller, e.g. replay, see pace_until() */
+void pace_schedule(struct pace *p)
+{
+	memset(p, 0, sizeof(*p));
+	init(p, 1);
+}
+
+/*
+ * Block until deadline, ns since start, instead of a rate.  Returns the
+ * time, ns since start, or -1 if a signal interrupted the wait.  The
+ * caller then sends everything due, and accounts for it with pace_count()
+ */
+int64_t pace_until(struct pace *p, uint64_t deadline)
+{
+	uint64_t target = deadline * PS_PER_NS;
+	uint64_t t;
+
+	if (wait_until(p, target))
+		return -1;
+	t = now(p);
+
+	/* jitter against the gap between deadlines, tat is the previous one */
+	if (!p->packets)
+		p->first = t;
+	else {
+		double dev = ((double)(t - p->last) - (double)(target - p->tat)) / PS_PER_NS;
+
+		p->samples++;
+		p->sum  += dev;
+		p->sum2 += dev * dev;
+		if (dev < 0)
+			dev = -dev;
+		if (dev > p->max)
+			p->max = dev;
+	}
+	p->last = t;
+	p->tat  = target;
+
+	return t / PS_PER_NS;
+}
+
+void pace_count(struct pace *p, int num, size_t bytes)
+{
+	p->num      = num;
+	p->packets += num;
+	p->bytes   += bytes;
+}
+
+void pace_report(struct pace *p, FILE *fp)
+{
+	double sec, avg = 0.0, dev = 0.0;
+	uint64_t num;
+
+	if (!p->packets)
+		return;
+
+	/* rate over the intervals between first and last departure */
+	sec = (double)(p->last - p->first) / PS_PER_SEC;
+	num = p->packets - p->num;
+	if (p->samples) {
+		avg = p->sum / p->samples;
+		dev = sqrt(p->sum2 / p->samples - avg * avg);
+	}
+
+	if (!p->bps && !p->pkt_ps) {
+		fprintf(fp, "Schedule: achieved %.0f pps, %.2f Mbps", sec > 0 ? num / sec : 0.0,
+			sec > 0 ? num * (p->bytes / p->packets) * 8 / sec / 1e6 : 0.0);
+	} else {
+		/* relative error of achieved vs target rate */
+		double target = p->bps ? p->bps / 1e6 : (double)PS_PER_SEC / p->pkt_ps;
+		double achieved = 0.0;
+
+		if (sec > 0)
+			achieved = p->bps ? num * (p->bytes / p->packets) * 8 / sec / 1e6 : num / sec;
+		fprintf(fp, "Pacing: target %.*f %s, achieved %.*f %s, error %+.2f%%",
+			p->bps ? 2 : 0, target, p->bps ? "Mbps" : "pps",
+			p->bps ? 2 : 0, achieved, p->bps ? "Mbps" : "pps",
+			100.0 * (achieved - target) / target);
+	}
+	fprintf(fp, ", inter-departure jitter avg %.0f ns, stddev %.0f ns, max %.0f ns\n",
+		avg, dev, p->max);
+}
+
+/**
+ * Local Variables:
+ *  c-file-style: "linux"
+ *  indent-tabs-mode: t
+ * End:
+ */
@@ -0,0 +1,53 @@
+/*
+ * pace.h -- Packet pacing engine, token bucket on CLOCK_MONOTONIC
+ */
+
+#ifndef MTOOLS_PACE_H_
+#define MTOOLS_PACE_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define PACE_SPIN_NS   50000	/* busy-wait the last 50 usec to a deadline */
+
+struct pace {
+	uint64_t pkt_ps;	/* cost of a packet, in picoseconds, or ... */
+	uint64_t bps;		/* ... target bit rate, cost depends on length */
+	uint64_t burst;		/* max packets sent back-to-back */
+
+	uint64_t start;		/* time base, ns, CLOCK_MONOTONIC */
+	uint64_t tat;		/* theoretical arrival time, ps since start */
+	uint64_t first;		/* first departure, ps since start */
+	uint64_t last;		/* previous departure, ps since start */
+	uint64_t gap;		/* target gap to next departure, ps */
+	int      num;		/* packets released at last departure */
+
+	uint64_t packets;	/* released packets */
+	uint64_t bytes;
+	uint64_t samples;	/* inter-departure jitter, in ns */
+	double   sum;
+	double   sum2;
+	double   max;
+};
+
+int  pace_init   (struct pace *p, const char *rate, unsigned burst);
+void pace_period (struct pace *p, uint64_t ns, unsigned burst);
+void pace_split  (struct pace *p, unsigned num);
+double pace_rate (struct pace *p, size_t len);
+int  pace_wait   (struct pace *p, size_t len, int max);
+int  pace_batch  (struct pace *p, size_t len, int num);
+
+void    pace_schedule (struct pace *p);
+int64_t pace_until    (struct pace *p, uint64_t deadline);
+void    pace_count    (struct pace *p, int num, size_t bytes);
+
+void pace_report (struct pace *p, FILE *fp);
+
+#endif /* MTOOLS_PACE_H_ */
+
+/**
+ * Local Variables:
+ *  c-file-style: "linux"
+ *  indent-tabs-mode: t
+ * End:
+ */
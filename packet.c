@@ -0,0 +1,704 @@
+/*
+ * packet.c -- AF_PACKET memory-mapped rings, TPACKET_V3 receive, TPACKET_V2 send
+ *
+ * The kernel copies each frame once, into a ring of large blocks shared
+ * with us, and hands over a whole block at a time, when it is full or
+ * after PACKET_TIMEOUT.  Frames are read in place, no system call per
+ * packet or per batch, and the block is given back when done.
+ *
+ * A classic BPF filter on the socket only lets through UDP to the given
+ * port and groups, and from the source with SSM, everything else on the
+ * interface is dropped before it is copied to the ring.  The group membership itself
+ * is still handled by the IP stack, see sock_mc_join().
+ *
+ * The send ring works the other way around, frames are written straight
+ * into the ring, marked for sending, and a single send() hands all that
+ * are ready to the driver.  The IP and UDP layers are bypassed entirely,
+ * so frames must be complete, see frame_build().  They are not looped
+ * back to local receivers.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <poll.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <linux/filter.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+
+#include "packet.h"
+#include "sock.h"
+#include "tstamp.h"
+
+/* Groups as ranges of addresses, IPv6 ones sharing their first 96 bits */
+struct range {
+	int      family;
+	uint32_t prefix[3];
+	uint32_t first;
+	uint32_t last;
+};
+
+static int range_cmp(const void *a, const void *b)
+{
+	const struct range *x = a, *y = b;
+
+	if (x->family != y->family)
+		return x->family < y->family ? -1 : 1;
+	for (int i = 0; i < 3; i++) {
+		if (x->prefix[i] != y->prefix[i])
+			return x->prefix[i] < y->prefix[i] ? -1 : 1;
+	}
+	if (x->first != y->first)
+		return x->first < y->first ? -1 : 1;
+
+	return 0;
+}
+
+/* Sort and merge groups into ranges, returns number of ranges */
+static size_t ranges(struct range *rng, const inet_addr_t *groups, size_t num)
+{
+	size_t n = 0;
+
+	for (size_t i = 0; i < num; i++) {
+		struct range *r = &rng[i];
+
+		memset(r, 0, sizeof(*r));
+		r->family = groups[i].ss_family;
+		if (r->family == AF_INET6) {
+			const struct sockaddr_in6 *sin6 = (const struct sockaddr_in6 *)&groups[i];
+			uint32_t w[4];
+
+			memcpy(w, &sin6->sin6_addr, sizeof(w));
+			for (int j = 0; j < 3; j++)
+				r->prefix[j] = ntohl(w[j]);
+			r->first = ntohl(w[3]);
+		} else {
+			r->first = ntohl(((const struct sockaddr_in *)&groups[i])->sin_addr.s_addr);
+		}
+		r->last = r->first;
+	}
+	qsort(rng, num, sizeof(*rng), range_cmp);
+
+	for (size_t i = 0; i < num; i++) {
+		struct range *r = n ? &rng[n - 1] : NULL;
+
+		if (r && r->family == rng[i].family && !memcmp(r->prefix, rng[i].prefix, sizeof(r->prefix)) &&
+		    rng[i].first <= r->last + 1 && r->last != UINT32_MAX) {
+			if (rng[i].first > r->last)
+				r->last = rng[i].first;
+			continue;
+		}
+		rng[n++] = rng[i];
+	}
+
+	return n;
+}
+
+#define STMT(op, k)          code[n++] = (struct sock_filter)BPF_STMT(op, k)
+#define JUMP(op, k, jt, jf)  code[n++] = (struct sock_filter)BPF_JUMP(op, k, jt, jf)
+
+/* Point all BPF_JA in code[from, to) at target, their offset is 32 bits */
+static void patch(struct sock_filter *code, size_t from, size_t to, size_t target)
+{
+	for (size_t i = from; i < to; i++) {
+		if (code[i].code == (BPF_JMP | BPF_JA))
+			code[i].k = target - i - 1;
+	}
+}
+
+/* Destination, A: loaded address word, one compare per range, to port check */
+static size_t match(struct sock_filter *code, size_t n, const struct range *r)
+{
+	if (r->first == r->last) {
+		JUMP(BPF_JMP | BPF_JEQ | BPF_K, r->first, 0, 1);
+	} else {
+		JUMP(BPF_JMP | BPF_JGE | BPF_K, r->first, 0, 2);
+		JUMP(BPF_JMP | BPF_JGT | BPF_K, r->last, 1, 0);
+	}
+	STMT(BPF_JMP | BPF_JA, 0);
+
+	return n;
+}
+
+/*
+ * IPv4: UDP, not a fragment, from source if SSM, to one of the groups.
+ * With too many ranges for a program, any group in 224.0.0.0/4.
+ */
+static size_t filter4(struct sock_filter *code, size_t n, const struct range *rng, size_t num,
+		      const inet_addr_t *source, in_port_t port, int any)
+{
+	size_t from;
+
+	STMT(BPF_LD  | BPF_B | BPF_ABS, 23);
+	JUMP(BPF_JMP | BPF_JEQ | BPF_K, IPPROTO_UDP, 1, 0);
+	STMT(BPF_RET | BPF_K, 0);
+	STMT(BPF_LD  | BPF_H | BPF_ABS, 20);
+	JUMP(BPF_JMP | BPF_JSET | BPF_K, 0x3fff, 0, 1);
+	STMT(BPF_RET | BPF_K, 0);
+
+	if (source && source->ss_family == AF_INET) {
+		STMT(BPF_LD  | BPF_W | BPF_ABS, 26);
+		JUMP(BPF_JMP | BPF_JEQ | BPF_K, ntohl(((const struct sockaddr_in *)source)->sin_addr.s_addr), 1, 0);
+		STMT(BPF_RET | BPF_K, 0);
+	}
+
+	from = n;
+	if (any) {
+		STMT(BPF_LD  | BPF_B | BPF_ABS, 30);
+		STMT(BPF_ALU | BPF_AND | BPF_K, 0xf0);
+		JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0xe0, 0, 1);
+		STMT(BPF_JMP | BPF_JA, 0);
+	} else {
+		STMT(BPF_LD  | BPF_W | BPF_ABS, 30);
+		for (size_t i = 0; i < num; i++)
+			n = match(code, n, &rng[i]);
+	}
+	STMT(BPF_RET | BPF_K, 0);
+	patch(code, from, n, n);
+
+	STMT(BPF_LDX | BPF_B | BPF_MSH, 14);
+	STMT(BPF_LD  | BPF_H | BPF_IND, 14 + 2);
+	JUMP(BPF_JMP | BPF_JEQ | BPF_K, port, 0, 1);
+	STMT(BPF_RET | BPF_K, 0xffffffff);
+	STMT(BPF_RET | BPF_K, 0);
+
+	return n;
+}
+
+/*
+ * IPv6: UDP, from source if SSM, to one of the groups.  With too many
+ * ranges for a program, any group in ff00::/8.
+ */
+static size_t filter6(struct sock_filter *code, size_t n, const struct range *rng, size_t num,
+		      const inet_addr_t *source, in_port_t port, int any)
+{
+	size_t from;
+
+	STMT(BPF_LD  | BPF_B | BPF_ABS, 20);
+	JUMP(BPF_JMP | BPF_JEQ | BPF_K, IPPROTO_UDP, 1, 0);
+	STMT(BPF_RET | BPF_K, 0);
+
+	if (source && source->ss_family == AF_INET6) {
+		const struct sockaddr_in6 *sin6 = (const struct sockaddr_in6 *)source;
+		uint32_t w[4];
+
+		memcpy(w, &sin6->sin6_addr, sizeof(w));
+		for (int i = 0; i < 4; i++) {
+			STMT(BPF_LD  | BPF_W | BPF_ABS, 22 + 4 * i);
+			JUMP(BPF_JMP | BPF_JEQ | BPF_K, ntohl(w[i]), 1, 0);
+			STMT(BPF_RET | BPF_K, 0);
+		}
+	}
+
+	from = n;
+	if (any) {
+		STMT(BPF_LD  | BPF_B | BPF_ABS, 38);
+		JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0xff, 0, 1);
+		STMT(BPF_JMP | BPF_JA, 0);
+	} else {
+		for (size_t i = 0; i < num; i++) {
+			int len = rng[i].first == rng[i].last ? 2 : 3;
+
+			/* on mismatch skip to next range, past the match() */
+			STMT(BPF_LD  | BPF_W | BPF_ABS, 38);
+			JUMP(BPF_JMP | BPF_JEQ | BPF_K, rng[i].prefix[0], 0, 5 + len);
+			STMT(BPF_LD  | BPF_W | BPF_ABS, 42);
+			JUMP(BPF_JMP | BPF_JEQ | BPF_K, rng[i].prefix[1], 0, 3 + len);
+			STMT(BPF_LD  | BPF_W | BPF_ABS, 46);
+			JUMP(BPF_JMP | BPF_JEQ | BPF_K, rng[i].prefix[2], 0, 1 + len);
+			STMT(BPF_LD  | BPF_W | BPF_ABS, 50);
+			n = match(code, n, &rng[i]);
+		}
+	}
+	STMT(BPF_RET | BPF_K, 0);
+	patch(code, from, n, n);
+
+	STMT(BPF_LD  | BPF_H | BPF_ABS, 54 + 2);
+	JUMP(BPF_JMP | BPF_JEQ | BPF_K, port, 0, 1);
+	STMT(BPF_RET | BPF_K, 0xffffffff);
+	STMT(BPF_RET | BPF_K, 0);
+
+	return n;
+}
+
+/*
+ * Offsets are from the Ethernet header.  Fragments are dropped, only the
+ * first has the UDP header, and IPv6 extension headers are not followed.
+ * Groups are merged into ranges, e.g., from -g FIRST-LAST, each costs a
+ * couple of compares.  If they do not fit in a program all multicast to
+ * the port is let through, and the caller matches groups on its own.
+ */
+static int filter(int sd, const inet_addr_t *groups, size_t num, const inet_addr_t *source,
+		  in_port_t port)
+{
+	struct sock_filter *code;
+	struct sock_fprog prog;
+	struct range *rng;
+	size_t n = 0, num4, num6, v4, v6;
+	int any, rc = 0;
+
+	code = calloc(BPF_MAXINSNS, sizeof(*code));
+	rng  = calloc(num ? num : 1, sizeof(*rng));
+	if (!code || !rng) {
+		perror("calloc");
+		rc = -1;
+		goto done;
+	}
+
+	num  = ranges(rng, groups, num);
+	for (num4 = 0; num4 < num && rng[num4].family == AF_INET; num4++)
+		;
+	num6 = num - num4;
+
+	/* worst case: dispatch, both headers with source, and port checks */
+	any = 11 + 3 * num4 + 10 * num6 + 50 > BPF_MAXINSNS;
+
+	/* not our own, on the way out */
+	STMT(BPF_LD  | BPF_B | BPF_ABS, SKF_AD_OFF + SKF_AD_PKTTYPE);
+	JUMP(BPF_JMP | BPF_JEQ | BPF_K, PACKET_OUTGOING, 0, 1);
+	STMT(BPF_RET | BPF_K, 0);
+
+	STMT(BPF_LD  | BPF_H | BPF_ABS, 12);
+	JUMP(BPF_JMP | BPF_JEQ | BPF_K, ETH_P_IP, 0, 1);
+	STMT(BPF_JMP | BPF_JA, 0);
+	JUMP(BPF_JMP | BPF_JEQ | BPF_K, ETH_P_IPV6, 0, 1);
+	STMT(BPF_JMP | BPF_JA, 0);
+	STMT(BPF_RET | BPF_K, 0);
+
+	/* families without groups go to the last return 0 */
+	v4 = v6 = n - 1;
+	if (num4) {
+		v4 = n;
+		n  = filter4(code, n, rng, num4, source, port, any);
+	}
+	if (num6) {
+		v6 = n;
+		n  = filter6(code, n, &rng[num4], num6, source, port, any);
+	}
+	patch(code, 5, 6, v4);
+	patch(code, 7, 8, v6);
+
+	prog.len    = n;
+	prog.filter = code;
+	if (setsockopt(sd, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog))) {
+		perror("setsockopt() SO_ATTACH_FILTER");
+		rc = -1;
+	}
+done:
+	free(rng);
+	free(code);
+
+	return rc;
+}
+
+#undef STMT
+#undef JUMP
+
+/*
+ * Spread frames over the sockets of all threads.  The kernel's own flow
+ * hash covers addresses and ports, for sharding by source address only
+ * the fanout group gets a program of its own, returning the socket.
+ */
+static int fanout(int sd, int family, int steer)
+{
+	struct sock_filter code[16];
+	struct sock_fprog prog;
+	int arg, i = 0;
+
+	arg = getpid() & 0xffff;
+	if (steer == SOCK_STEER_FLOW || !family)
+		arg |= PACKET_FANOUT_HASH << 16;
+	else
+		arg |= PACKET_FANOUT_CBPF << 16;
+
+	if (setsockopt(sd, SOL_PACKET, PACKET_FANOUT, &arg, sizeof(arg))) {
+		perror("setsockopt() PACKET_FANOUT");
+		return -1;
+	}
+	if ((arg >> 16) == PACKET_FANOUT_HASH)
+		return 0;
+
+	/* source address hash, the kernel takes it modulo num sockets */
+	if (family == AF_INET6) {
+		code[i++] = (struct sock_filter)BPF_STMT(BPF_LD  | BPF_W | BPF_ABS, SKF_NET_OFF + 8);
+		for (int off = 12; off < 24; off += 4) {
+			code[i++] = (struct sock_filter)BPF_STMT(BPF_MISC | BPF_TAX, 0);
+			code[i++] = (struct sock_filter)BPF_STMT(BPF_LD  | BPF_W | BPF_ABS, SKF_NET_OFF + off);
+			code[i++] = (struct sock_filter)BPF_STMT(BPF_ALU | BPF_XOR | BPF_X, 0);
+		}
+	} else {
+		code[i++] = (struct sock_filter)BPF_STMT(BPF_LD  | BPF_W | BPF_ABS, SKF_NET_OFF + 12);
+	}
+	code[i++] = (struct sock_filter)BPF_STMT(BPF_ALU | BPF_MUL | BPF_K, 2654435761U);
+	code[i++] = (struct sock_filter)BPF_STMT(BPF_ALU | BPF_RSH | BPF_K, 16);
+	code[i++] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_A, 0);
+
+	prog.len    = i;
+	prog.filter = code;
+	if (setsockopt(sd, SOL_PACKET, PACKET_FANOUT_DATA, &prog, sizeof(prog))) {
+		perror("setsockopt() PACKET_FANOUT_DATA");
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Open ring on interface, for IPv4, IPv6 or, with family 0, both, only
+ * frames to the num groups, and from source if not NULL.  With
+ * fanout > 1 the socket joins a fanout group shared by all sockets opened
+ * by this process, steer selects the key, see sock_steer().
+ */
+int packet_rx_open(struct packet_rx *r, const char *ifname, int family, const inet_addr_t *groups,
+		   size_t num, const inet_addr_t *source, in_port_t port, unsigned int fanout_num,
+		   int steer, int hw)
+{
+	struct tpacket_req3 req = {
+		.tp_block_size       = PACKET_BLOCKSZ,
+		.tp_block_nr         = PACKET_BLOCKNR,
+		.tp_frame_size       = PACKET_FRAMESZ,
+		.tp_frame_nr         = PACKET_BLOCKSZ / PACKET_FRAMESZ * PACKET_BLOCKNR,
+		.tp_retire_blk_tov   = PACKET_TIMEOUT,
+	};
+	struct sockaddr_ll sll = { 0 };
+	int version = TPACKET_V3;
+	uint16_t proto;
+
+	memset(r, 0, sizeof(*r));
+	r->map = MAP_FAILED;
+
+	if (family == AF_INET)
+		proto = ETH_P_IP;
+	else if (family == AF_INET6)
+		proto = ETH_P_IPV6;
+	else
+		proto = ETH_P_ALL;
+
+	/* no protocol until bound, the ring should only see filtered frames */
+	r->sd = socket(AF_PACKET, SOCK_RAW, 0);
+	if (r->sd < 0) {
+		perror("socket() AF_PACKET");
+		return -1;
+	}
+
+	if (setsockopt(r->sd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version))) {
+		perror("setsockopt() PACKET_VERSION");
+		goto fail;
+	}
+
+	if (filter(r->sd, groups, num, source, port))
+		goto fail;
+
+	if (hw && tstamp_packet_enable(r->sd, ifname))
+		fputs("Hardware timestamping not available, using software.\n", stderr);
+
+	if (setsockopt(r->sd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req))) {
+		perror("setsockopt() PACKET_RX_RING");
+		goto fail;
+	}
+
+	r->block_nr = req.tp_block_nr;
+	r->size     = (size_t)req.tp_block_size * req.tp_block_nr;
+	r->map      = mmap(NULL, r->size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->sd, 0);
+	if (r->map == MAP_FAILED) {
+		perror("mmap");
+		goto fail;
+	}
+
+	sll.sll_family   = AF_PACKET;
+	sll.sll_protocol = htons(proto);
+	sll.sll_ifindex  = if_nametoindex(ifname);
+	if (!sll.sll_ifindex) {
+		perror(ifname);
+		goto fail;
+	}
+	if (bind(r->sd, (struct sockaddr *)&sll, sizeof(sll))) {
+		perror("bind() AF_PACKET");
+		goto fail;
+	}
+
+	if (fanout_num > 1 && fanout(r->sd, family, steer))
+		goto fail;
+
+	return 0;
+fail:
+	packet_rx_close(r);
+	return -1;
+}
+
+/*
+ * Next frame in ring, 1 if one, 0 if none ready.  The frame stays valid
+ * until the next call, which gives its block back to the kernel when all
+ * frames in it have been read.
+ */
+int packet_rx_next(struct packet_rx *r, struct packet_frame *f)
+{
+	struct tpacket3_hdr *h;
+
+	while (!r->left) {
+		struct tpacket_block_desc *bd;
+
+		if (r->blk) {
+			bd = (struct tpacket_block_desc *)r->blk;
+			__atomic_store_n(&bd->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+			r->blk   = NULL;
+			r->block = (r->block + 1) % r->block_nr;
+		}
+
+		bd = (struct tpacket_block_desc *)(r->map + (size_t)r->block * PACKET_BLOCKSZ);
+		if (!(__atomic_load_n(&bd->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER))
+			return 0;
+
+		r->blk  = (uint8_t *)bd;
+		r->left = bd->hdr.bh1.num_pkts;
+		r->next = r->blk + bd->hdr.bh1.offset_to_first_pkt;
+		r->blocks++;
+	}
+
+	h = (struct tpacket3_hdr *)r->next;
+	f->data = (uint8_t *)h + h->tp_mac;
+	f->len  = h->tp_snaplen;
+	f->ts   = (uint64_t)h->tp_sec * 1000000000 + h->tp_nsec;
+	f->hw   = !!(h->tp_status & TP_STATUS_TS_RAW_HARDWARE);
+	f->trunc = h->tp_snaplen < h->tp_len;
+
+	r->next += h->tp_next_offset;
+	r->left--;
+
+	return 1;
+}
+
+/* Fold kernel counters into ours, frames received and dropped, ring full */
+int packet_rx_stats(struct packet_rx *r)
+{
+	struct tpacket_stats_v3 st;
+	socklen_t len = sizeof(st);
+
+	if (getsockopt(r->sd, SOL_PACKET, PACKET_STATISTICS, &st, &len)) {
+		perror("getsockopt() PACKET_STATISTICS");
+		return -1;
+	}
+
+	r->packets += st.tp_packets;
+	r->drops   += st.tp_drops;
+
+	return 0;
+}
+
+void packet_rx_close(struct packet_rx *r)
+{
+	if (r->map && r->map != MAP_FAILED)
+		munmap(r->map, r->size);
+	r->map = NULL;
+
+	if (r->sd >= 0)
+		close(r->sd);
+	r->sd = -1;
+}
+
+/* Frames do not cross blocks, the tail of each block is unused */
+static inline uint8_t *tx_frame(struct packet_tx *t, unsigned int i)
+{
+	return t->map + (size_t)(i / t->frame_per_block) * PACKET_BLOCKSZ +
+		(size_t)(i % t->frame_per_block) * t->frame_size;
+}
+
+/* Frame data, after the frame header, as the kernel expects it for TX */
+static inline uint8_t *tx_data(struct packet_tx *t, unsigned int i)
+{
+	return tx_frame(t, i) + TPACKET2_HDRLEN - sizeof(struct sockaddr_ll);
+}
+
+static inline struct tpacket2_hdr *tx_hdr(struct packet_tx *t, unsigned int i)
+{
+	return (struct tpacket2_hdr *)tx_frame(t, i);
+}
+
+/*
+ * Interface MTU, the largest IP packet, or -1 on error.  Frames on the
+ * send ring bypass the IP stack, so nothing fragments them for us.
+ */
+int packet_mtu(const char *ifname)
+{
+	struct ifreq ifr;
+	int sd, ret;
+
+	sd = socket(AF_PACKET, SOCK_RAW, 0);
+	if (sd < 0) {
+		perror("socket() AF_PACKET");
+		return -1;
+	}
+
+	memset(&ifr, 0, sizeof(ifr));
+	strncpy(ifr.ifr_name, ifname, IFNAMSIZ - 1);
+	ret = ioctl(sd, SIOCGIFMTU, &ifr);
+	if (ret)
+		perror("ioctl() SIOCGIFMTU");
+	close(sd);
+
+	return ret ? -1 : ifr.ifr_mtu;
+}
+
+/*
+ * Open send ring on interface, for frames up to len bytes.  The ring is
+ * PACKET_TXRING bytes, frames are only as large as needed, so the number
+ * of frames depends on len.
+ */
+int packet_tx_open(struct packet_tx *t, const char *ifname, size_t len)
+{
+	struct tpacket_req req = { 0 };
+	struct sockaddr_ll sll = { 0 };
+	int version = TPACKET_V2;
+	struct ifreq ifr;
+
+	memset(t, 0, sizeof(*t));
+	t->map = MAP_FAILED;
+
+	t->frame_size = TPACKET_ALIGN(TPACKET2_HDRLEN + len);
+	if (t->frame_size > PACKET_BLOCKSZ) {
+		errno = EMSGSIZE;
+		perror("packet_tx_open");
+		return -1;
+	}
+	t->frame_per_block = PACKET_BLOCKSZ / t->frame_size;
+
+	/* protocol 0, we never receive on it */
+	t->sd = socket(AF_PACKET, SOCK_RAW, 0);
+	if (t->sd < 0) {
+		perror("socket() AF_PACKET");
+		return -1;
+	}
+
+	if (setsockopt(t->sd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version))) {
+		perror("setsockopt() PACKET_VERSION");
+		goto fail;
+	}
+
+	req.tp_frame_size = t->frame_size;
+	req.tp_block_size = PACKET_BLOCKSZ;
+	req.tp_block_nr   = PACKET_TXRING / PACKET_BLOCKSZ;
+	req.tp_frame_nr   = t->frame_per_block * req.tp_block_nr;
+	if (setsockopt(t->sd, SOL_PACKET, PACKET_TX_RING, &req, sizeof(req))) {
+		perror("setsockopt() PACKET_TX_RING");
+		goto fail;
+	}
+
+	t->frame_nr = req.tp_frame_nr;
+	t->size     = (size_t)req.tp_block_size * req.tp_block_nr;
+	t->map      = mmap(NULL, t->size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, t->sd, 0);
+	if (t->map == MAP_FAILED) {
+		perror("mmap");
+		goto fail;
+	}
+
+	memset(&ifr, 0, sizeof(ifr));
+	strncpy(ifr.ifr_name, ifname, IFNAMSIZ - 1);
+	if (ioctl(t->sd, SIOCGIFHWADDR, &ifr)) {
+		perror("ioctl() SIOCGIFHWADDR");
+		goto fail;
+	}
+	memcpy(t->mac, ifr.ifr_hwaddr.sa_data, sizeof(t->mac));
+
+	sll.sll_family  = AF_PACKET;
+	sll.sll_ifindex = if_nametoindex(ifname);
+	if (!sll.sll_ifindex) {
+		perror(ifname);
+		goto fail;
+	}
+	if (bind(t->sd, (struct sockaddr *)&sll, sizeof(sll))) {
+		perror("bind() AF_PACKET");
+		goto fail;
+	}
+
+	return 0;
+fail:
+	packet_tx_close(t);
+	return -1;
+}
+
+/* Copy frame template to all slots, after this only changes are written */
+void packet_tx_fill(struct packet_tx *t, const void *frame, size_t len)
+{
+	for (unsigned int i = 0; i < t->frame_nr; i++) {
+		memcpy(tx_data(t, i), frame, len);
+		tx_hdr(t, i)->tp_len = len;
+	}
+}
+
+/* Next free slot in ring, NULL if all are waiting to be sent */
+uint8_t *packet_tx_next(struct packet_tx *t)
+{
+	struct tpacket2_hdr *h = tx_hdr(t, t->frame);
+	uint32_t status;
+
+	status = __atomic_load_n(&h->tp_status, __ATOMIC_ACQUIRE);
+	if (status & TP_STATUS_WRONG_FORMAT)
+		t->errors++;
+	else if (status != TP_STATUS_AVAILABLE)
+		return NULL;
+
+	return tx_data(t, t->frame);
+}
+
+/* Mark slot returned by packet_tx_next() for sending, len bytes of it */
+void packet_tx_queue(struct packet_tx *t, size_t len)
+{
+	struct tpacket2_hdr *h = tx_hdr(t, t->frame);
+
+	h->tp_len = len;
+	__atomic_store_n(&h->tp_status, TP_STATUS_SEND_REQUEST, __ATOMIC_RELEASE);
+	t->frame = (t->frame + 1) % t->frame_nr;
+}
+
+/* Send all queued frames, without waiting for them to leave */
+int packet_tx_kick(struct packet_tx *t)
+{
+	if (send(t->sd, NULL, 0, MSG_DONTWAIT) < 0) {
+		if (errno == EAGAIN || errno == ENOBUFS || errno == EINTR)
+			return 0;
+		perror("send() AF_PACKET");
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Ring full, wait for the driver to free a slot, or a signal */
+int packet_tx_wait(struct packet_tx *t)
+{
+	struct pollfd pfd = {
+		.fd     = t->sd,
+		.events = POLLOUT,
+	};
+
+	if (poll(&pfd, 1, 100) < 0 && errno != EINTR) {
+		perror("poll");
+		return -1;
+	}
+
+	return 0;
+}
+
+void packet_tx_close(struct packet_tx *t)
+{
+	if (t->map && t->map != MAP_FAILED)
+		munmap(t->map, t->size);
+	t->map = NULL;
+
+	if (t->sd >= 0)
+		close(t->sd);
+	t->sd = -1;
+}
+
+/**
+ * Local Variables:
+ *  c-file-style: "linux"
+ *  indent-tabs-mode: t
+ * End:
+ */
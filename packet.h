@@ -0,0 +1,82 @@
+/*
+ * packet.h -- AF_PACKET memory-mapped rings, TPACKET_V3 receive, TPACKET_V2 send
+ */
+
+#ifndef MTOOLS_PACKET_H_
+#define MTOOLS_PACKET_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "inet.h"
+
+#define PACKET_BLOCKSZ  (1 << 20)	/* ring block, frames are packed into it */
+#define PACKET_BLOCKNR  64
+#define PACKET_FRAMESZ  2048
+#define PACKET_TIMEOUT  10		/* ms, hand over partially filled block */
+#define PACKET_TXRING   (8 << 20)	/* send ring, bytes */
+
+/* One frame in a block, data points into the ring */
+struct packet_frame {
+	const uint8_t *data;	/* link layer header */
+	size_t         len;	/* captured length */
+	uint64_t       ts;	/* kernel sw, or NIC hw, receive time, ns */
+	int            hw;	/* ts is from NIC */
+	int            trunc;	/* did not fit in the ring */
+};
+
+struct packet_rx {
+	int            sd;
+	uint8_t       *map;
+	size_t         size;
+	unsigned int   block_nr;
+	unsigned int   block;	/* next block to look at */
+
+	/* current block, while walking its frames */
+	uint8_t       *blk;
+	uint32_t       left;
+	uint8_t       *next;
+
+	uint64_t       blocks;	/* handed to us by the kernel */
+
+	/* accumulated from PACKET_STATISTICS, it resets on read */
+	uint64_t       packets;
+	uint64_t       drops;
+};
+
+struct packet_tx {
+	int            sd;
+	uint8_t       *map;
+	size_t         size;
+	size_t         frame_size;
+	unsigned int   frame_nr;
+	unsigned int   frame_per_block;
+	unsigned int   frame;	/* next to fill */
+	uint8_t        mac[6];	/* of interface */
+	uint64_t       errors;	/* frames rejected by the kernel */
+};
+
+int  packet_rx_open  (struct packet_rx *r, const char *ifname, int family,
+		      const inet_addr_t *groups, size_t num, const inet_addr_t *source,
+		      in_port_t port, unsigned int fanout, int steer, int hw);
+int  packet_rx_next  (struct packet_rx *r, struct packet_frame *f);
+int  packet_rx_stats (struct packet_rx *r);
+void packet_rx_close (struct packet_rx *r);
+
+int      packet_mtu      (const char *ifname);
+int      packet_tx_open  (struct packet_tx *t, const char *ifname, size_t len);
+void     packet_tx_fill  (struct packet_tx *t, const void *frame, size_t len);
+uint8_t *packet_tx_next  (struct packet_tx *t);
+void     packet_tx_queue (struct packet_tx *t, size_t len);
+int      packet_tx_kick  (struct packet_tx *t);
+int      packet_tx_wait  (struct packet_tx *t);
+void     packet_tx_close (struct packet_tx *t);
+
+#endif /* MTOOLS_PACKET_H_ */
+
+/**
+ * Local Variables:
+ *  c-file-style: "linux"
+ *  indent-tabs-mode: t
+ * End:
+ */
@@ -0,0 +1,107 @@
+/*
+ * pcap.h -- Capture file formats, classic pcap and pcapng
+ *
+ * Only what mtools needs, see the pcapng draft at the IETF OPSAWG and
+ * https://www.tcpdump.org/linktypes.html
+ */
+
+#ifndef MTOOLS_PCAP_H_
+#define MTOOLS_PCAP_H_
+
+#include <stdint.h>
+
+/* pcapng block types */
+#define PCAPNG_SHB         0x0A0D0D0A	/* section header */
+#define PCAPNG_IDB         0x00000001	/* interface description */
+#define PCAPNG_PB          0x00000002	/* packet, obsolete */
+#define PCAPNG_SPB         0x00000003	/* simple packet */
+#define PCAPNG_EPB         0x00000006	/* enhanced packet */
+#define PCAPNG_BOM         0x1A2B3C4D	/* byte-order magic, in SHB */
+
+/* pcapng option codes */
+#define PCAPNG_OPT_END     0
+#define PCAPNG_OPT_COMMENT 1
+#define PCAPNG_SHB_APPL    4	/* shb_userappl */
+#define PCAPNG_IF_NAME     2
+#define PCAPNG_IF_TSRESOL  9
+#define PCAPNG_EPB_FLAGS   2
+#define PCAPNG_EPB_INBOUND 0x00000001
+
+/* classic pcap file header magic, usec and nsec timestamps */
+#define PCAP_MAGIC_US      0xA1B2C3D4
+#define PCAP_MAGIC_NS      0xA1B23C4D
+
+/* link types */
+#define LINKTYPE_ETHERNET  1
+#define LINKTYPE_RAW       101	/* IPv4 or IPv6, no link layer header */
+#define LINKTYPE_LINUX_SLL 113
+#define LINKTYPE_IPV4      228
+#define LINKTYPE_IPV6      229
+#define LINKTYPE_LINUX_SLL2 276
+
+/* All pcapng blocks start with type and length, and end with length */
+struct pcapng_block {
+	uint32_t type;
+	uint32_t len;
+};
+
+struct pcapng_shb {
+	uint32_t type;
+	uint32_t len;
+	uint32_t bom;
+	uint16_t major;
+	uint16_t minor;
+	int64_t  section;	/* length, -1: unknown */
+};
+
+struct pcapng_idb {
+	uint32_t type;
+	uint32_t len;
+	uint16_t linktype;
+	uint16_t reserved;
+	uint32_t snaplen;
+};
+
+struct pcapng_epb {
+	uint32_t type;
+	uint32_t len;
+	uint32_t ifid;
+	uint32_t ts_hi;
+	uint32_t ts_lo;
+	uint32_t caplen;
+	uint32_t origlen;
+};
+
+struct pcapng_opt {
+	uint16_t code;
+	uint16_t len;
+};
+
+struct pcap_hdr {
+	uint32_t magic;
+	uint16_t major;
+	uint16_t minor;
+	int32_t  zone;
+	uint32_t sigfigs;
+	uint32_t snaplen;
+	uint32_t linktype;
+};
+
+struct pcap_rec {
+	uint32_t sec;
+	uint32_t frac;		/* usec or nsec, see magic */
+	uint32_t caplen;
+	uint32_t origlen;
+};
+
+/* Blocks and options are padded to 32 bits */
+#define PCAPNG_PAD(len)    (((len) + 3) & ~3U)
+
+#endif /* MTOOLS_PCAP_H_ */
+
+/**
+ * Local Variables:
+ *  c-file-style: "linux"
+ *  indent-tabs-mode: t
+ * End:
+ */
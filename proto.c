@@ -0,0 +1,56 @@
+/*
+ * proto.c -- Binary sequenced payload header used by msend -n
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+#include "proto.h"
+
+
+void proto_init(void *buf, size_t len, uint32_t sender, uint16_t stream, int flags)
+{
+	struct proto_hdr *hdr = buf;
+
+	memset(hdr, 0, sizeof(*hdr));
+	hdr->magic   = htonl(PROTO_MAGIC);
+	hdr->version = PROTO_VERSION;
+	hdr->flags   = flags;
+	hdr->stream  = htons(stream);
+	hdr->sender  = htonl(sender);
+	hdr->length  = htonl(len);
+}
+
+/* Returns -1 if buf does not start with a header we understand */
+int proto_parse(const void *buf, size_t len, struct proto_info *pi)
+{
+	struct proto_hdr hdr;
+
+	if (len < PROTO_HDRLEN)
+		goto fail;
+
+	/* may be unaligned in the receive buffer */
+	memcpy(&hdr, buf, sizeof(hdr));
+	if (ntohl(hdr.magic) != PROTO_MAGIC || hdr.version != PROTO_VERSION)
+		goto fail;
+
+	pi->sender = ntohl(hdr.sender);
+	pi->stream = ntohs(hdr.stream);
+	pi->flags  = hdr.flags;
+	pi->length = ntohl(hdr.length);
+	pi->seq    = be64toh(hdr.seq);
+	pi->tstamp = be64toh(hdr.tstamp);
+
+	return 0;
+fail:
+	errno = EPROTO;
+	return -1;
+}
+
+/**
+ * Local Variables:
+ *  c-file-style: "linux"
+ *  indent-tabs-mode: t
+ * End:
+ */
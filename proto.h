@@ -0,0 +1,77 @@
+/*
+ * proto.h -- Binary sequenced payload header used by msend -n
+ */
+
+#ifndef MTOOLS_PROTO_H_
+#define MTOOLS_PROTO_H_
+
+#include <endian.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+
+#define PROTO_MAGIC    0x6d746f6f	/* "mtoo" */
+#define PROTO_VERSION  1
+
+#define PROTO_F_TAI    0x01		/* tstamp is CLOCK_TAI, not CLOCK_REALTIME */
+
+/*
+ * All fields in network byte order.  The header is written once to a
+ * packet template by proto_init() and then seq and tstamp are patched
+ * in place for each packet by proto_stamp().
+ */
+struct proto_hdr {
+	uint32_t magic;
+	uint8_t  version;
+	uint8_t  flags;
+	uint16_t stream;	/* sub-stream of sender, e.g. thread */
+	uint32_t sender;	/* sender ID, random per msend instance */
+	uint32_t length;	/* length of datagram, including header */
+	uint64_t seq;
+	uint64_t tstamp;	/* send time, nanoseconds since epoch */
+} __attribute__((packed));
+
+#define PROTO_HDRLEN   sizeof(struct proto_hdr)
+
+struct proto_info {
+	uint32_t sender;
+	uint16_t stream;
+	uint8_t  flags;
+	uint32_t length;
+	uint64_t seq;
+	uint64_t tstamp;
+};
+
+void proto_init  (void *buf, size_t len, uint32_t sender, uint16_t stream, int flags);
+int  proto_parse (const void *buf, size_t len, struct proto_info *pi);
+
+static inline clockid_t proto_clock(int flags)
+{
+	return (flags & PROTO_F_TAI) ? CLOCK_TAI : CLOCK_REALTIME;
+}
+
+/* Hot path, patch sequence number and send timestamp of template */
+static inline void proto_stamp(void *buf, uint64_t seq, uint64_t tstamp)
+{
+	struct proto_hdr *hdr = buf;
+
+	hdr->seq    = htobe64(seq);
+	hdr->tstamp = htobe64(tstamp);
+}
+
+/* Datagrams of varying size share one template, patch length too */
+static inline void proto_length(void *buf, size_t len)
+{
+	struct proto_hdr *hdr = buf;
+
+	hdr->length = htobe32(len);
+}
+
+#endif /* MTOOLS_PROTO_H_ */
+
+/**
+ * Local Variables:
+ *  c-file-style: "linux"
+ *  indent-tabs-mode: t
+ * End:
+ */
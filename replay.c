@@ -0,0 +1,301 @@
+/*
+ * replay.c -- Read UDP datagrams from a memory-mapped pcap or pcapng file
+ *
+ * The whole file is mapped read-only and datagrams are returned as
+ * pointers into the mapping, nothing is copied or read per packet.  Both
+ * classic pcap, microsecond and nanosecond, and pcapng with any number
+ * of sections and interfaces are supported, in either byte order.
+ *
+ * Only UDP over IPv4 or IPv6 is returned, see frame.c for the link
+ * types understood, everything else is skipped.  If the capture was
+ * truncated by a snap length, only the captured part of the payload is
+ * returned.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "frame.h"
+#include "pcap.h"
+#include "replay.h"
+
+static inline uint16_t get16(const struct replay *r, const uint8_t *p)
+{
+	uint16_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return r->swap ? __builtin_bswap16(v) : v;
+}
+
+static inline uint32_t get32(const struct replay *r, const uint8_t *p)
+{
+	uint32_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return r->swap ? __builtin_bswap32(v) : v;
+}
+
+/* Timestamp in units of 10^-res or 2^-res seconds, to ns */
+static uint64_t tsconv(uint64_t ts, uint8_t res)
+{
+	unsigned __int128 units = 1;
+
+	if (res & 0x80) {
+		units <<= res & 0x7f;
+	} else {
+		if (res <= 9) {
+			uint64_t mul = 1;
+
+			for (int i = res; i < 9; i++)
+				mul *= 10;
+			return ts * mul;
+		}
+		for (int i = 0; i < res; i++)
+			units *= 10;
+	}
+
+	return (unsigned __int128)ts * 1000000000 / units;
+}
+
+/* Find UDP in link layer frame, 0 if found, -1 if not */
+static int decode(uint32_t linktype, const uint8_t *p, size_t len, struct replay_pkt *pkt)
+{
+	struct frame f;
+
+	if (frame_parse(linktype, p, len, &f))
+		return -1;
+
+	pkt->data = f.data;
+	pkt->len  = f.len;
+	pkt->dst  = f.dst;
+
+	return 0;
+}
+
+static int pcap_record(struct replay *r, struct replay_pkt *pkt)
+{
+	const uint8_t *end = r->map + r->size;
+	const uint8_t *p = r->pos;
+	uint32_t caplen;
+
+	if (end - p < (ptrdiff_t)sizeof(struct pcap_rec))
+		return -1;
+
+	caplen = get32(r, &p[8]);
+	if ((size_t)(end - p) - sizeof(struct pcap_rec) < caplen)
+		return -1;	/* truncated file */
+	r->pos = p + sizeof(struct pcap_rec) + caplen;
+
+	pkt->ts = get32(r, &p[0]) * 1000000000ULL + get32(r, &p[4]) * r->tsmul;
+
+	return decode(r->linktype, p + sizeof(struct pcap_rec), caplen, pkt) ? 0 : 1;
+}
+
+static void pcapng_idb(struct replay *r, const uint8_t *p, uint32_t len)
+{
+	const uint8_t *opt = p + sizeof(struct pcapng_idb);
+	const uint8_t *end = p + len - 4;
+	int i = r->num_ifs;
+
+	if (i >= REPLAY_IFMAX)
+		return;
+
+	r->ifs[i].linktype = get16(r, &p[8]);
+	r->ifs[i].tsresol  = 6;
+	while (end - opt >= (ptrdiff_t)sizeof(struct pcapng_opt)) {
+		uint16_t code = get16(r, opt), olen = get16(r, &opt[2]);
+
+		if (code == PCAPNG_OPT_END)
+			break;
+		if (code == PCAPNG_IF_TSRESOL && olen >= 1)
+			r->ifs[i].tsresol = opt[4];
+		opt += sizeof(struct pcapng_opt) + PCAPNG_PAD(olen);
+	}
+	r->num_ifs++;
+}
+
+static int pcapng_record(struct replay *r, struct replay_pkt *pkt)
+{
+	const uint8_t *end = r->map + r->size;
+
+	while (end - r->pos >= (ptrdiff_t)sizeof(struct pcapng_block)) {
+		const uint8_t *p = r->pos;
+		uint32_t type, len, ifid, caplen;
+
+		memcpy(&type, p, sizeof(type));
+		if (type == PCAPNG_SHB) {
+			uint32_t bom;
+
+			if (end - p < (ptrdiff_t)sizeof(struct pcapng_shb))
+				return -1;
+			memcpy(&bom, &p[8], sizeof(bom));
+			if (bom == PCAPNG_BOM)
+				r->swap = 0;
+			else if (bom == __builtin_bswap32(PCAPNG_BOM))
+				r->swap = 1;
+			else
+				return -1;
+			r->num_ifs = 0;
+		}
+
+		type = get32(r, p);
+		len  = get32(r, &p[4]);
+		if (len < 12 || len % 4 || (size_t)(end - p) < len)
+			return -1;
+		r->pos = p + len;
+
+		switch (type) {
+		case PCAPNG_IDB:
+			if (len >= sizeof(struct pcapng_idb) + 4)
+				pcapng_idb(r, p, len);
+			break;
+
+		case PCAPNG_EPB:
+		case PCAPNG_PB:	/* obsolete, same layout for what we need */
+			if (len < sizeof(struct pcapng_epb) + 4)
+				return 0;
+			ifid   = type == PCAPNG_EPB ? get32(r, &p[8]) : get16(r, &p[8]);
+			caplen = get32(r, &p[20]);
+			if (ifid >= (uint32_t)r->num_ifs || caplen > len - sizeof(struct pcapng_epb) - 4)
+				return 0;
+
+			pkt->ts = tsconv((uint64_t)get32(r, &p[12]) << 32 | get32(r, &p[16]),
+					 r->ifs[ifid].tsresol);
+
+			return decode(r->ifs[ifid].linktype, p + sizeof(struct pcapng_epb), caplen, pkt) ? 0 : 1;
+
+		case PCAPNG_SPB:
+			return 0;	/* no timestamp, no use */
+		}
+	}
+
+	return -1;
+}
+
+/* Next record: 1 if UDP datagram, 0 if something else, -1 at end of file */
+static int record(struct replay *r, struct replay_pkt *pkt)
+{
+	if (r->ng)
+		return pcapng_record(r, pkt);
+
+	return pcap_record(r, pkt);
+}
+
+/* Next UDP datagram in file, returns 0 at end of file */
+int replay_next(struct replay *r, struct replay_pkt *pkt)
+{
+	int rc;
+
+	while ((rc = record(r, pkt)) == 0)
+		;
+
+	return rc > 0;
+}
+
+void replay_rewind(struct replay *r)
+{
+	r->pos = r->map;
+	if (!r->ng)
+		r->pos += sizeof(struct pcap_hdr);
+}
+
+/* Map capture file and count UDP datagrams in it, for timing and loops */
+int replay_open(struct replay *r, const char *file)
+{
+	struct replay_pkt pkt;
+	struct stat st;
+	uint32_t magic;
+	int fd, rc;
+
+	memset(r, 0, sizeof(*r));
+
+	fd = open(file, O_RDONLY);
+	if (fd < 0 || fstat(fd, &st)) {
+		perror(file);
+		if (fd >= 0)
+			close(fd);
+		return -1;
+	}
+
+	r->size = st.st_size;
+	if (r->size < sizeof(struct pcap_hdr)) {
+		fprintf(stderr, "%s: not a pcap or pcapng file\n", file);
+		close(fd);
+		return -1;
+	}
+
+	r->map = mmap(NULL, r->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (r->map == MAP_FAILED) {
+		perror("mmap");
+		return -1;
+	}
+	madvise((void *)r->map, r->size, MADV_SEQUENTIAL);
+
+	memcpy(&magic, r->map, sizeof(magic));
+	switch (magic) {
+	case PCAPNG_SHB:
+		r->ng = 1;
+		break;
+	case PCAP_MAGIC_US:
+	case PCAP_MAGIC_NS:
+		break;
+	default:
+		magic = __builtin_bswap32(magic);
+		if (magic != PCAP_MAGIC_US && magic != PCAP_MAGIC_NS) {
+			fprintf(stderr, "%s: not a pcap or pcapng file\n", file);
+			replay_close(r);
+			return -1;
+		}
+		r->swap = 1;
+		break;
+	}
+
+	if (!r->ng) {
+		r->tsmul    = magic == PCAP_MAGIC_NS ? 1 : 1000;
+		r->linktype = get32(r, &r->map[20]) & 0xffff;
+	}
+
+	replay_rewind(r);
+	while ((rc = record(r, &pkt)) >= 0) {
+		if (!rc) {
+			r->skipped++;
+			continue;
+		}
+
+		if (!r->packets++) {
+			r->first = pkt.ts;
+			r->dst   = pkt.dst;
+		}
+		if (pkt.ts > r->last)
+			r->last = pkt.ts;
+	}
+	replay_rewind(r);
+
+	if (!r->packets) {
+		fprintf(stderr, "%s: no UDP datagrams found\n", file);
+		replay_close(r);
+		return -1;
+	}
+
+	return 0;
+}
+
+void replay_close(struct replay *r)
+{
+	if (r->map && r->map != MAP_FAILED)
+		munmap((void *)r->map, r->size);
+	r->map = NULL;
+}
+
+/**
+ * Local Variables:
+ *  c-file-style: "linux"
+ *  indent-tabs-mode: t
+ * End:
+ */
@@ -0,0 +1,61 @@
+/*
+ * replay.h -- Read UDP datagrams from a memory-mapped pcap or pcapng file
+ */
+
+#ifndef MTOOLS_REPLAY_H_
+#define MTOOLS_REPLAY_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "inet.h"
+
+#define REPLAY_IFMAX   64	/* pcapng interfaces per section */
+
+struct replay_pkt {
+	uint64_t     ts;	/* capture time, ns */
+	const void  *data;	/* UDP payload, in the mapped file */
+	size_t       len;	/* captured length of payload */
+	inet_addr_t  dst;	/* original destination, group and port */
+};
+
+struct replay {
+	const uint8_t *map;
+	size_t         size;
+	const uint8_t *pos;	/* next record or block */
+
+	int            ng;	/* pcapng, else classic pcap */
+	int            swap;	/* file written on other endian host */
+
+	/* classic pcap */
+	uint32_t       linktype;
+	uint64_t       tsmul;	/* ns per timestamp fraction */
+
+	/* pcapng, interfaces of current section */
+	struct {
+		uint16_t linktype;
+		uint8_t  tsresol;
+	} ifs[REPLAY_IFMAX];
+	int            num_ifs;
+
+	/* from first pass over the file */
+	uint64_t       packets;	/* UDP datagrams */
+	uint64_t       skipped;	/* other, fragmented or unknown link type */
+	uint64_t       first;	/* timestamps, ns */
+	uint64_t       last;
+	inet_addr_t    dst;	/* of first datagram */
+};
+
+int  replay_open   (struct replay *r, const char *file);
+int  replay_next   (struct replay *r, struct replay_pkt *pkt);
+void replay_rewind (struct replay *r);
+void replay_close  (struct replay *r);
+
+#endif /* MTOOLS_REPLAY_H_ */
+
+/**
+ * Local Variables:
+ *  c-file-style: "linux"
+ *  indent-tabs-mode: t
+ * End:
+ */
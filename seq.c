@@ -0,0 +1,227 @@
+/*
+ * seq.c -- Sequence number tracking, loss, reorder and duplicates
+ *
+ * Loosely following RFC 4737, a packet with a sequence number lower than
+ * the next expected is reordered (late), unless it has already been
+ * received, then it is a duplicate.  Received sequence numbers are kept
+ * in a bitmap over a sliding window, a sequence number that slides out
+ * of the window without being received is counted as lost.
+ *
+ * All work per packet is O(1), except for gaps where each skipped
+ * sequence number is visited once, bounded by the window size.
+ */
+
+#include <string.h>
+
+#include "common.h"
+#include "seq.h"
+
+#define SLOT(seq)  ((seq) & (SEQ_WINDOW - 1))
+
+static inline int test(const struct seq *s, uint64_t seq)
+{
+	return !!(s->bitmap[SLOT(seq) / 64] & (1ULL << (SLOT(seq) % 64)));
+}
+
+static inline void set(struct seq *s, uint64_t seq)
+{
+	s->bitmap[SLOT(seq) / 64] |= 1ULL << (SLOT(seq) % 64);
+}
+
+static inline void clear(struct seq *s, uint64_t seq)
+{
+	s->bitmap[SLOT(seq) / 64] &= ~(1ULL << (SLOT(seq) % 64));
+}
+
+static inline int bucket(uint64_t val)
+{
+	int b;
+
+	if (!val)
+		return 0;
+
+	b = 64 - __builtin_clzll(val);
+	return b < SEQ_BUCKETS ? b : SEQ_BUCKETS - 1;
+}
+
+/*
+ * Window starts at seq, nothing before it is counted as lost.  Those
+ * still arriving were sent before seq, so are late, tracked in early.
+ */
+static void start(struct seq *s, uint64_t seq)
+{
+	memset(s->bitmap, 0xff, sizeof(s->bitmap));
+	memset(s->early, 0, sizeof(s->early));
+	s->base = seq;
+	s->next = seq + 1;
+}
+
+void seq_init(struct seq *s)
+{
+	memset(s, 0, sizeof(*s));
+}
+
+/* Sequence numbers in the window not (yet) received */
+uint64_t seq_missing(const struct seq *s)
+{
+	uint64_t num = 0;
+
+	if (!s->next)
+		return 0;
+
+	for (int i = 0; i < SEQ_WORDS; i++)
+		num += 64 - __builtin_popcountll(s->bitmap[i]);
+
+	return num;
+}
+
+/* Slide window forward to seq, a higher seq than any received so far */
+static void advance(struct seq *s, uint64_t seq, uint32_t idx)
+{
+	uint64_t gap = seq - s->next;
+
+	if (gap >= SEQ_WINDOW) {
+		/* whole window, and everything skipped before new window, lost */
+		STAT_ADD(s->lost, seq_missing(s) + gap - SEQ_WINDOW + 1);
+		memset(s->bitmap, 0, sizeof(s->bitmap));
+		for (int i = 0; i < SEQ_WINDOW; i++)
+			s->passed[i] = idx;
+		set(s, seq);
+		s->next = seq + 1;
+		return;
+	}
+
+	/* each slot reused by t still holds t - SEQ_WINDOW */
+	for (uint64_t t = s->next; t < seq; t++) {
+		if (!test(s, t))
+			STAT_INC(s->lost);
+		clear(s, t);
+		s->passed[SLOT(t)] = idx;
+	}
+	if (!test(s, seq))
+		STAT_INC(s->lost);
+	set(s, seq);
+	s->next = seq + 1;
+}
+
+static void reorder(struct seq *s, uint64_t extent, uint64_t distance)
+{
+	s->extent[bucket(extent)]++;
+	s->distance[bucket(distance)]++;
+	if (extent > s->max_extent)
+		s->max_extent = extent;
+	if (distance > s->max_distance)
+		s->max_distance = distance;
+}
+
+/* Account for a received packet, returns what kind of arrival, SEQ_* */
+int seq_update(struct seq *s, uint64_t seq)
+{
+	uint32_t idx = s->arrivals++;
+
+	if (!s->next) {
+		start(s, seq);
+		STAT_INC(s->packets);
+		return SEQ_FIRST;
+	}
+
+	if (seq >= s->next) {
+		int rc = seq == s->next ? SEQ_NEXT : SEQ_GAP;
+
+		advance(s, seq, idx);
+		STAT_INC(s->packets);
+		return rc;
+	}
+
+	if (seq + SEQ_WINDOW < s->next) {
+		/* a sender restarting from 1 is more likely than a very late packet */
+		if (seq <= SEQ_WINDOW) {
+			STAT_ADD(s->lost, seq_missing(s));
+			STAT_INC(s->resets);
+			start(s, seq);
+			STAT_INC(s->packets);
+			return SEQ_RESET;
+		}
+
+		STAT_INC(s->stale);
+		return SEQ_STALE;
+	}
+
+	/* before the first packet, passed by every arrival since */
+	if (seq < s->base) {
+		uint64_t bit = 1ULL << (SLOT(seq) % 64);
+
+		if (s->early[SLOT(seq) / 64] & bit) {
+			STAT_INC(s->dups);
+			return SEQ_DUP;
+		}
+		s->early[SLOT(seq) / 64] |= bit;
+		STAT_INC(s->packets);
+		STAT_INC(s->late);
+		reorder(s, idx, s->next - seq);
+
+		return SEQ_LATE;
+	}
+
+	if (test(s, seq)) {
+		STAT_INC(s->dups);
+		return SEQ_DUP;
+	}
+
+	set(s, seq);
+	STAT_INC(s->packets);
+	STAT_INC(s->late);
+	reorder(s, idx - s->passed[SLOT(seq)], s->next - seq);
+
+	return SEQ_LATE;
+}
+
+static void buckets(FILE *fp, const char *name, const uint64_t *b, uint64_t max)
+{
+	fprintf(fp, "  %-16s", name);
+	for (int i = 1; i < SEQ_BUCKETS; i++) {
+		uint64_t lo = 1ULL << (i - 1), hi = (1ULL << i) - 1;
+
+		if (!b[i])
+			continue;
+
+		if (i == SEQ_BUCKETS - 1)
+			fprintf(fp, " %llu+:%llu", (unsigned long long)lo, (unsigned long long)b[i]);
+		else if (lo == hi)
+			fprintf(fp, " %llu:%llu", (unsigned long long)lo, (unsigned long long)b[i]);
+		else
+			fprintf(fp, " %llu-%llu:%llu", (unsigned long long)lo, (unsigned long long)hi,
+				(unsigned long long)b[i]);
+	}
+	fprintf(fp, ", max %llu\n", (unsigned long long)max);
+}
+
+/* Summary, packets still missing in the window are counted as lost */
+void seq_print(const struct seq *s, FILE *fp, const char *name)
+{
+	uint64_t lost = s->lost + seq_missing(s);
+	uint64_t total = s->packets + lost;
+
+	fprintf(fp, "%s: %llu packets, %llu lost (%.3f%%), %llu late, %llu duplicates",
+		name, (unsigned long long)s->packets, (unsigned long long)lost,
+		total ? 100.0 * lost / total : 0.0, (unsigned long long)s->late,
+		(unsigned long long)s->dups);
+	if (s->stale)
+		fprintf(fp, ", %llu too late", (unsigned long long)s->stale);
+	if (s->resets)
+		fprintf(fp, ", %llu resets", (unsigned long long)s->resets);
+	fprintf(fp, "\n");
+
+	if (!s->late)
+		return;
+
+	buckets(fp, "Reorder extent", s->extent, s->max_extent);
+	buckets(fp, "Reorder distance", s->distance, s->max_distance);
+}
+
+/**
+ * Local Variables:
+ *  c-file-style: "linux"
+ *  indent-tabs-mode: t
+ * End:
+ */
@@ -0,0 +1,71 @@
+/*
+ * seq.h -- Sequence number tracking, loss, reorder and duplicates
+ */
+
+#ifndef MTOOLS_SEQ_H_
+#define MTOOLS_SEQ_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define SEQ_WINDOW     1024	/* sequence numbers tracked, power of two */
+#define SEQ_WORDS      (SEQ_WINDOW / 64)
+#define SEQ_BUCKETS    16	/* log2 buckets for reorder extent/distance */
+
+/* Result of seq_update() */
+enum {
+	SEQ_FIRST,		/* first packet, or after a reset */
+	SEQ_NEXT,		/* in order, next expected */
+	SEQ_GAP,		/* ahead of next expected, skipped some */
+	SEQ_LATE,		/* reordered, previously skipped */
+	SEQ_DUP,		/* duplicate, already received */
+	SEQ_STALE,		/* older than window, already counted lost */
+	SEQ_RESET,		/* sender restarted its sequence */
+};
+
+/*
+ * Sliding window over the last SEQ_WINDOW sequence numbers, ending at the
+ * highest received.  A packet is counted lost first when its sequence
+ * number slides out of the window without having been received, so a
+ * late arrival within the window is counted as reordered, not as a loss.
+ */
+struct seq {
+	uint64_t next;		/* highest received + 1, 0: no packets yet */
+	uint64_t base;		/* first received, window start */
+	uint64_t arrivals;	/* arrival index, all packets */
+
+	uint64_t packets;	/* unique packets received */
+	uint64_t lost;		/* slid out of window without arriving */
+	uint64_t late;		/* reordered, arrived after a higher seq */
+	uint64_t dups;
+	uint64_t stale;		/* arrived after window, counted as lost */
+	uint64_t resets;
+
+	/*
+	 * RFC 4737 reorder extent: arrivals between the first packet with
+	 * a higher seq and the late packet.  Reorder distance: how many
+	 * sequence numbers behind next expected it arrived.
+	 */
+	uint64_t extent[SEQ_BUCKETS];
+	uint64_t distance[SEQ_BUCKETS];
+	uint64_t max_extent;
+	uint64_t max_distance;
+
+	uint64_t bitmap[SEQ_WORDS];	/* received, indexed by seq % SEQ_WINDOW */
+	uint32_t passed[SEQ_WINDOW];	/* arrival index when skipped */
+	uint64_t early[SEQ_WORDS];	/* received, older than base */
+};
+
+void     seq_init    (struct seq *s);
+int      seq_update  (struct seq *s, uint64_t seq);
+uint64_t seq_missing (const struct seq *s);
+void     seq_print   (const struct seq *s, FILE *fp, const char *name);
+
+#endif /* MTOOLS_SEQ_H_ */
+
+/**
+ * Local Variables:
+ *  c-file-style: "linux"
+ *  indent-tabs-mode: t
+ * End:
+ */
@@ -0,0 +1,274 @@
+/*
+ * size.c -- Datagram size profiles: fixed, sweep, or weighted mix
+ *
+ * A profile is given as one of:
+ *
+ *     SIZE                      fixed
+ *     FIRST-LAST[/STEP]         sweep, doubling, or in steps of STEP
+ *     SIZE[:WEIGHT],...         mix, each datagram picked at random
+ *     imix                      7:4:1 mix of 64, 576, and 1500 byte IP packets
+ *
+ * Sizes are UDP payload bytes.  Also counts packets per size seen, so
+ * throughput and loss can be broken down by size at exit.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "size.h"
+
+static int add(struct size_profile *sp, size_t size, unsigned int weight)
+{
+	if (sp->num >= SIZE_ENTRIES) {
+		errno = E2BIG;
+		return -1;
+	}
+
+	sp->ent[sp->num].size   = size;
+	sp->ent[sp->num].weight = weight;
+	sp->num++;
+
+	return 0;
+}
+
+static int number(const char *arg, char **end, size_t *val)
+{
+	unsigned long v;
+
+	errno = 0;
+	v = strtoul(arg, end, 10);
+	if (errno || *end == arg)
+		return -1;
+	*val = v;
+
+	return 0;
+}
+
+/* Sweep from first to last, both included */
+static int sweep(struct size_profile *sp, size_t first, size_t last, size_t step)
+{
+	size_t size = first;
+
+	if (last < first || (!step && !first))
+		goto fail;
+
+	while (size < last) {
+		if (add(sp, size, 1))
+			return -1;
+		size = step ? size + step : size * 2;
+	}
+
+	return add(sp, last, 1);
+fail:
+	errno = EINVAL;
+	return -1;
+}
+
+/* Parse profile, sizes must be min-max, hdrlen is IP + UDP for imix */
+int size_parse(struct size_profile *sp, const char *arg, size_t min, size_t max, size_t hdrlen)
+{
+	static const struct { size_t ip; unsigned int weight; } imix[] = {
+		{   64, 7 },
+		{  576, 4 },
+		{ 1500, 1 },
+	};
+	size_t a, b, step = 0;
+	char *end;
+
+	memset(sp, 0, sizeof(*sp));
+
+	if (!strcmp(arg, "imix")) {
+		sp->mode = SIZE_MIX;
+		for (size_t i = 0; i < sizeof(imix) / sizeof(imix[0]); i++) {
+			size_t size = imix[i].ip > hdrlen ? imix[i].ip - hdrlen : 0;
+
+			add(sp, size < min ? min : size, imix[i].weight);
+		}
+	} else if (strchr(arg, ',') || strchr(arg, ':')) {
+		sp->mode = SIZE_MIX;
+		while (*arg) {
+			unsigned long weight = 1;
+
+			if (number(arg, &end, &a))
+				goto fail;
+			if (*end == ':') {
+				arg = end + 1;
+				errno = 0;
+				weight = strtoul(arg, &end, 10);
+				if (errno || end == arg || !weight || weight > 1000000)
+					goto fail;
+			}
+			if (*end && *end != ',')
+				goto fail;
+			if (add(sp, a, weight))
+				return -1;
+			arg = *end ? end + 1 : end;
+		}
+	} else if (strchr(arg, '-')) {
+		sp->mode = SIZE_SWEEP;
+		if (number(arg, &end, &a) || *end != '-')
+			goto fail;
+		if (number(end + 1, &end, &b))
+			goto fail;
+		if (*end == '/' && (number(end + 1, &end, &step) || !step))
+			goto fail;
+		if (*end)
+			goto fail;
+		if (sweep(sp, a, b, step))
+			return -1;
+	} else {
+		sp->mode = SIZE_FIXED;
+		if (number(arg, &end, &a) || *end)
+			goto fail;
+		add(sp, a, 1);
+	}
+
+	if (!sp->num)
+		goto fail;
+
+	for (unsigned int i = 0; i < sp->num; i++) {
+		size_t size = sp->ent[i].size;
+
+		if (size < min || size > max) {
+			errno = ERANGE;
+			return -1;
+		}
+		if (size > sp->max)
+			sp->max = size;
+		sp->total += sp->ent[i].weight;
+		sp->mean  += size * sp->ent[i].weight;
+	}
+	sp->mean /= sp->total;
+
+	return 0;
+fail:
+	errno = EINVAL;
+	return -1;
+}
+
+/* Random size from mix, weighted, rng is per thread xorshift state */
+size_t size_pick(const struct size_profile *sp, uint64_t *rng)
+{
+	uint64_t x = *rng;
+	unsigned int r;
+
+	if (sp->num == 1)
+		return sp->ent[0].size;
+
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	*rng = x;
+
+	r = x % sp->total;
+	for (unsigned int i = 0; i < sp->num; i++) {
+		if (r < sp->ent[i].weight)
+			return sp->ent[i].size;
+		r -= sp->ent[i].weight;
+	}
+
+	return sp->ent[sp->num - 1].size;
+}
+
+static struct size_stat *lookup(struct size_stats *st, size_t size, uint64_t now)
+{
+	struct size_stat *e;
+
+	if (st->num && st->ent[st->hint].size == size)
+		return &st->ent[st->hint];
+
+	for (unsigned int i = 0; i < st->num; i++) {
+		if (st->ent[i].size == size) {
+			st->hint = i;
+			return &st->ent[i];
+		}
+	}
+
+	if (st->num >= SIZE_STATS)
+		return NULL;
+
+	st->hint = st->num++;
+	e = &st->ent[st->hint];
+	e->size  = size;
+	e->first = now;
+
+	return e;
+}
+
+void size_count(struct size_stats *st, size_t size, uint64_t gaps, uint64_t now)
+{
+	struct size_stat *e = lookup(st, size, now);
+
+	if (!e) {
+		st->other++;
+		return;
+	}
+
+	e->packets++;
+	e->bytes += size;
+	e->gaps  += gaps;
+	e->last   = now;
+}
+
+/* Merge counters from one thread, when done */
+void size_merge(struct size_stats *dst, const struct size_stats *src)
+{
+	for (unsigned int i = 0; i < src->num; i++) {
+		const struct size_stat *s = &src->ent[i];
+		struct size_stat *e = lookup(dst, s->size, s->first);
+
+		if (!e) {
+			dst->other += s->packets;
+			continue;
+		}
+
+		e->packets += s->packets;
+		e->bytes   += s->bytes;
+		e->gaps    += s->gaps;
+		if (s->first < e->first)
+			e->first = s->first;
+		if (s->last > e->last)
+			e->last = s->last;
+	}
+	dst->other += src->other;
+}
+
+static int cmp(const void *a, const void *b)
+{
+	const struct size_stat *x = a, *y = b;
+
+	return (x->size > y->size) - (x->size < y->size);
+}
+
+/* Table by size, rates over the time each size was seen */
+void size_print(const struct size_stats *st, FILE *fp, int gaps)
+{
+	struct size_stat ent[SIZE_STATS];
+
+	memcpy(ent, st->ent, st->num * sizeof(ent[0]));
+	qsort(ent, st->num, sizeof(ent[0]), cmp);
+
+	fprintf(fp, "      Size      Packets%s          pps         Mbps\n", gaps ? "         Gaps" : "");
+	for (unsigned int i = 0; i < st->num; i++) {
+		const struct size_stat *e = &ent[i];
+		double sec = (e->last - e->first) / 1e9;
+
+		fprintf(fp, "%10zu %12llu", e->size, (unsigned long long)e->packets);
+		if (gaps)
+			fprintf(fp, " %12llu", (unsigned long long)e->gaps);
+		if (sec > 0)
+			fprintf(fp, " %12.0f %12.2f\n", e->packets / sec, e->bytes * 8 / sec / 1e6);
+		else
+			fprintf(fp, " %12s %12s\n", "-", "-");
+	}
+	if (st->other)
+		fprintf(fp, "%10s %12llu\n", "other", (unsigned long long)st->other);
+}
+
+/**
+ * Local Variables:
+ *  c-file-style: "linux"
+ *  indent-tabs-mode: t
+ * End:
+ */
@@ -0,0 +1,66 @@
+/*
+ * size.h -- Datagram size profiles: fixed, sweep, or weighted mix
+ */
+
+#ifndef MTOOLS_SIZE_H_
+#define MTOOLS_SIZE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define SIZE_ENTRIES   64	/* sizes in a sweep or mix */
+#define SIZE_STATS     64	/* distinct sizes counted, the rest are other */
+#define SIZE_MAX_IPV4  65507	/* 65535 - IPv4 and UDP header */
+#define SIZE_MAX_IPV6  65527	/* 65535 - UDP header, payload length excludes IPv6 header */
+
+enum {
+	SIZE_FIXED,		/* one size */
+	SIZE_SWEEP,		/* each size in turn, for a while */
+	SIZE_MIX,		/* random per datagram, weighted */
+};
+
+struct size_profile {
+	int          mode;
+	unsigned int num;
+	struct {
+		size_t       size;
+		unsigned int weight;
+	} ent[SIZE_ENTRIES];
+	unsigned int total;	/* sum of weights */
+	size_t       max;
+	size_t       mean;	/* weighted, for pacing in bits/s */
+};
+
+/* Packets seen per datagram size, by one thread */
+struct size_stat {
+	size_t   size;
+	uint64_t packets;
+	uint64_t bytes;
+	uint64_t gaps;		/* sequence numbers skipped right before */
+	uint64_t first;		/* ns */
+	uint64_t last;
+};
+
+struct size_stats {
+	struct size_stat ent[SIZE_STATS];
+	unsigned int     num;
+	unsigned int     hint;	/* last used, sizes come in runs */
+	uint64_t         other;	/* packets of sizes not fitting */
+};
+
+int    size_parse  (struct size_profile *sp, const char *arg, size_t min, size_t max, size_t hdrlen);
+size_t size_pick   (const struct size_profile *sp, uint64_t *rng);
+
+void   size_count  (struct size_stats *st, size_t size, uint64_t gaps, uint64_t now);
+void   size_merge  (struct size_stats *dst, const struct size_stats *src);
+void   size_print  (const struct size_stats *st, FILE *fp, int gaps);
+
+#endif /* MTOOLS_SIZE_H_ */
+
+/**
+ * Local Variables:
+ *  c-file-style: "linux"
+ *  indent-tabs-mode: t
+ * End:
+ */
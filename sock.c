@@ -4,17 +4,23 @@
 
 #include <errno.h>
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>
 #include <net/if.h>
+#ifdef __linux__
+#include <netinet/udp.h>
+#include <linux/errqueue.h>
+#include <linux/filter.h>
+#endif
 
 #include "sock.h"
 
 
-int sock_create(inet_addr_t *ina, const char *ifname)
+int sock_create(inet_addr_t *ina, const char *ifname, int flags)
 {
 	int sd, on = 1;
 
-	sd = socket(ina->ss_family, SOCK_DGRAM, 0);
+	sd = socket(ina->ss_family, (flags & SOCK_F_STREAM) ? SOCK_STREAM : SOCK_DGRAM, 0);
 	if (sd < 0) {
 		perror("socket");
 		return sd;
@@ -26,6 +32,12 @@ int sock_create(inet_addr_t *ina, const char *ifname)
 		return -1;
 	}
 
+	if ((flags & SOCK_F_REUSEPORT) && setsockopt(sd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on))) {
+		perror("setsockopt() SO_REUSEPORT");
+		close(sd);
+		return -1;
+	}
+
 #ifdef __linux__
 	if (ifname) {
 		/* Bind to device, required for IPv6 link-local addresses */
@@ -48,6 +60,263 @@ int sock_create(inet_addr_t *ina, const char *ifname)
 	return sd;
 }
 
+/*
+ * Multicast is delivered to every socket bound to the group, reuseport
+ * groups (and SO_ATTACH_REUSEPORT_CBPF) only select among sockets for
+ * unicast.  So to shard a group over num sockets, each socket instead
+ * gets a classic BPF filter that accepts only its own share of the
+ * senders: hash(source [+ port]) % num == idx.  The filter runs before
+ * the packet is queued, so the rest are dropped cheaply in softirq.
+ *
+ * Offset 0 is the UDP header in a socket filter, the IP header is
+ * reached using the SKF_NET_OFF extension.
+ */
+int sock_steer(int sd, int family, int key, unsigned int num, unsigned int idx)
+{
+#ifdef __linux__
+	struct sock_filter code[32];
+	struct sock_fprog prog;
+	int i = 0;
+
+	if (family == AF_INET6) {
+		/* XOR fold the 128-bit source address */
+		code[i++] = (struct sock_filter)BPF_STMT(BPF_LD  | BPF_W | BPF_ABS, SKF_NET_OFF + 8);
+		for (int off = 12; off < 24; off += 4) {
+			code[i++] = (struct sock_filter)BPF_STMT(BPF_MISC | BPF_TAX, 0);
+			code[i++] = (struct sock_filter)BPF_STMT(BPF_LD  | BPF_W | BPF_ABS, SKF_NET_OFF + off);
+			code[i++] = (struct sock_filter)BPF_STMT(BPF_ALU | BPF_XOR | BPF_X, 0);
+		}
+	} else {
+		code[i++] = (struct sock_filter)BPF_STMT(BPF_LD  | BPF_W | BPF_ABS, SKF_NET_OFF + 12);
+	}
+
+	if (key == SOCK_STEER_FLOW) {
+		/* UDP source port */
+		code[i++] = (struct sock_filter)BPF_STMT(BPF_MISC | BPF_TAX, 0);
+		code[i++] = (struct sock_filter)BPF_STMT(BPF_LD  | BPF_H | BPF_ABS, 0);
+		code[i++] = (struct sock_filter)BPF_STMT(BPF_ALU | BPF_XOR | BPF_X, 0);
+	}
+
+	/* Knuth multiplicative hash, use the well mixed upper bits */
+	code[i++] = (struct sock_filter)BPF_STMT(BPF_ALU | BPF_MUL | BPF_K, 2654435761U);
+	code[i++] = (struct sock_filter)BPF_STMT(BPF_ALU | BPF_RSH | BPF_K, 16);
+	code[i++] = (struct sock_filter)BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, num);
+	code[i++] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, idx, 0, 1);
+	code[i++] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, 0xffffffff);
+	code[i++] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, 0);
+
+	prog.len    = i;
+	prog.filter = code;
+	if (setsockopt(sd, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog))) {
+		perror("setsockopt() SO_ATTACH_FILTER");
+		return -1;
+	}
+
+	return 0;
+#else
+	(void)sd;
+	(void)family;
+	(void)key;
+	(void)num;
+	(void)idx;
+	errno = EOPNOTSUPP;
+	perror("sock_steer");
+	return -1;
+#endif
+}
+
+/*
+ * Drop everything on the socket, for sockets only used to hold a group
+ * membership while the traffic is read some other way, e.g. AF_PACKET.
+ */
+int sock_drop(int sd)
+{
+#ifdef __linux__
+	struct sock_filter code[] = {
+		BPF_STMT(BPF_RET | BPF_K, 0),
+	};
+	struct sock_fprog prog = {
+		.len    = 1,
+		.filter = code,
+	};
+
+	if (setsockopt(sd, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog))) {
+		perror("setsockopt() SO_ATTACH_FILTER");
+		return -1;
+	}
+
+	return 0;
+#else
+	(void)sd;
+	errno = EOPNOTSUPP;
+	perror("sock_drop");
+	return -1;
+#endif
+}
+
+/*
+ * UDP generic segmentation offload: every send larger than size is cut
+ * into datagrams of size by the stack, or the NIC, after routing.  One
+ * trip through the stack for up to SOCK_GSO_MAX datagrams.
+ */
+int sock_gso(int sd, int size)
+{
+#ifdef __linux__
+	if (setsockopt(sd, SOL_UDP, UDP_SEGMENT, &size, sizeof(size))) {
+		perror("setsockopt() UDP_SEGMENT");
+		return -1;
+	}
+
+	return 0;
+#else
+	(void)sd;
+	(void)size;
+	errno = EOPNOTSUPP;
+	perror("sock_gso");
+	return -1;
+#endif
+}
+
+/*
+ * UDP receive offload: datagrams from the same flow, arriving back to
+ * back, may be read as one buffer, with the segment size in a control
+ * message.  Only the last segment may be shorter.
+ */
+int sock_gro(int sd)
+{
+#ifdef __linux__
+	int on = 1;
+
+	if (setsockopt(sd, SOL_UDP, UDP_GRO, &on, sizeof(on))) {
+		perror("setsockopt() UDP_GRO");
+		return -1;
+	}
+
+	return 0;
+#else
+	(void)sd;
+	errno = EOPNOTSUPP;
+	perror("sock_gro");
+	return -1;
+#endif
+}
+
+/* Segment size of a coalesced read, or 0 for a single datagram */
+size_t sock_gro_size(struct msghdr *msg)
+{
+#ifdef __linux__
+	struct cmsghdr *cmsg;
+
+	for (cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+		int size;
+
+		if (cmsg->cmsg_level != SOL_UDP || cmsg->cmsg_type != UDP_GRO)
+			continue;
+
+		memcpy(&size, CMSG_DATA(cmsg), sizeof(size));
+		return size > 0 ? size : 0;
+	}
+#else
+	(void)msg;
+#endif
+
+	return 0;
+}
+
+/*
+ * Allow MSG_ZEROCOPY sends, the kernel then pins the pages of the send
+ * buffer instead of copying, and tells us on the error queue when it is
+ * done with them, see sock_zc_drain().
+ */
+int sock_zerocopy(int sd)
+{
+#ifdef __linux__
+	int on = 1;
+
+	if (setsockopt(sd, SOL_SOCKET, SO_ZEROCOPY, &on, sizeof(on))) {
+		perror("setsockopt() SO_ZEROCOPY");
+		return -1;
+	}
+
+	return 0;
+#else
+	(void)sd;
+	errno = EOPNOTSUPP;
+	perror("sock_zerocopy");
+	return -1;
+#endif
+}
+
+/*
+ * Read all zerocopy completions from the error queue without blocking.
+ * Each covers a range of sends, numbered from zero per socket, and says
+ * if the kernel had to copy after all, e.g. device without scatter-gather,
+ * or looped back.  Returns number of completions read.
+ */
+int sock_zc_drain(int sd, sock_zc_cb_t cb, void *arg)
+{
+	int num = 0;
+#ifdef __linux__
+	char ctrl[CMSG_SPACE(sizeof(struct sock_extended_err) + sizeof(struct sockaddr_in6))];
+	struct msghdr msg = { 0 };
+
+	for (;;) {
+		struct sock_extended_err *ee = NULL;
+		struct cmsghdr *cmsg;
+
+		msg.msg_control    = ctrl;
+		msg.msg_controllen = sizeof(ctrl);
+		if (recvmsg(sd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+			break;
+
+		for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+			if ((cmsg->cmsg_level == SOL_IP   && cmsg->cmsg_type == IP_RECVERR) ||
+			    (cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR))
+				ee = (struct sock_extended_err *)CMSG_DATA(cmsg);
+		}
+
+		if (!ee || ee->ee_origin != SO_EE_ORIGIN_ZEROCOPY || ee->ee_errno)
+			continue;
+
+		cb(ee->ee_info, ee->ee_data, ee->ee_code & SO_EE_CODE_ZEROCOPY_COPIED, arg);
+		num++;
+	}
+#else
+	(void)sd;
+	(void)cb;
+	(void)arg;
+#endif
+
+	return num;
+}
+
+/*
+ * Kernel pacing, rate in bytes per second.  Enforced by the fq qdisc for
+ * any socket, and by TCP itself without fq.  The 32-bit option caps the
+ * rate at ~34 Gbps, anything above that is left unlimited.
+ */
+int sock_pacing(int sd, double rate)
+{
+#ifdef __linux__
+	unsigned int val = ~0U;
+
+	if (rate < val)
+		val = rate;
+	if (setsockopt(sd, SOL_SOCKET, SO_MAX_PACING_RATE, &val, sizeof(val))) {
+		perror("setsockopt() SO_MAX_PACING_RATE");
+		return -1;
+	}
+
+	return 0;
+#else
+	(void)sd;
+	(void)rate;
+	errno = EOPNOTSUPP;
+	perror("sock_pacing");
+	return -1;
+#endif
+}
+
 int sock_family(int sd)
 {
 	struct sockaddr_storage ss;
@@ -7,8 +7,29 @@
 
 #include "inet.h"
 
-int         sock_create  (inet_addr_t *ina, const char *ifname);
+#define SOCK_F_REUSEPORT  0x01	/* allow several sockets on same group:port */
+#define SOCK_F_STREAM     0x02	/* TCP instead of UDP, for ttcp */
+
+#define SOCK_STEER_SRC    1	/* shard by source address */
+#define SOCK_STEER_FLOW   2	/* shard by source address and port */
+
+#define SOCK_GSO_MAX      64	/* datagrams per send, UDP_MAX_SEGMENTS */
+#define SOCK_GSO_BUFSZ    65507	/* max UDP payload, all segments */
+#define SOCK_GRO_CTRLSZ   CMSG_SPACE(sizeof(int))
+
+/* sends lo..hi done, buffers free again, copied: kernel copied anyway */
+typedef void (*sock_zc_cb_t)(uint32_t lo, uint32_t hi, int copied, void *arg);
+
+int         sock_create  (inet_addr_t *ina, const char *ifname, int flags);
 int         sock_family  (int sd);
+int         sock_steer   (int sd, int family, int key, unsigned int num, unsigned int idx);
+int         sock_drop    (int sd);
+int         sock_gso     (int sd, int size);
+int         sock_gro     (int sd);
+size_t      sock_gro_size(struct msghdr *msg);
+int         sock_zerocopy(int sd);
+int         sock_zc_drain(int sd, sock_zc_cb_t cb, void *arg);
+int         sock_pacing  (int sd, double rate);
 int         sock_mc_loop (int sd, int loop);
 int         sock_mc_ttl  (int sd, int ttl);
 
@@ -0,0 +1,169 @@
+/*
+ * stream.c -- Per-source stream table for receivers
+ *
+ * A stream is what a receiver can tell apart: source address and port,
+ * the group it was sent to, and the sender and stream ID of the msend -n
+ * header.  Each stream has its own counters and sequence tracking, and
+ * the source address is formatted once, when the stream is first seen.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "stream.h"
+
+static uint64_t hash(const struct stream_key *k)
+{
+	uint64_t w[sizeof(*k) / sizeof(uint64_t)];
+	uint64_t h = 0;
+
+	memcpy(w, k, sizeof(w));
+	for (size_t i = 0; i < sizeof(w) / sizeof(w[0]); i++) {
+		h  = (h ^ w[i]) * 0x9e3779b97f4a7c15ULL;
+		h ^= h >> 29;
+	}
+
+	return h;
+}
+
+int stream_init(struct stream_tab *t, size_t size)
+{
+	memset(t, 0, sizeof(*t));
+
+	t->size = 16;
+	while (t->size < size)
+		t->size <<= 1;
+
+	t->slot = calloc(t->size, sizeof(*t->slot));
+	if (!t->slot)
+		return -1;
+	t->tail = &t->head;
+
+	return 0;
+}
+
+void stream_key(struct stream_key *k, const inet_addr_t *from, uint32_t group,
+		uint32_t sender, uint32_t stream)
+{
+	memset(k, 0, sizeof(*k));
+	if (from->ss_family == AF_INET6) {
+		const struct sockaddr_in6 *sin6 = (const struct sockaddr_in6 *)from;
+
+		memcpy(k->addr, &sin6->sin6_addr, sizeof(sin6->sin6_addr));
+		k->port = sin6->sin6_port;
+	} else {
+		const struct sockaddr_in *sin = (const struct sockaddr_in *)from;
+
+		memcpy(k->addr, &sin->sin_addr, sizeof(sin->sin_addr));
+		k->port = sin->sin_port;
+	}
+	k->family = from->ss_family;
+	k->group  = group;
+	k->sender = sender;
+	k->stream = stream;
+}
+
+static struct stream **probe(struct stream_tab *t, const struct stream_key *k, uint64_t h)
+{
+	size_t i = h & (t->size - 1);
+
+	while (t->slot[i]) {
+		if (t->slot[i]->hash == h && !memcmp(&t->slot[i]->key, k, sizeof(*k)))
+			break;
+		i = (i + 1) & (t->size - 1);
+	}
+
+	return &t->slot[i];
+}
+
+/* Double the table, streams stay where they are, only pointers move */
+static int grow(struct stream_tab *t)
+{
+	struct stream **old = t->slot;
+	size_t size = t->size;
+
+	t->slot = calloc(size * 2, sizeof(*t->slot));
+	if (!t->slot) {
+		t->slot = old;
+		return -1;
+	}
+	t->size = size * 2;
+
+	for (size_t i = 0; i < size; i++) {
+		if (old[i])
+			*probe(t, &old[i]->key, old[i]->hash) = old[i];
+	}
+	free(old);
+
+	return 0;
+}
+
+static struct stream *insert(struct stream_tab *t, struct stream **slot, const struct stream_key *k,
+			     uint64_t h, uint64_t now)
+{
+	struct stream *s;
+	inet_addr_t ina = { .ss_family = k->family };
+
+	if (t->count >= STREAM_MAX) {
+		errno = ENOSPC;
+		return NULL;
+	}
+
+	s = calloc(1, sizeof(*s));
+	if (!s)
+		return NULL;
+
+	s->key   = *k;
+	s->hash  = h;
+	s->first = now;
+	s->last  = now;
+	s->port  = ntohs(k->port);
+	seq_init(&s->seq);
+
+	if (k->family == AF_INET6)
+		memcpy(&((struct sockaddr_in6 *)&ina)->sin6_addr, k->addr, sizeof(struct in6_addr));
+	else
+		memcpy(&((struct sockaddr_in *)&ina)->sin_addr, k->addr, sizeof(struct in_addr));
+	if (!inet_address(&ina, s->str, sizeof(s->str)))
+		strcpy(s->str, "?");
+
+	*slot = s;
+	t->count++;
+
+	/* fully set up before other threads can see it */
+	__atomic_store_n(t->tail, s, __ATOMIC_RELEASE);
+	t->tail = &s->next;
+
+	/* keep load factor below 1/2 */
+	if (t->count * 2 > t->size && grow(t))
+		perror("stream table");
+
+	return s;
+}
+
+/* Look up stream, or add it if this is the first packet, NULL if full */
+struct stream *stream_get(struct stream_tab *t, const struct stream_key *k, uint64_t now)
+{
+	struct stream **slot, *s;
+	uint64_t h;
+
+	if (t->cache && !memcmp(&t->cache->key, k, sizeof(*k)))
+		return t->cache;
+
+	h = hash(k);
+	slot = probe(t, k, h);
+	s = *slot ? *slot : insert(t, slot, k, h, now);
+	if (s)
+		t->cache = s;
+
+	return s;
+}
+
+/**
+ * Local Variables:
+ *  c-file-style: "linux"
+ *  indent-tabs-mode: t
+ * End:
+ */
@@ -0,0 +1,92 @@
+/*
+ * stream.h -- Per-source stream table for receivers
+ */
+
+#ifndef MTOOLS_STREAM_H_
+#define MTOOLS_STREAM_H_
+
+#include <stdint.h>
+#include "inet.h"
+#include "seq.h"
+
+#define STREAM_MAX     65536	/* cap, e.g., on spoofed source flood */
+
+struct hist;
+
+/* Compact, fixed size, key: source, group and sender of msend -n header */
+struct stream_key {
+	uint8_t  addr[16];
+	uint16_t port;
+	uint16_t family;
+	uint32_t group;		/* index in receiver's group list */
+	uint32_t sender;	/* sender ID, 0 if no header */
+	uint32_t stream;	/* sub-stream of sender, e.g., thread */
+};
+
+struct stream {
+	struct stream_key key;
+	struct stream    *next;	/* all streams, in order of first packet */
+	uint64_t          hash;
+
+	uint64_t          packets;
+	uint64_t          bytes;
+	uint64_t          first;	/* receive time of first packet, ns */
+	uint64_t          last;		/* ... and of latest packet */
+
+	char              str[INET_ADDRSTR_LEN];	/* printable source */
+	in_port_t         port;				/* host byte order */
+
+	struct seq        seq;
+
+	/* -L, end-to-end latency, now and at last report, NULL if not tracked */
+	struct hist      *lat;
+
+	/* at last interval report, only used by the reporter */
+	struct {
+		uint64_t  packets;
+		uint64_t  bytes;
+		uint64_t  lost;
+		uint64_t  late;
+		uint64_t  dups;
+	} prev;
+};
+
+/*
+ * Open addressing, linear probing, hash table of pointers to streams, so
+ * entries never move when the table grows.  Only the owner thread looks
+ * up and inserts, other threads may walk the list of streams at any time
+ * using stream_first() and stream_next().
+ */
+struct stream_tab {
+	struct stream **slot;
+	size_t          size;	/* power of two */
+	size_t          count;
+
+	struct stream  *head;
+	struct stream **tail;
+	struct stream  *cache;	/* last looked up, often same as next */
+};
+
+int            stream_init  (struct stream_tab *t, size_t size);
+void           stream_key   (struct stream_key *k, const inet_addr_t *from, uint32_t group,
+			     uint32_t sender, uint32_t stream);
+struct stream *stream_get   (struct stream_tab *t, const struct stream_key *k, uint64_t now);
+
+static inline struct stream *stream_first(struct stream_tab *t)
+{
+	return __atomic_load_n(&t->head, __ATOMIC_ACQUIRE);
+}
+
+static inline struct stream *stream_next(struct stream *s)
+{
+	return __atomic_load_n(&s->next, __ATOMIC_ACQUIRE);
+}
+
+#endif /* MTOOLS_STREAM_H_ */
+
+/**
+ * Local Variables:
+ *  c-file-style: "linux"
+ *  indent-tabs-mode: t
+ * End:
+ */
@@ -0,0 +1,252 @@
+/*
+ * tstamp.c -- Kernel socket timestamps, SO_TIMESTAMPING and friends
+ *
+ * Software timestamps are taken by the kernel when a packet is received
+ * by the network stack, in CLOCK_REALTIME.  Hardware timestamps are
+ * taken by the NIC, in the time base of its PTP hardware clock, which
+ * must be synchronized with the system clock, e.g. using phc2sys, for
+ * the values to be comparable with send times.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#ifdef __linux__
+#include <linux/errqueue.h>
+#include <linux/if_packet.h>
+#include <linux/net_tstamp.h>
+#include <linux/sockios.h>
+#endif
+
+#include "tstamp.h"
+
+#ifdef __linux__
+static uint64_t ts_ns(const struct timespec *ts)
+{
+	return (uint64_t)ts->tv_sec * 1000000000 + ts->tv_nsec;
+}
+
+/* Ask driver to timestamp all received packets */
+static int hw_enable(int sd, const char *ifname)
+{
+	struct hwtstamp_config cfg = {
+		.tx_type   = HWTSTAMP_TX_OFF,
+		.rx_filter = HWTSTAMP_FILTER_ALL,
+	};
+	struct ifreq ifr;
+
+	if (!ifname) {
+		fputs("Need an interface (-I) for hardware timestamping.\n", stderr);
+		errno = EINVAL;
+		return -1;
+	}
+
+	memset(&ifr, 0, sizeof(ifr));
+	strncpy(ifr.ifr_name, ifname, IFNAMSIZ - 1);
+	ifr.ifr_data = (void *)&cfg;
+	if (ioctl(sd, SIOCSHWTSTAMP, &ifr)) {
+		perror("ioctl() SIOCSHWTSTAMP");
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Enable RX timestamps, software and, optionally, hardware.  Falls back
+ * to SO_TIMESTAMPNS on kernels without SO_TIMESTAMPING.
+ */
+int tstamp_rx_enable(int sd, const char *ifname, int hw)
+{
+	int flags = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE;
+	int on = 1;
+
+	if (hw) {
+		if (hw_enable(sd, ifname))
+			fputs("Hardware timestamping not available, using software.\n", stderr);
+		else
+			flags |= SOF_TIMESTAMPING_RX_HARDWARE | SOF_TIMESTAMPING_RAW_HARDWARE;
+	}
+
+	if (!setsockopt(sd, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)))
+		return 0;
+
+	if (setsockopt(sd, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on))) {
+		perror("setsockopt() SO_TIMESTAMPNS");
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Ask for NIC timestamps in a packet socket's ring instead of the kernel
+ * software receive time.  Frames that got one have TP_STATUS_TS_RAW_HARDWARE.
+ */
+int tstamp_packet_enable(int sd, const char *ifname)
+{
+	int flags = SOF_TIMESTAMPING_RAW_HARDWARE;
+
+	if (hw_enable(sd, ifname))
+		return -1;
+
+	if (setsockopt(sd, SOL_PACKET, PACKET_TIMESTAMP, &flags, sizeof(flags))) {
+		perror("setsockopt() PACKET_TIMESTAMP");
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Timestamps of a received message, in nanoseconds, 0 if not available */
+int tstamp_rx_parse(struct msghdr *msg, uint64_t *sw, uint64_t *hw)
+{
+	struct cmsghdr *cmsg;
+
+	*sw = *hw = 0;
+	for (cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+		struct timespec ts[3];
+
+		if (cmsg->cmsg_level != SOL_SOCKET)
+			continue;
+
+		switch (cmsg->cmsg_type) {
+		case SCM_TIMESTAMPING:
+			memcpy(ts, CMSG_DATA(cmsg), sizeof(ts));
+			*sw = ts_ns(&ts[0]);
+			*hw = ts_ns(&ts[2]);
+			break;
+		case SCM_TIMESTAMPNS:
+			memcpy(ts, CMSG_DATA(cmsg), sizeof(ts[0]));
+			*sw = ts_ns(&ts[0]);
+			break;
+		}
+	}
+
+	return *sw || *hw ? 0 : -1;
+}
+
+/*
+ * Enable software TX timestamps when a packet enters the qdisc and when
+ * it is handed to the driver.  Each datagram sent after this gets an ID,
+ * counting from zero, reported back with its timestamps.
+ */
+int tstamp_tx_enable(int sd)
+{
+	int flags = SOF_TIMESTAMPING_TX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE |
+		SOF_TIMESTAMPING_OPT_ID | SOF_TIMESTAMPING_OPT_TSONLY;
+	int sz = 4 << 20;
+
+	/* timestamps are queued on the error queue, charged to SO_RCVBUF */
+	setsockopt(sd, SOL_SOCKET, SO_RCVBUF, &sz, sizeof(sz));
+
+	/* SCHED since Linux 4.0, older kernels only have SND */
+	flags |= SOF_TIMESTAMPING_TX_SCHED;
+	if (!setsockopt(sd, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)))
+		return 0;
+
+	flags &= ~SOF_TIMESTAMPING_TX_SCHED;
+	if (setsockopt(sd, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags))) {
+		perror("setsockopt() SO_TIMESTAMPING");
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Read all queued TX timestamps from the socket error queue, without
+ * blocking, calling cb for each.  Returns number of timestamps read.
+ */
+int tstamp_tx_drain(int sd, tstamp_cb_t cb, void *arg)
+{
+	char ctrl[2 * TSTAMP_CTRLSZ];
+	struct msghdr msg = { 0 };
+	int num = 0;
+
+	for (;;) {
+		struct sock_extended_err *ee = NULL;
+		struct cmsghdr *cmsg;
+		uint64_t ts = 0;
+
+		msg.msg_control    = ctrl;
+		msg.msg_controllen = sizeof(ctrl);
+		if (recvmsg(sd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+			break;
+
+		for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+			if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPING) {
+				struct timespec t;
+
+				memcpy(&t, CMSG_DATA(cmsg), sizeof(t));
+				ts = ts_ns(&t);
+			} else if ((cmsg->cmsg_level == SOL_IP   && cmsg->cmsg_type == IP_RECVERR) ||
+				   (cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR)) {
+				ee = (struct sock_extended_err *)CMSG_DATA(cmsg);
+			}
+		}
+
+		if (!ee || ee->ee_origin != SO_EE_ORIGIN_TIMESTAMPING || !ts)
+			continue;
+
+		cb(ee->ee_data, ee->ee_info, ts, arg);
+		num++;
+	}
+
+	return num;
+}
+#else
+int tstamp_rx_enable(int sd, const char *ifname, int hw)
+{
+	(void)sd;
+	(void)ifname;
+	(void)hw;
+
+	errno = ENOSYS;
+	return -1;
+}
+
+int tstamp_packet_enable(int sd, const char *ifname)
+{
+	(void)sd;
+	(void)ifname;
+
+	errno = ENOSYS;
+	return -1;
+}
+
+int tstamp_rx_parse(struct msghdr *msg, uint64_t *sw, uint64_t *hw)
+{
+	(void)msg;
+
+	*sw = *hw = 0;
+	return -1;
+}
+
+int tstamp_tx_enable(int sd)
+{
+	(void)sd;
+
+	errno = ENOSYS;
+	return -1;
+}
+
+int tstamp_tx_drain(int sd, tstamp_cb_t cb, void *arg)
+{
+	(void)sd;
+	(void)cb;
+	(void)arg;
+
+	return 0;
+}
+#endif
+
+/**
+ * Local Variables:
+ *  c-file-style: "linux"
+ *  indent-tabs-mode: t
+ * End:
+ */
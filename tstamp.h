@@ -0,0 +1,34 @@
+/*
+ * tstamp.h -- Kernel socket timestamps, SO_TIMESTAMPING and friends
+ */
+
+#ifndef MTOOLS_TSTAMP_H_
+#define MTOOLS_TSTAMP_H_
+
+#include <stdint.h>
+#include <sys/socket.h>
+
+/* Room for SCM_TIMESTAMPING, or SCM_TIMESTAMPNS, per message */
+#define TSTAMP_CTRLSZ  128
+
+/* TX timestamp types, same as SCM_TSTAMP_* on Linux */
+#define TSTAMP_SND     0	/* handed to driver */
+#define TSTAMP_SCHED   1	/* entered packet scheduler (qdisc) */
+
+typedef void (*tstamp_cb_t)(uint32_t id, int type, uint64_t ts, void *arg);
+
+int tstamp_rx_enable     (int sd, const char *ifname, int hw);
+int tstamp_rx_parse      (struct msghdr *msg, uint64_t *sw, uint64_t *hw);
+int tstamp_packet_enable (int sd, const char *ifname);
+
+int tstamp_tx_enable     (int sd);
+int tstamp_tx_drain      (int sd, tstamp_cb_t cb, void *arg);
+
+#endif /* MTOOLS_TSTAMP_H_ */
+
+/**
+ * Local Variables:
+ *  c-file-style: "linux"
+ *  indent-tabs-mode: t
+ * End:
+ */
@@ -4,10 +4,6 @@
  * Test TCP connection.  Makes a connection on port 5001
  * and transfers fabricated buffers or data copied from stdin.
  *
- * Usable on 4.2, 4.3, and 4.1a systems by defining one of
- * BSD42 BSD43 (BSD41a)
- * Machines using System V with BSD sockets should define SYSV.
- *
  * Modified for operation under 4.2BSD, 18 Dec 84
  *      T.C. Slattery, USNA
  * Minor improvements, Mike Muuss and Terry Slattery, 16-Oct-85.
@@ -30,82 +26,74 @@
  */
 /* Modified by Yvan Pointurier (yp9x), University of Virginia - May 2002 */
 /* Modified by Joachim Nilsson (troglobit), GitHub - Jul 2015 */
+/*
+ * Rebuilt on the mtools inet and sock helpers: IPv4 and IPv6, unicast,
+ * and ASM or SSM multicast.  The SYSV and 4.2BSD compat code is gone,
+ * and all option state is kept per test, in struct ttcp.
+ */
 
-#define BSD43
-/* #define BSD42 */
-/* #define BSD41a */
-#if defined(sgi)
-#define SYSV
-#endif
-
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
-#include <signal.h>
 #include <ctype.h>
 #include <errno.h>
+#include <netdb.h>
 #include <unistd.h>
-#include <arpa/inet.h>
-#include <sys/types.h>
-#include <sys/socket.h>
-#include <netinet/in.h>
 #include <netinet/tcp.h>
-#include <netdb.h>
-#include <sys/time.h>		/* struct timeval */
-
-#if defined(SYSV)
-#include <sys/times.h>
-#include <sys/param.h>
-struct rusage {
-	struct timeval ru_utime, ru_stime;
-};
-#define RUSAGE_SELF 0
-#else
-#include <sys/resource.h>
+#ifdef __linux__
+#include <linux/sockios.h>
 #endif
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/select.h>
+
+#include "common.h"
+#include "pace.h"
+
+#define TTCP_PORT      5001
+#define TTCP_SENTINEL  4	/* UDP start/end marker, shorter than any data */
+
+/* One test, sender or receiver, as set up from the command line */
+struct ttcp {
+	int            trans;		/* 0=receive, !0=transmit mode */
+	int            udp;		/* 0 = tcp, !0 = udp */
+	int            sinkmode;	/* 0=normal I/O, !0=sink/source mode */
+	int            verbose;		/* 0=print basic info, 1=print cpu rate */
+	int            nodelay;		/* set TCP_NODELAY socket option */
+	int            b_flag;		/* use mread() */
+	int            debug;		/* set SO_DEBUG socket option */
+	char          *rate;		/* -R: pps, or bit/s with bps suffix */
+	int            fq;		/* -F: leave pacing to the kernel */
+	struct pace    pace;
+	int            ttl;		/* for multicast only */
+	int            family;		/* -4 or -6, 0: IPv4, as default for -r */
+	in_port_t      port;		/* TCP/UDP port number */
+	char          *ifname;		/* bind to, and join groups on */
+
+	char          *host;		/* -t: name or address of peer */
+	char          *group;		/* -r: multicast group to join */
+	char          *source;		/* -r: SSM source of group */
+	inet_addr_t    peer;		/* -t: where to connect, or send */
+
+	int            sd;		/* fd of network socket */
+	size_t         buflen;		/* length of buffer */
+	char          *buf;		/* ptr to dynamic buffer */
+	int            nbuf;		/* number of buffers to send in sinkmode */
+	int            bufoffset;	/* align buffer to this */
+	int            bufalign;	/* modulo this */
+
+	size_t         nbytes;		/* bytes on net */
+	size_t         calls;		/* # of I/O system calls */
+	struct timeval time0;		/* time at which timing started */
+	struct rusage  ru0;		/* resource utilization at the start */
+	double         cput, realt;	/* user, real time (seconds) */
+	char           stats[132];	/* as line in read_timer() */
+};
 
-struct sockaddr_in sinme;
-struct sockaddr_in sinhim;
-struct sockaddr_in frominet;
-
-socklen_t fromlen;
-int domain;
-int fd;				/* fd of network socket */
-
-size_t buflen = 8 * 1024;	/* length of buffer */
-char *buf;			/* ptr to dynamic buffer */
-int nbuf = 8 * 1024;		/* number of buffers to send in sinkmode */
-
-int bufoffset = 0;		/* align buffer to this */
-int bufalign = 16 * 1024;	/* modulo this */
-
-int udp = 0;			/* 0 = tcp, !0 = udp */
-int ttl = 100;			/* for multicast only */
-int options = 0;		/* socket options */
-int one = 1;			/* for 4.3 BSD style setsockopt() */
-short port = 5001;		/* TCP port number */
-char *host;			/* ptr to name of host */
-int trans;			/* 0=receive, !0=transmit mode */
-int sinkmode = 1;		/* 0=normal I/O, !0=sink/source mode */
-int verbose = 0;		/* 0=print basic info, 1=print cpu rate, proc
-				 * resource usage. */
-int nodelay = 0;		/* set TCP_NODELAY socket option */
-int b_flag = 0;			/* use mread() */
-int mcast = 0;			/* 1 = multicast reception, 0 = unicast */
-char *mgroup;			/* multicast group address */
-				    /*#define MAXPAK 32768           *//* max # of packets received */
-/*int rcvBytesArray[MAXPAK];   */
-/*double rcvTimeArray[MAXPAK]; */
-int rcvIndex = 0;		/* index in the arrays */
-long rate = 0;			/* sending rate */
-
-struct hostent *addr;
-extern int errno;
-
-char Usage[] = "\
+static const char *Usage = "\
 Usage: ttcp -t [-options] host [ < in ]\n\
        ttcp -r [-options > out]\n\
 Common options:\n\
+	-4	-t: resolve host name to IPv4, -r: listen on IPv4 (default)\n\
+	-6	-t: resolve host name to IPv6, -r: listen on IPv6\n\
+	-I IF	bind to interface, -r: join group on it, mandatory for IPv6 groups\n\
 	-l##	length of bufs read from or written to network (default 8192)\n\
 	-u	use UDP instead of TCP\n\
 	-p##	port number to send to or listen at (default 5001)\n\
@@ -118,37 +106,26 @@ Common options:\n\
 Options specific to -t:\n\
 	-n##	number of source bufs written to network (default 8192)\n\
 	-D	don't buffer TCP writes (sets TCP_NODELAY socket option)\n\
-	-iTTL   sets the ttl of the packets (multicast packets)\n\
-        -R##    slows down sending rate (higher values mean slower rates\n\
+	-iTTL	TTL, or hop limit, of multicast packets (default 1)\n\
+	-R RATE	pace writes, pps, or bit/s with bps suffix, e.g. 10k, 100Mbps\n\
+	-F	with -R, pace in the kernel, SO_MAX_PACING_RATE, needs fq for UDP\n\
 Options specific to -r:\n\
 	-B	for -s, only output full blocks as specified by -l (for TAR)\n\
-        -m IP   bind to a multicast group designated by its IP address\n\
+	-m GROUP  join IPv4 or IPv6 multicast group, with -u\n\
+	-S ADDR	  only from this source, source-specific multicast (SSM)\n\
 ";
 
-char stats[128];
-size_t nbytes;			/* bytes on net */
-size_t numCalls;		/* # of I/O system calls */
-
-void prep_timer();
-double read_timer();
-double cput, realt;		/* user, real time (seconds) */
-
-static void sigpipe()
-{
-}
-
-
-static void err(char *s)
+static void err(struct ttcp *t, char *s)
 {
-	fprintf(stderr, "ttcp%s: ", trans ? "-t" : "-r");
+	fprintf(stderr, "ttcp%s: ", t->trans ? "-t" : "-r");
 	perror(s);
 	fprintf(stderr, "errno=%d\n", errno);
 	exit(1);
 }
 
-static void mes(char *s)
+static void mes(struct ttcp *t, char *s)
 {
-	fprintf(stderr, "ttcp%s: %s\n", trans ? "-t" : "-r", s);
+	fprintf(stderr, "ttcp%s: %s\n", t->trans ? "-t" : "-r", s);
 }
 
 static void pattern(char *cp, size_t cnt)
@@ -162,6 +139,14 @@ static void pattern(char *cp, size_t cnt)
 	}
 }
 
+static int is_multicast(const inet_addr_t *ina)
+{
+	if (ina->ss_family == AF_INET6)
+		return IN6_IS_ADDR_MULTICAST(&((struct sockaddr_in6 *)ina)->sin6_addr);
+
+	return IN_MULTICAST(ntohl(((struct sockaddr_in *)ina)->sin_addr.s_addr));
+}
+
 static void tvadd(struct timeval *tsum, struct timeval *t0, struct timeval *t1)
 {
 
@@ -202,6 +187,145 @@ static void psecs(int l, char *cp)
 	sprintf(cp, "%d%d", i / 10, i % 10);
 }
 
+static void prusage(struct rusage *r0, struct rusage *r1, struct timeval *e, struct timeval *b, char *outp)
+{
+	struct timeval tdiff;
+	time_t t;
+	char *cp;
+	int i;
+	int ms;
+
+	t = (r1->ru_utime.tv_sec - r0->ru_utime.tv_sec) * 100 +
+	    (r1->ru_utime.tv_usec - r0->ru_utime.tv_usec) / 10000 +
+	    (r1->ru_stime.tv_sec - r0->ru_stime.tv_sec) * 100 + (r1->ru_stime.tv_usec - r0->ru_stime.tv_usec) / 10000;
+	ms = (e->tv_sec - b->tv_sec) * 100 + (e->tv_usec - b->tv_usec) / 10000;
+
+	cp = "%Uuser %Ssys %Ereal %P %Xi+%Dd %Mmaxrss %F+%Rpf %Ccsw";
+	for (; *cp; cp++) {
+		if (*cp != '%')
+			*outp++ = *cp;
+		else if (cp[1])
+			switch (*++cp) {
+
+			case 'U':
+				tvsub(&tdiff, &r1->ru_utime, &r0->ru_utime);
+				sprintf(outp, "%d.%01d", (int)tdiff.tv_sec, (int)tdiff.tv_usec / 100000);
+				END(outp);
+				break;
+
+			case 'S':
+				tvsub(&tdiff, &r1->ru_stime, &r0->ru_stime);
+				sprintf(outp, "%d.%01d", (int)tdiff.tv_sec, (int)tdiff.tv_usec / 100000);
+				END(outp);
+				break;
+
+			case 'E':
+				psecs(ms / 100, outp);
+				END(outp);
+				break;
+
+			case 'P':
+				sprintf(outp, "%d%%", (int)(t * 100 / ((ms ? ms : 1))));
+				END(outp);
+				break;
+
+			case 'W':
+				i = r1->ru_nswap - r0->ru_nswap;
+				sprintf(outp, "%d", i);
+				END(outp);
+				break;
+
+			case 'X':
+				sprintf(outp, "%d", t == 0 ? 0 : (int)((r1->ru_ixrss - r0->ru_ixrss) / t));
+				END(outp);
+				break;
+
+			case 'D':
+				sprintf(outp, "%d", t == 0 ? 0 : (int)((r1->ru_idrss + r1->ru_isrss - (r0->ru_idrss + r0->ru_isrss)) / t));
+				END(outp);
+				break;
+
+			case 'K':
+				sprintf(outp, "%d", t == 0 ? 0 : (int)(
+						((r1->ru_ixrss + r1->ru_isrss + r1->ru_idrss) -
+						 (r0->ru_ixrss + r0->ru_idrss + r0->ru_isrss)) / t));
+				END(outp);
+				break;
+
+			case 'M':
+				sprintf(outp, "%d", (int)(r1->ru_maxrss / 2));
+				END(outp);
+				break;
+
+			case 'F':
+				sprintf(outp, "%d", (int)(r1->ru_majflt - r0->ru_majflt));
+				END(outp);
+				break;
+
+			case 'R':
+				sprintf(outp, "%d", (int)(r1->ru_minflt - r0->ru_minflt));
+				END(outp);
+				break;
+
+			case 'I':
+				sprintf(outp, "%d", (int)(r1->ru_inblock - r0->ru_inblock));
+				END(outp);
+				break;
+
+			case 'O':
+				sprintf(outp, "%d", (int)(r1->ru_oublock - r0->ru_oublock));
+				END(outp);
+				break;
+			case 'C':
+				sprintf(outp, "%d+%d", (int)(r1->ru_nvcsw - r0->ru_nvcsw),
+					(int)(r1->ru_nivcsw - r0->ru_nivcsw));
+				END(outp);
+				break;
+			}
+	}
+	*outp = '\0';
+}
+
+/*
+ *			P R E P _ T I M E R
+ */
+static void prep_timer(struct ttcp *t)
+{
+	gettimeofday(&t->time0, NULL);
+	getrusage(RUSAGE_SELF, &t->ru0);
+}
+
+/*
+ *			R E A D _ T I M E R
+ * 
+ */
+static double read_timer(struct ttcp *t)
+{
+	struct timeval timedol;
+	struct rusage ru1;
+	struct timeval td;
+	struct timeval tend, tstart;
+	char line[132];
+
+	getrusage(RUSAGE_SELF, &ru1);
+	gettimeofday(&timedol, NULL);
+	prusage(&t->ru0, &ru1, &timedol, &t->time0, line);
+	snprintf(t->stats, sizeof(t->stats), "%s", line);
+
+	/* Get real time */
+	tvsub(&td, &timedol, &t->time0);
+	t->realt = td.tv_sec + ((double)td.tv_usec) / 1000000;
+
+	/* Get CPU time (user+sys) */
+	tvadd(&tend, &ru1.ru_utime, &ru1.ru_stime);
+	tvadd(&tstart, &t->ru0.ru_utime, &t->ru0.ru_stime);
+	tvsub(&td, &tend, &tstart);
+	t->cput = td.tv_sec + ((double)td.tv_usec) / 1000000;
+	if (t->cput < 0.00001)
+		t->cput = 0.00001;
+	return (t->cput);
+}
+
 /*
  *			M R E A D
  *
@@ -211,21 +335,21 @@ static void psecs(int l, char *cp)
  * network connections don't deliver data with the same
  * grouping as it is written with.  Written by Robert S. Miles, BRL.
  */
-static ssize_t mread(int fd, char *bufp, size_t len)
+static ssize_t mread(struct ttcp *t, char *bufp, size_t len)
 {
-	int nread;
+	ssize_t nread;
 	size_t bytes = 0;
 
 	do {
-		nread = read(fd, bufp, len - bytes);
-		numCalls++;
+		nread = read(t->sd, bufp, len - bytes);
+		t->calls++;
 		if (nread < 0) {
 			perror("ttcp_mread");
 			return (-1);
 		}
 		if (nread == 0)
-			return ((int)bytes);
-		bytes += (unsigned)nread;
+			return bytes;
+		bytes += nread;
 		bufp += nread;
 	} while (bytes < len);
 
@@ -235,21 +359,19 @@ static ssize_t mread(int fd, char *bufp, size_t len)
 /*
  *			N R E A D
  */
-static ssize_t Nread(int fd, char *buf, size_t len)
+static ssize_t Nread(struct ttcp *t, char *buf, size_t len)
 {
-	size_t bytes;
-	struct sockaddr_in from;
-	socklen_t from_len = sizeof(from);
+	ssize_t bytes;
 
-	if (udp) {
-		bytes = recvfrom(fd, buf, len, 0, (struct sockaddr *)&from, &from_len);
-		numCalls++;
+	if (t->udp) {
+		bytes = recv(t->sd, buf, len, 0);
+		t->calls++;
 	} else {
-		if (b_flag)
-			bytes = mread(fd, buf, len);	/* fill buf */
+		if (t->b_flag)
+			bytes = mread(t, buf, len);	/* fill buf */
 		else {
-			bytes = read(fd, buf, len);
-			numCalls++;
+			bytes = read(t->sd, buf, len);
+			t->calls++;
 		}
 	}
 
@@ -268,522 +390,434 @@ static void delay(int us)
 /*
  *			N W R I T E
  */
-static ssize_t Nwrite(int fd, char *buf, size_t len)
+static ssize_t Nwrite(struct ttcp *t, char *buf, size_t len)
 {
-	int i;
 	ssize_t bytes;
 
-	if (rate > 0)
-		for (i = 0; i < rate * 100; i++) ;
-	if (udp) {
+	if (t->udp) {
  again:
-		bytes = sendto(fd, buf, len, 0, (struct sockaddr *)&sinhim, sizeof(sinhim));
-		numCalls++;
+		bytes = sendto(t->sd, buf, len, 0, (struct sockaddr *)&t->peer, inet_addrlen(&t->peer));
+		t->calls++;
 		if (bytes < 0 && errno == ENOBUFS) {
 			delay(18000);
 			errno = 0;
 			goto again;
 		}
 	} else {
-		bytes = write(fd, buf, len);
-		numCalls++;
+		bytes = write(t->sd, buf, len);
+		t->calls++;
 	}
 
 	return bytes;
 }
 
+/*
+ * Wait for the pacer, if any, before writing len bytes.  Returns zero if
+ * interrupted by a signal.  With -F the kernel paces, writes block when
+ * the socket buffer is full.
+ */
+static int pace(struct ttcp *t, size_t len)
+{
+	if (!t->rate || t->fq)
+		return 1;
+
+	return pace_wait(&t->pace, len, 1);
+}
+
+/*
+ * With -F the last writes only queue data, which the kernel then paces
+ * out.  Wait for the send queue to drain, so the time, and the achieved
+ * rate, is that of the data leaving.
+ */
+static void drain(struct ttcp *t)
+{
+#ifdef SIOCOUTQ
+	int len;
+
+	while (!ioctl(t->sd, SIOCOUTQ, &len) && len > 0)
+		delay(1000);
+#else
+	(void)t;
+#endif
+}
+
+/* Target and achieved rate, and pacing error, of the data written */
+static void pace_stats(struct ttcp *t)
+{
+	double target, achieved;
+
+	if (!t->rate)
+		return;
+
+	if (!t->fq) {
+		fprintf(stdout, "#ttcp-t: ");
+		pace_report(&t->pace, stdout);
+		return;
+	}
+
+	target   = pace_rate(&t->pace, t->buflen) * 8 / 1e6;
+	achieved = t->nbytes * 8 / t->realt / 1e6;
+	fprintf(stdout, "#ttcp-t: Pacing: kernel, target %.2f Mbps, achieved %.2f Mbps, error %+.2f%%\n",
+		target, achieved, 100.0 * (achieved - target) / target);
+}
+
+/*
+ * Numeric address of any family, or name resolved in the family of -4/-6.
+ * Names default to IPv4, as the receiver, which listens on IPv4 only,
+ * while the first address of any family is often ::1 or another IPv6.
+ */
+static int resolve(struct ttcp *t)
+{
+	struct addrinfo hints = {
+		.ai_family   = t->family ? t->family : AF_INET,
+		.ai_socktype = t->udp ? SOCK_DGRAM : SOCK_STREAM,
+	};
+	struct addrinfo *ai;
+	int rc;
+
+	if (!inet_parse(&t->peer, t->host, t->port))
+		return 0;
+
+	rc = getaddrinfo(t->host, NULL, &hints, &ai);
+	if (rc) {
+		fprintf(stderr, "ttcp-t: %s: %s\n", t->host, gai_strerror(rc));
+		return -1;
+	}
+
+	memset(&t->peer, 0, sizeof(t->peer));
+	memcpy(&t->peer, ai->ai_addr, ai->ai_addrlen);
+	inet_set_port(&t->peer, t->port);
+	freeaddrinfo(ai);
+
+	return 0;
+}
+
+/* We are the client if transmitting, UDP to a group sets the TTL */
+static int sender(struct ttcp *t)
+{
+	inet_addr_t me = { .ss_family = t->peer.ss_family };	/* free choice */
+	int one = 1;
+
+	t->sd = sock_create(&me, t->ifname, t->udp ? 0 : SOCK_F_STREAM);
+	if (t->sd < 0)
+		return -1;
+	mes(t, "socket");
+
+	if (t->debug && setsockopt(t->sd, SOL_SOCKET, SO_DEBUG, &one, sizeof(one)) < 0)
+		err(t, "setsockopt");
+
+	if (t->udp) {
+		if (is_multicast(&t->peer)) {
+			if (sock_mc_ttl(t->sd, t->ttl))
+				return -1;
+			fprintf(stdout, "#TTL set to %d\n", t->ttl);
+		}
+	} else if (t->nodelay) {
+		if (setsockopt(t->sd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)) < 0)
+			err(t, "setsockopt: nodelay");
+		mes(t, "nodelay");
+	}
+
+	if (t->fq) {
+		if (sock_pacing(t->sd, pace_rate(&t->pace, t->buflen)))
+			return -1;
+		mes(t, "pacing");
+	}
+
+	if (!t->udp) {
+		if (connect(t->sd, (struct sockaddr *)&t->peer, inet_addrlen(&t->peer)) < 0)
+			err(t, "connect");
+		mes(t, "connect");
+	}
+
+	return 0;
+}
+
+/*
+ * Otherwise, we are the server and should listen for the connection, or
+ * with UDP bind to the port, or group and port, and join the group.
+ */
+static int receiver(struct ttcp *t)
+{
+	inet_addr_t me = { .ss_family = t->family ? t->family : AF_INET };
+	inet_addr_t from, src;
+	socklen_t len = sizeof(from);
+	char addr[INET_ADDRSTR_LEN];
+	int sd, one = 1;
+
+	if (t->group) {
+		if (inet_parse(&me, t->group, t->port) || !is_multicast(&me)) {
+			fprintf(stderr, "ttcp-r: invalid multicast group %s\n", t->group);
+			return -1;
+		}
+	} else
+		inet_set_port(&me, t->port);
+
+	if (t->source && (inet_parse(&src, t->source, 0) || src.ss_family != me.ss_family)) {
+		fprintf(stderr, "ttcp-r: invalid source %s for group %s\n", t->source, t->group);
+		return -1;
+	}
+
+	sd = sock_create(&me, t->ifname, t->udp ? 0 : SOCK_F_STREAM);
+	if (sd < 0)
+		return -1;
+	mes(t, "socket");
+
+	if (t->debug && setsockopt(sd, SOL_SOCKET, SO_DEBUG, &one, sizeof(one)) < 0)
+		err(t, "setsockopt");
+
+	if (t->group) {
+		if (sock_mc_join(sd, t->source ? &src : NULL, &me, t->ifname, 0, NULL))
+			return -1;
+		if (t->source)
+			fprintf(stdout, "#Joined group %s from %s\n", t->group, t->source);
+		else
+			fprintf(stdout, "#Joined group %s\n", t->group);
+	}
+
+	if (t->udp) {
+		t->sd = sd;
+		return 0;
+	}
+
+	listen(sd, 0);		/* allow a queue of 0 */
+	t->sd = accept(sd, (struct sockaddr *)&from, &len);
+	if (t->sd < 0)
+		err(t, "accept");
+	close(sd);
+
+	fprintf(stderr, "ttcp-r: accept from %s\n", inet_address(&from, addr, sizeof(addr)));
+
+	return 0;
+}
+
 int main(int argc, char *argv[])
 {
-	unsigned long addr_tmp;
+	struct ttcp test = {
+		.sinkmode = 1,
+		.ttl      = 1,
+		.port     = TTCP_PORT,
+		.sd       = -1,
+		.buflen   = 8 * 1024,
+		.nbuf     = 8 * 1024,
+		.bufalign = 16 * 1024,
+	};
+	struct ttcp *t = &test;
+	int c, i;
 
 	if (argc < 2)
 		goto usage;
 
-	argv++;
-	argc--;
-	while (argc > 0 && argv[0][0] == '-') {
-		switch (argv[0][1]) {
-
+	while ((c = getopt(argc, argv, "46A:BdDFhi:I:l:m:n:O:p:rR:sS:tuv")) != EOF) {
+		switch (c) {
+		case '4':
+			t->family = AF_INET;
+			break;
+		case '6':
+			t->family = AF_INET6;
+			break;
 		case 'B':
-			b_flag = 1;
+			t->b_flag = 1;
 			break;
 		case 't':
-			trans = 1;
+			t->trans = 1;
 			break;
 		case 'r':
-			trans = 0;
+			t->trans = 0;
 			break;
 		case 'd':
-			options |= SO_DEBUG;
+			t->debug = 1;
 			break;
 		case 'D':
-			nodelay = 1;
+			t->nodelay = 1;
+			break;
+		case 'F':
+			t->fq = 1;
 			break;
 		case 'n':
-			nbuf = atoi(&argv[0][2]);
+			t->nbuf = atoi(optarg);
 			break;
 		case 'l':
-			buflen = atoi(&argv[0][2]);
+			t->buflen = atoi(optarg);
 			break;
 		case 's':
-			sinkmode = 0;	/* sink/source data */
+			t->sinkmode = 0;	/* sink/source data */
 			break;
 		case 'p':
-			port = atoi(&argv[0][2]);
+			t->port = atoi(optarg);
 			break;
 		case 'u':
-			udp = 1;
+			t->udp = 1;
 			break;
 		case 'v':
-			verbose = 1;
+			t->verbose = 1;
 			break;
 		case 'A':
-			bufalign = atoi(&argv[0][2]);
+			t->bufalign = atoi(optarg);
 			break;
 		case 'O':
-			bufoffset = atoi(&argv[0][2]);
+			t->bufoffset = atoi(optarg);
 			break;
 		case 'i':
-			ttl = atoi(&argv[0][2]);
+			t->ttl = atoi(optarg);
+			break;
+		case 'I':
+			t->ifname = optarg;
 			break;
 		case 'R':
-			rate = atol(&argv[0][2]);
+			t->rate = optarg;
 			break;
 		case 'm':
-			mcast = 1;
-			argv++;
-			argc--;
-			if (argc > 0)
-				mgroup = argv[0];
-			else
-				goto usage;
+			t->group = optarg;
+			break;
+		case 'S':
+			t->source = optarg;
 			break;
 		default:
 			goto usage;
 		}
-		argv++;
-		argc--;
 	}
-	if (trans) {
+
+	if (t->trans) {
 		/* xmitr */
-		if (argc != 1)
+		if (optind != argc - 1 || t->group || t->source)
 			goto usage;
 
-		memset(&sinhim, 0, sizeof(sinhim));
-		host = argv[0];
-		if (atoi(host) > 0) {
-			/* Numeric */
-			sinhim.sin_family = AF_INET;
-#if defined(cray)
-			addr_tmp = inet_addr(host);
-			sinhim.sin_addr = addr_tmp;
-#else
-			sinhim.sin_addr.s_addr = inet_addr(host);
-#endif
-		} else {
-			if ((addr = gethostbyname(host)) == NULL)
-				err("bad hostname");
-			sinhim.sin_family = addr->h_addrtype;
-			memcpy(&addr_tmp, addr->h_addr, addr->h_length);
-#if defined(cray)
-			sinhim.sin_addr = addr_tmp;
-#else
-			sinhim.sin_addr.s_addr = addr_tmp;
-#endif	/* cray */
+		t->host = argv[optind];
+		if (resolve(t))
+			return 1;
+
+		if (t->fq && !t->rate) {
+			fprintf(stderr, "ttcp-t: -F needs a rate, use -R\n");
+			return 1;
+		}
+		if (t->rate && pace_init(&t->pace, t->rate, 1)) {
+			fprintf(stderr, "ttcp-t: invalid rate %s\n", t->rate);
+			return 1;
 		}
-		sinhim.sin_port = htons(port);
-		sinme.sin_port = 0;	/* free choice */
 	} else {
 		/* rcvr */
-		sinme.sin_port = htons(port);
+		if (optind != argc)
+			goto usage;
+		if (t->group && !t->udp) {
+			fprintf(stderr, "ttcp-r: multicast needs UDP, use -u\n");
+			return 1;
+		}
+		if (t->source && (!t->group || !t->ifname)) {
+			fprintf(stderr, "ttcp-r: SSM needs a group and an interface, use -m and -I\n");
+			return 1;
+		}
 	}
 
+	if (t->udp && t->buflen <= TTCP_SENTINEL)
+		t->buflen = TTCP_SENTINEL + 1;	/* send more than the sentinel size */
 
-	if (udp && buflen < 5) {
-		buflen = 5;	/* send more than the sentinel size */
-	}
-
-	buf = (char *)malloc(buflen + bufalign);
-	if (!buf)
-		err("malloc");
-	if (bufalign != 0)
-		buf += (bufalign - ((int)buf % bufalign) + bufoffset) % bufalign;
+	t->buf = malloc(t->buflen + t->bufalign);
+	if (!t->buf)
+		err(t, "malloc");
+	if (t->bufalign != 0)
+		t->buf += (t->bufalign - ((uintptr_t)t->buf % t->bufalign) + t->bufoffset) % t->bufalign;
 
-	if (trans) {
+	if (t->trans) {
 		fprintf(stdout,
 			"#ttcp-t: buflen=%zd, nbuf=%d, align=%d/+%d, port=%d  %s  -> %s\n",
-			buflen, nbuf, bufalign, bufoffset, port, udp ? "udp" : "tcp", argv[0]);
+			t->buflen, t->nbuf, t->bufalign, t->bufoffset, t->port, t->udp ? "udp" : "tcp", t->host);
+		if (sender(t))
+			return 1;
 	} else {
 		fprintf(stdout,
 			"#ttcp-r: buflen=%zd, nbuf=%d, align=%d/+%d, port=%d  %s\n",
-			buflen, nbuf, bufalign, bufoffset, port, udp ? "udp" : "tcp");
-	}
-
-	if ((fd = socket(AF_INET, udp ? SOCK_DGRAM : SOCK_STREAM, 0)) < 0)
-		err("socket");
-	mes("socket");
-
-	if (bind(fd, (struct sockaddr *)&sinme, sizeof(sinme)) < 0)
-		err("bind");
-
-	if (mcast) {
-		struct ip_mreq stMreq;
-		stMreq.imr_multiaddr.s_addr = inet_addr(mgroup);
-		stMreq.imr_interface.s_addr = INADDR_ANY;
-		if (setsockopt(fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, (char *)&stMreq, sizeof(stMreq)) < 0)
-			err("multicast group join");
-		else
-			fprintf(stdout, "#Joined group %s\n", mgroup);
+			t->buflen, t->nbuf, t->bufalign, t->bufoffset, t->port, t->udp ? "udp" : "tcp");
+		if (receiver(t))
+			return 1;
 	}
 
-	if (!udp) {
-		signal(SIGPIPE, sigpipe);
-		if (trans) {
-			/* We are the client if transmitting */
-			if (options) {
-#if defined(BSD42)
-				if (setsockopt(fd, SOL_SOCKET, options, 0, 0) < 0)
-#else	/* BSD43 */
-				if (setsockopt(fd, SOL_SOCKET, options, &one, sizeof(one)) < 0)
-#endif
-					err("setsockopt");
-			}
-			if (nodelay) {
-				struct protoent *p;
-				p = getprotobyname("tcp");
-				if (p && setsockopt(fd, p->p_proto, TCP_NODELAY, &one, sizeof(one)) < 0)
-					err("setsockopt: nodelay");
-				mes("nodelay");
-			}
-			if (connect(fd, (struct sockaddr *)&sinhim, sizeof(sinhim)) < 0)
-				err("connect");
-			mes("connect");
-		} else {
-			/* otherwise, we are the server and 
-			 * should listen for the connections
-			 */
-			listen(fd, 0);	/* allow a queue of 0 */
-			if (options) {
-#if defined(BSD42)
-				if (setsockopt(fd, SOL_SOCKET, options, 0, 0) < 0)
-#else	/* BSD43 */
-				if (setsockopt(fd, SOL_SOCKET, options, &one, sizeof(one)) < 0)
-#endif
-					err("setsockopt");
-			}
-
-			fromlen = sizeof(frominet);
-			domain = AF_INET;
-			if ((fd = accept(fd, (struct sockaddr *)&frominet, &fromlen)) < 0) {
-				err("accept");
-			} else {
-				struct sockaddr_in peer;
-				socklen_t peerlen = sizeof(peer);
-
-				if (getpeername(fd, (struct sockaddr *)&peer, &peerlen) < 0)
-					err("getpeername");
-
-				fprintf(stderr, "ttcp-r: accept from %s\n", inet_ntoa(peer.sin_addr));
-			}
-		}
-	}
+	/* print stats when receiver has died, write() gets EPIPE */
+	if (!t->udp)
+		signal(SIGPIPE, SIG_IGN);
 
-	prep_timer();
+	prep_timer(t);
 	errno = 0;
 
-	if (sinkmode) {
+	if (t->sinkmode) {
 		ssize_t cnt;
 
-		if (udp) {
-			int ret = 0;
-
-			if ((ntohl(sinhim.sin_addr.s_addr)) >> 28 == 0xe) {
-				ret = setsockopt(fd, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(int));
-				if (ret == -1)
-					fprintf(stderr, "Error while setting TTL\n");
-				else
-					fprintf(stdout, "#TTL set to %d\n", ttl);
-			}
-		}
-		if (trans) {
-			pattern(buf, buflen);
-			if (udp)
-				Nwrite(fd, buf, 4);	/* rcvr start */
-			while (nbuf-- && Nwrite(fd, buf, buflen) == (ssize_t)buflen)
-				nbytes += buflen;
-			if (udp)
-				Nwrite(fd, buf, 4);	/* rcvr end */
+		if (t->trans) {
+			pattern(t->buf, t->buflen);
+			if (t->udp)
+				Nwrite(t, t->buf, TTCP_SENTINEL);	/* rcvr start */
+			while (t->nbuf-- && pace(t, t->buflen) && Nwrite(t, t->buf, t->buflen) == (ssize_t)t->buflen)
+				t->nbytes += t->buflen;
+			if (t->udp)
+				Nwrite(t, t->buf, TTCP_SENTINEL);	/* rcvr end */
 		} else {
-			if (udp) {
-				while ((cnt = Nread(fd, buf, buflen)) > 0) {
-/*
-//yp9x: allow for duplicate starting packet
-				    static int going = 2; 
-				    if( cnt <= 4 )  {
-					    if( going == 0) 
-						    break; 
-					    going--;
-					    prep_timer();
-*/
+			if (t->udp) {
+				int going = 0;
 
-/*
-//original version
-				    static int going = 0; 
-				    if( cnt <= 4 )  {
-					    if( going ) 
-						    break; 
-					    going=1; 
-					    prep_timer();
-
-*/
-					static int going = 0;
-					if (cnt <= 4) {
+				while ((cnt = Nread(t, t->buf, t->buflen)) > 0) {
+					if (cnt <= TTCP_SENTINEL) {
 						if (going)
 							break;
 						going = 1;
-						prep_timer();
-
+						prep_timer(t);
 					} else {
-						nbytes += cnt;
-						read_timer(stats, sizeof(stats));
-//                                          fprintf(stdout, "%f\t%d\n", realt, nbytes); 
-						rcvIndex++;
+						t->nbytes += cnt;
+						read_timer(t);
 					}
 				}
 			} else {
-				while ((cnt = Nread(fd, buf, buflen)) > 0) {
-					nbytes += cnt;
+				while ((cnt = Nread(t, t->buf, t->buflen)) > 0) {
+					t->nbytes += cnt;
 				}
 			}
 		}
 	} else {
 		ssize_t cnt;
 
-		if (trans) {
-			while ((cnt = read(0, buf, buflen)) > 0 && Nwrite(fd, buf, cnt) == cnt)
-				nbytes += cnt;
+		if (t->trans) {
+			while ((cnt = read(0, t->buf, t->buflen)) > 0 && pace(t, cnt) && Nwrite(t, t->buf, cnt) == cnt)
+				t->nbytes += cnt;
 		} else {
-			while ((cnt = Nread(fd, buf, buflen)) > 0 && write(1, buf, cnt) == cnt)
-				nbytes += cnt;
+			while ((cnt = Nread(t, t->buf, t->buflen)) > 0 && write(1, t->buf, cnt) == cnt)
+				t->nbytes += cnt;
 		}
 	}
 	if (errno)
-		err("IO");
-	read_timer(stats, sizeof(stats));
-	if (udp && trans) {
-		Nwrite(fd, buf, 4);	/* rcvr end */
-		Nwrite(fd, buf, 4);	/* rcvr end */
-		Nwrite(fd, buf, 4);	/* rcvr end */
-		Nwrite(fd, buf, 4);	/* rcvr end */
-		Nwrite(fd, buf, 4);	/* rcvr end *//* yp9x */
-		Nwrite(fd, buf, 4);	/* rcvr end *//* yp9x */
-		Nwrite(fd, buf, 4);	/* rcvr end *//* yp9x */
-		Nwrite(fd, buf, 4);	/* rcvr end *//* yp9x */
+		err(t, "IO");
+	if (t->trans && t->fq)
+		drain(t);
+	read_timer(t);
+	if (t->udp && t->trans) {
+		/* more rcvr end, in case some are lost, yp9x */
+		for (i = 0; i < 8; i++)
+			Nwrite(t, t->buf, TTCP_SENTINEL);
 	}
-	if (cput <= 0.0)
-		cput = 0.001;
-	if (realt <= 0.0)
-		realt = 0.001;
-	fprintf(stdout, "#ttcp%s: %ld bytes in %.2f real seconds = %.2f KB/sec +++\n",
-		trans ? "-t" : "-r", nbytes, realt, ((double)nbytes) / realt / 1024);
-	if (verbose) {
+	if (t->cput <= 0.0)
+		t->cput = 0.001;
+	if (t->realt <= 0.0)
+		t->realt = 0.001;
+	fprintf(stdout, "#ttcp%s: %zd bytes in %.2f real seconds = %.2f KB/sec +++\n",
+		t->trans ? "-t" : "-r", t->nbytes, t->realt, ((double)t->nbytes) / t->realt / 1024);
+	if (t->verbose) {
 		fprintf(stdout,
-			"#ttcp%s: %ld bytes in %.2f CPU seconds = %.2f KB/cpu sec\n",
-			trans ? "-t" : "-r", nbytes, cput, ((double)nbytes) / cput / 1024);
+			"#ttcp%s: %zd bytes in %.2f CPU seconds = %.2f KB/cpu sec\n",
+			t->trans ? "-t" : "-r", t->nbytes, t->cput, ((double)t->nbytes) / t->cput / 1024);
 	}
 	fprintf(stdout, "#ttcp%s: %zd I/O calls, msec/call = %.2f, calls/sec = %.2f\n",
-		trans ? "-t" : "-r", numCalls, 1024.0 * realt / ((double)numCalls), ((double)numCalls) / realt);
-	fprintf(stdout, "#ttcp%s: %s\n", trans ? "-t" : "-r", stats);
-	if (verbose) {
-		fprintf(stdout, "#ttcp%s: buffer address %p\n", trans ? "-t" : "-r", buf);
+		t->trans ? "-t" : "-r", t->calls, 1024.0 * t->realt / ((double)t->calls),
+		((double)t->calls) / t->realt);
+	fprintf(stdout, "#ttcp%s: %s\n", t->trans ? "-t" : "-r", t->stats);
+	if (t->trans)
+		pace_stats(t);
+	if (t->verbose) {
+		fprintf(stdout, "#ttcp%s: buffer address %p\n", t->trans ? "-t" : "-r", t->buf);
 	}
-/*	printStats(); */
-	exit(0);
+
+	return 0;
 
  usage:
 	fprintf(stderr, "%s", Usage);
-	exit(1);
-}
-
-
-static struct timeval time0;	/* Time at which timing started */
-static struct rusage ru0;	/* Resource utilization at the start */
-
-static void prusage();
-static void tvadd();
-static void tvsub();
-static void psecs();
-
-#if defined(SYSV)
- /*ARGSUSED*/ static getrusage(ignored, ru)
-int ignored;
-struct rusage *ru;
-{
-	struct tms buf;
-
-	times(&buf);
-
-	/* Assumption: HZ <= 2147 (LONG_MAX/1000000) */
-	ru->ru_stime.tv_sec = buf.tms_stime / HZ;
-	ru->ru_stime.tv_usec = ((buf.tms_stime % HZ) * 1000000) / HZ;
-	ru->ru_utime.tv_sec = buf.tms_utime / HZ;
-	ru->ru_utime.tv_usec = ((buf.tms_utime % HZ) * 1000000) / HZ;
-}
-
-#if !defined(sgi)
- /*ARGSUSED*/ static gettimeofday(tp, zp)
-struct timeval *tp;
-struct timezone *zp;
-{
-	tp->tv_sec = time(0);
-	tp->tv_usec = 0;
-}
-#endif
-#endif	/* SYSV */
-
-/*
- *			P R E P _ T I M E R
- */
-void prep_timer(void)
-{
-	gettimeofday(&time0, (struct timezone *)0);
-	getrusage(RUSAGE_SELF, &ru0);
-}
-
-/*
- *			R E A D _ T I M E R
- * 
- */
-double read_timer(char *str, int len)
-{
-	struct timeval timedol;
-	struct rusage ru1;
-	struct timeval td;
-	struct timeval tend, tstart;
-	char line[132];
-
-	getrusage(RUSAGE_SELF, &ru1);
-	gettimeofday(&timedol, (struct timezone *)0);
-	prusage(&ru0, &ru1, &timedol, &time0, line);
-	strncpy(str, line, len);
-
-	/* Get real time */
-	tvsub(&td, &timedol, &time0);
-	realt = td.tv_sec + ((double)td.tv_usec) / 1000000;
-
-	/* Get CPU time (user+sys) */
-	tvadd(&tend, &ru1.ru_utime, &ru1.ru_stime);
-	tvadd(&tstart, &ru0.ru_utime, &ru0.ru_stime);
-	tvsub(&td, &tend, &tstart);
-	cput = td.tv_sec + ((double)td.tv_usec) / 1000000;
-	if (cput < 0.00001)
-		cput = 0.00001;
-	return (cput);
-}
-
-static void prusage(struct rusage *r0, struct rusage *r1, struct timeval *e, struct timeval *b, char *outp)
-{
-	struct timeval tdiff;
-	time_t t;
-	char *cp;
-	int i;
-	int ms;
-
-	t = (r1->ru_utime.tv_sec - r0->ru_utime.tv_sec) * 100 +
-	    (r1->ru_utime.tv_usec - r0->ru_utime.tv_usec) / 10000 +
-	    (r1->ru_stime.tv_sec - r0->ru_stime.tv_sec) * 100 + (r1->ru_stime.tv_usec - r0->ru_stime.tv_usec) / 10000;
-	ms = (e->tv_sec - b->tv_sec) * 100 + (e->tv_usec - b->tv_usec) / 10000;
-
-#if defined(SYSV)
-	cp = "%Uuser %Ssys %Ereal %P";
-#else
-	cp = "%Uuser %Ssys %Ereal %P %Xi+%Dd %Mmaxrss %F+%Rpf %Ccsw";
-#endif
-	for (; *cp; cp++) {
-		if (*cp != '%')
-			*outp++ = *cp;
-		else if (cp[1])
-			switch (*++cp) {
-
-			case 'U':
-				tvsub(&tdiff, &r1->ru_utime, &r0->ru_utime);
-				sprintf(outp, "%d.%01d", (int)tdiff.tv_sec, (int)tdiff.tv_usec / 100000);
-				END(outp);
-				break;
-
-			case 'S':
-				tvsub(&tdiff, &r1->ru_stime, &r0->ru_stime);
-				sprintf(outp, "%d.%01d", (int)tdiff.tv_sec, (int)tdiff.tv_usec / 100000);
-				END(outp);
-				break;
-
-			case 'E':
-				psecs(ms / 100, outp);
-				END(outp);
-				break;
-
-			case 'P':
-				sprintf(outp, "%d%%", (int)(t * 100 / ((ms ? ms : 1))));
-				END(outp);
-				break;
-
-#if !defined(SYSV)
-			case 'W':
-				i = r1->ru_nswap - r0->ru_nswap;
-				sprintf(outp, "%d", i);
-				END(outp);
-				break;
-
-			case 'X':
-				sprintf(outp, "%d", t == 0 ? 0 : (int)((r1->ru_ixrss - r0->ru_ixrss) / t));
-				END(outp);
-				break;
-
-			case 'D':
-				sprintf(outp, "%d", t == 0 ? 0 : (int)((r1->ru_idrss + r1->ru_isrss - (r0->ru_idrss + r0->ru_isrss)) / t));
-				END(outp);
-				break;
-
-			case 'K':
-				sprintf(outp, "%d", t == 0 ? 0 : (int)(
-						((r1->ru_ixrss + r1->ru_isrss + r1->ru_idrss) -
-						 (r0->ru_ixrss + r0->ru_idrss + r0->ru_isrss)) / t));
-				END(outp);
-				break;
-
-			case 'M':
-				sprintf(outp, "%d", (int)(r1->ru_maxrss / 2));
-				END(outp);
-				break;
-
-			case 'F':
-				sprintf(outp, "%d", (int)(r1->ru_majflt - r0->ru_majflt));
-				END(outp);
-				break;
-
-			case 'R':
-				sprintf(outp, "%d", (int)(r1->ru_minflt - r0->ru_minflt));
-				END(outp);
-				break;
-
-			case 'I':
-				sprintf(outp, "%d", (int)(r1->ru_inblock - r0->ru_inblock));
-				END(outp);
-				break;
-
-			case 'O':
-				sprintf(outp, "%d", (int)(r1->ru_oublock - r0->ru_oublock));
-				END(outp);
-				break;
-			case 'C':
-				sprintf(outp, "%d+%d", (int)(r1->ru_nvcsw - r0->ru_nvcsw),
-					(int)(r1->ru_nivcsw - r0->ru_nivcsw));
-				END(outp);
-				break;
-#endif	/* !SYSV */
-			}
-	}
-	*outp = '\0';
+	return 1;
 }
 
 /**
@@ -0,0 +1,322 @@
+/*
+ * uring.c -- Minimal io_uring, raw system calls, no liburing
+ *
+ * Only what the send and receive engines need: one submission and one
+ * completion queue mapped from the kernel, fixed files, registered
+ * buffers for zero-copy send, and a ring of provided buffers for
+ * multishot receive.  A ring is only ever used by
+ * one thread at a time.
+ *
+ * Every function returns -1 with errno set if the kernel lacks support,
+ * so callers can fall back to plain system calls.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "uring.h"
+
+#ifdef __linux__
+static int sys_setup(unsigned int entries, struct io_uring_params *p)
+{
+	return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_enter(int fd, unsigned int submit, unsigned int wait, unsigned int flags,
+		     void *arg, size_t argsz)
+{
+	return syscall(__NR_io_uring_enter, fd, submit, wait, flags, arg, argsz);
+}
+
+static int sys_register(int fd, unsigned int op, void *arg, unsigned int num)
+{
+	return syscall(__NR_io_uring_register, fd, op, arg, num);
+}
+
+int uring_init(struct uring *u, unsigned int entries)
+{
+	struct io_uring_params p;
+	uint8_t *sq, *cq;
+
+	memset(u, 0, sizeof(*u));
+	u->sq_map = u->cq_map = u->sqes = MAP_FAILED;
+
+	/*
+	 * Completions need not interrupt us, we always wait for them.  Not
+	 * SINGLE_ISSUER, rings are set up by main and used by a worker.
+	 */
+	memset(&p, 0, sizeof(p));
+	p.flags = IORING_SETUP_COOP_TASKRUN;
+	u->fd = sys_setup(entries, &p);
+	if (u->fd < 0 && errno == EINVAL) {
+		memset(&p, 0, sizeof(p));
+		u->fd = sys_setup(entries, &p);
+	}
+	if (u->fd < 0)
+		return -1;
+	u->features = p.features;
+
+	u->sq_size   = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	u->cq_size   = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	u->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+
+	u->sq_map = mmap(NULL, u->sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+			 u->fd, IORING_OFF_SQ_RING);
+	u->cq_map = mmap(NULL, u->cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+			 u->fd, IORING_OFF_CQ_RING);
+	u->sqes   = mmap(NULL, u->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+			 u->fd, IORING_OFF_SQES);
+	if (u->sq_map == MAP_FAILED || u->cq_map == MAP_FAILED || u->sqes == MAP_FAILED) {
+		uring_exit(u);
+		return -1;
+	}
+
+	sq = u->sq_map;
+	u->sq_head    = (unsigned int *)(sq + p.sq_off.head);
+	u->sq_tail    = (unsigned int *)(sq + p.sq_off.tail);
+	u->sq_array   = (unsigned int *)(sq + p.sq_off.array);
+	u->sq_mask    = *(unsigned int *)(sq + p.sq_off.ring_mask);
+	u->sq_entries = p.sq_entries;
+	u->sq_local   = *u->sq_tail;
+
+	cq = u->cq_map;
+	u->cq_head = (unsigned int *)(cq + p.cq_off.head);
+	u->cq_tail = (unsigned int *)(cq + p.cq_off.tail);
+	u->cq_mask = *(unsigned int *)(cq + p.cq_off.ring_mask);
+	u->cqes    = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+	return 0;
+}
+
+void uring_exit(struct uring *u)
+{
+	if (u->sqes && u->sqes != MAP_FAILED)
+		munmap(u->sqes, u->sqes_size);
+	if (u->cq_map && u->cq_map != MAP_FAILED)
+		munmap(u->cq_map, u->cq_size);
+	if (u->sq_map && u->sq_map != MAP_FAILED)
+		munmap(u->sq_map, u->sq_size);
+	u->sqes = u->cq_map = u->sq_map = NULL;
+
+	if (u->fd >= 0)
+		close(u->fd);
+	u->fd = -1;
+}
+
+/*
+ * Publish all new submissions and, optionally, wait for at least wait
+ * completions, or timeout ns if set.  One system call.  Returns number
+ * submitted, or -1 on error, with EINTR and ETIME when interrupted.
+ */
+int uring_submit(struct uring *u, unsigned int wait, uint64_t timeout_ns)
+{
+	unsigned int submit = u->sq_local - *u->sq_tail;
+	struct __kernel_timespec ts;
+	struct io_uring_getevents_arg arg = { 0 };
+	unsigned int flags = 0;
+
+	__atomic_store_n(u->sq_tail, u->sq_local, __ATOMIC_RELEASE);
+	if (wait)
+		flags |= IORING_ENTER_GETEVENTS;
+
+	if (wait && timeout_ns && (u->features & IORING_FEAT_EXT_ARG)) {
+		ts.tv_sec  = timeout_ns / 1000000000;
+		ts.tv_nsec = timeout_ns % 1000000000;
+		arg.ts     = (uint64_t)(uintptr_t)&ts;
+		return sys_enter(u->fd, submit, wait, flags | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+	}
+
+	return sys_enter(u->fd, submit, wait, flags, NULL, 0);
+}
+
+/*
+ * Check that rings, and provided buffers if bufs, work at all, they may
+ * be missing from the kernel, or disabled by sysctl or seccomp.
+ */
+int uring_probe(int bufs)
+{
+	struct uring_bufs b;
+	struct uring u;
+	int ret = 0;
+
+	if (uring_init(&u, 1))
+		return -1;
+	if (bufs) {
+		ret = uring_bufs_init(&u, &b, 0, 1, 64);
+		if (!ret)
+			uring_bufs_exit(&b);
+	}
+	uring_exit(&u);
+
+	return ret;
+}
+
+/* Register sockets, SQEs then use IOSQE_FIXED_FILE and an index */
+int uring_files(struct uring *u, const int *fds, unsigned int num)
+{
+	return sys_register(u->fd, IORING_REGISTER_FILES, (void *)fds, num) < 0 ? -1 : 0;
+}
+
+/* Register buffers, SQEs then use IORING_RECVSEND_FIXED_BUF and an index */
+int uring_buffers(struct uring *u, const struct iovec *iov, unsigned int num)
+{
+	return sys_register(u->fd, IORING_REGISTER_BUFFERS, (void *)iov, num) < 0 ? -1 : 0;
+}
+
+/* Ring of entries (power of two) buffers of size bytes, as group bgid */
+int uring_bufs_init(struct uring *u, struct uring_bufs *b, uint16_t bgid,
+		    unsigned int entries, size_t size)
+{
+	struct io_uring_buf_reg reg = { 0 };
+
+	memset(b, 0, sizeof(*b));
+	b->fd      = -1;
+	b->entries = entries;
+	b->size    = size;
+	b->bgid    = bgid;
+
+	b->br_size = entries * sizeof(struct io_uring_buf);
+	b->br = mmap(NULL, b->br_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (b->br == MAP_FAILED) {
+		b->br = NULL;
+		return -1;
+	}
+
+	b->base = malloc(entries * size);
+	if (!b->base) {
+		uring_bufs_exit(b);
+		return -1;
+	}
+
+	reg.ring_addr    = (uint64_t)(uintptr_t)b->br;
+	reg.ring_entries = entries;
+	reg.bgid         = bgid;
+	if (sys_register(u->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+		int err = errno;
+
+		uring_bufs_exit(b);
+		errno = err;
+		return -1;
+	}
+	b->fd = u->fd;
+
+	for (unsigned int i = 0; i < entries; i++)
+		uring_bufs_put(b, i);
+	uring_bufs_commit(b);
+
+	return 0;
+}
+
+/* Unregister the ring before unmapping it, the ring must still be open */
+void uring_bufs_exit(struct uring_bufs *b)
+{
+	if (b->fd >= 0) {
+		struct io_uring_buf_reg reg = { .bgid = b->bgid };
+
+		sys_register(b->fd, IORING_UNREGISTER_PBUF_RING, &reg, 1);
+		b->fd = -1;
+	}
+	if (b->br)
+		munmap(b->br, b->br_size);
+	b->br = NULL;
+	free(b->base);
+	b->base = NULL;
+}
+
+/* Give buffer back, to the kernel after uring_bufs_commit() */
+void uring_bufs_put(struct uring_bufs *b, uint16_t bid)
+{
+	struct io_uring_buf *buf = &b->br->bufs[b->tail & (b->entries - 1)];
+
+	buf->addr = (uint64_t)(uintptr_t)uring_bufs_get(b, bid);
+	buf->len  = b->size;
+	buf->bid  = bid;
+	b->tail++;
+}
+#else
+int uring_init(struct uring *u, unsigned int entries)
+{
+	(void)u;
+	(void)entries;
+
+	errno = ENOSYS;
+	return -1;
+}
+
+void uring_exit(struct uring *u)
+{
+	(void)u;
+}
+
+int uring_submit(struct uring *u, unsigned int wait, uint64_t timeout_ns)
+{
+	(void)u;
+	(void)wait;
+	(void)timeout_ns;
+
+	errno = ENOSYS;
+	return -1;
+}
+
+int uring_probe(int bufs)
+{
+	(void)bufs;
+
+	errno = ENOSYS;
+	return -1;
+}
+
+int uring_files(struct uring *u, const int *fds, unsigned int num)
+{
+	(void)u;
+	(void)fds;
+	(void)num;
+
+	errno = ENOSYS;
+	return -1;
+}
+
+int uring_buffers(struct uring *u, const struct iovec *iov, unsigned int num)
+{
+	(void)u;
+	(void)iov;
+	(void)num;
+
+	errno = ENOSYS;
+	return -1;
+}
+
+int uring_bufs_init(struct uring *u, struct uring_bufs *b, uint16_t bgid,
+		    unsigned int entries, size_t size)
+{
+	(void)u;
+	(void)b;
+	(void)bgid;
+	(void)entries;
+	(void)size;
+
+	errno = ENOSYS;
+	return -1;
+}
+
+void uring_bufs_exit(struct uring_bufs *b)
+{
+	(void)b;
+}
+
+void uring_bufs_put(struct uring_bufs *b, uint16_t bid)
+{
+	(void)b;
+	(void)bid;
+}
+#endif /* __linux__ */
+
+/**
+ * Local Variables:
+ *  c-file-style: "linux"
+ *  indent-tabs-mode: t
+ * End:
+ */
@@ -0,0 +1,139 @@
+/*
+ * uring.h -- Minimal io_uring, raw system calls, no liburing
+ */
+
+#ifndef MTOOLS_URING_H_
+#define MTOOLS_URING_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#ifdef __linux__
+#include <linux/io_uring.h>
+#endif
+
+struct uring {
+	int                  fd;
+	unsigned int         features;
+
+	/* submission queue */
+	unsigned int        *sq_head;
+	unsigned int        *sq_tail;
+	unsigned int        *sq_array;
+	unsigned int         sq_mask;
+	unsigned int         sq_entries;
+	unsigned int         sq_local;	/* tail, not yet published */
+	struct io_uring_sqe *sqes;
+
+	/* completion queue */
+	unsigned int        *cq_head;
+	unsigned int        *cq_tail;
+	unsigned int         cq_mask;
+	struct io_uring_cqe *cqes;
+
+	void                *sq_map;
+	size_t               sq_size;
+	void                *cq_map;
+	size_t               cq_size;
+	size_t               sqes_size;
+};
+
+/* Provided buffers, handed to the kernel in a ring, picked per completion */
+struct uring_bufs {
+	struct io_uring_buf_ring *br;
+	size_t               br_size;
+	uint8_t             *base;
+	size_t               size;	/* of each buffer */
+	unsigned int         entries;
+	unsigned int         tail;	/* not yet published */
+	uint16_t             bgid;
+	int                  fd;	/* of ring, once registered */
+};
+
+int  uring_init       (struct uring *u, unsigned int entries);
+void uring_exit       (struct uring *u);
+int  uring_submit     (struct uring *u, unsigned int wait, uint64_t timeout_ns);
+int  uring_probe      (int bufs);
+int  uring_files      (struct uring *u, const int *fds, unsigned int num);
+int  uring_buffers    (struct uring *u, const struct iovec *iov, unsigned int num);
+
+int  uring_bufs_init  (struct uring *u, struct uring_bufs *b, uint16_t bgid,
+		       unsigned int entries, size_t size);
+void uring_bufs_exit  (struct uring_bufs *b);
+void uring_bufs_put   (struct uring_bufs *b, uint16_t bid);
+
+#ifdef __linux__
+/* Next free submission entry, cleared, or NULL if the queue is full */
+static inline struct io_uring_sqe *uring_sqe(struct uring *u)
+{
+	unsigned int head = __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE);
+	struct io_uring_sqe *sqe;
+
+	if (u->sq_local - head >= u->sq_entries)
+		return NULL;
+
+	sqe = &u->sqes[u->sq_local & u->sq_mask];
+	memset(sqe, 0, sizeof(*sqe));
+	u->sq_array[u->sq_local & u->sq_mask] = u->sq_local & u->sq_mask;
+	u->sq_local++;
+
+	return sqe;
+}
+
+/* Next completion, or NULL if none, release it with uring_cqe_seen() */
+static inline struct io_uring_cqe *uring_cqe(struct uring *u)
+{
+	unsigned int head = *u->cq_head;
+
+	if (head == __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE))
+		return NULL;
+
+	return &u->cqes[head & u->cq_mask];
+}
+
+static inline void uring_cqe_seen(struct uring *u)
+{
+	__atomic_store_n(u->cq_head, *u->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+/* Make buffers given back with uring_bufs_put() visible to the kernel */
+static inline void uring_bufs_commit(struct uring_bufs *b)
+{
+	__atomic_store_n(&b->br->tail, (uint16_t)b->tail, __ATOMIC_RELEASE);
+}
+
+static inline void *uring_bufs_get(struct uring_bufs *b, uint16_t bid)
+{
+	return b->base + (size_t)bid * b->size;
+}
+
+/*
+ * Layout of a multishot recvmsg() buffer: header, source address and
+ * control messages, each of the size asked for, then the payload.
+ */
+static inline void *uring_recvmsg_name(struct io_uring_recvmsg_out *o)
+{
+	return o + 1;
+}
+
+static inline void *uring_recvmsg_control(struct io_uring_recvmsg_out *o, const struct msghdr *msg)
+{
+	return (uint8_t *)(o + 1) + msg->msg_namelen;
+}
+
+static inline void *uring_recvmsg_payload(struct io_uring_recvmsg_out *o, const struct msghdr *msg)
+{
+	return (uint8_t *)(o + 1) + msg->msg_namelen + msg->msg_controllen;
+}
+#endif /* __linux__ */
+
+#endif /* MTOOLS_URING_H_ */
+
+/**
+ * Local Variables:
+ *  c-file-style: "linux"
+ *  indent-tabs-mode: t
+ * End:
+ */